@@ -4,71 +4,135 @@
 
 #pragma once
 
+#include "HeaderMap.hxx"
 #include "net/AllocatedSocketAddress.hxx"
-#include "util/StaticVector.hxx"
 #include "config.h"
 
 #include <cstdint>
-#include <map>
+#include <memory>
 #include <optional>
 #include <string>
+#include <variant>
+#include <vector>
 
 enum class HttpMethod : uint_least8_t;
+class ExecTemplate;
+
+enum class StdinOption : uint_least8_t {
+	/**
+	 * Inherit Passage's stdin (usually /dev/null).
+	 */
+	NONE,
+
+	/**
+	 * A pipe filled with the request body.
+	 */
+	BODY,
+
+	/**
+	 * The file descriptor passed by the client with the request.
+	 */
+	FD,
+};
 
 enum class StderrOption : uint_least8_t {
 	JOURNAL,
 	PIPE,
 };
 
-struct Action {
-	static constexpr unsigned MAX_EXEC = 32;
-	static constexpr unsigned MAX_ENV = 32;
+struct ErrorAction {
+	/**
+	 * An optional error message (empty if none).
+	 */
+	std::string message;
 
-	enum class Type : uint_least8_t {
-		UNDEFINED,
-		ERROR,
+	HeaderMap response_headers;
+};
 
-		// deprecated: use control_client.build().fade_children()
-		FADE_CHILDREN,
+// deprecated: use control_client.build().fade_children()
+struct FadeChildrenAction {
+	AllocatedSocketAddress address;
 
-		// deprecated: use control_client.build().flush_http_cache()
-		FLUSH_HTTP_CACHE,
+	/**
+	 * An optional child tag (empty if none).
+	 */
+	std::string tag;
+};
 
-		EXEC_PIPE,
-#ifdef HAVE_CURL
-		HTTP_REQUEST,
-#endif
-	};
+// deprecated: use control_client.build().flush_http_cache()
+struct FlushHttpCacheAction {
+	AllocatedSocketAddress address;
 
-	std::map<std::string, std::string, std::less<>> response_headers;
+	std::string tag;
+};
 
-	AllocatedSocketAddress address;
+struct ExecPipeAction {
+	static constexpr unsigned MAX_EXEC = 32;
+	static constexpr unsigned MAX_ENV = 32;
+
+	/**
+	 * The program path and its arguments (at most #MAX_EXEC).
+	 */
+	std::vector<std::string> exec;
+
+	/**
+	 * Environment variables in the form "NAME=VALUE" (at most
+	 * #MAX_ENV).
+	 */
+	std::vector<std::string> env;
+
+	StdinOption stdin = StdinOption::NONE;
 
-	std::string param;
+	StderrOption stderr = StderrOption::JOURNAL;
 
-	StaticVector<std::string, MAX_EXEC> exec;
+	bool cgroup_client = false;
+};
+
+/**
+ * Like #ExecPipeAction, but with a prebuilt command line (see
+ * passage_exec_template()).
+ */
+struct ExecTemplateAction {
+	std::shared_ptr<const ExecTemplate> exec_template;
 
 	/**
-	 * Environment variables for #EXEC_PIPE.
+	 * Arguments appended to the template's arguments (at most
+	 * #ExecPipeAction::MAX_EXEC in total).
 	 */
-	StaticVector<std::string, MAX_ENV> env;
+	std::vector<std::string> args;
+};
 
 #ifdef HAVE_CURL
-	std::map<std::string, std::string, std::less<>> request_headers;
-	std::optional<std::string> body;
 
-	std::size_t max_size;
+struct HttpRequestAction {
+	std::string url;
 
-	HttpMethod http_method;
-#endif
+	HeaderMap request_headers;
 
-	Type type = Type::UNDEFINED;
+	std::optional<std::string> body;
 
-	StderrOption stderr = StderrOption::JOURNAL;
+	std::size_t max_size = 64 * 1024;
 
-	bool cgroup_client = false;
+	HttpMethod http_method{};
+};
+
+#endif // HAVE_CURL
 
-	constexpr bool IsDefined() const noexcept {
-		return type != Type::UNDEFINED;
-	}
+using ActionVariant = std::variant<ErrorAction,
+				   FadeChildrenAction,
+				   FlushHttpCacheAction,
+				   ExecPipeAction,
+				   ExecTemplateAction
+#ifdef HAVE_CURL
+				   , HttpRequestAction
+#endif
+				   >;
+
+/**
+ * An action returned by the Lua handler.  Each alternative contains
+ * only the data needed by one action type, so the Lua userdata is
+ * only as large as the largest of them.
+ */
+struct Action : ActionVariant {
+	using ActionVariant::variant;
 };
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility> // for std::exchange()
+#include <vector>
+
+/**
+ * A monotonic allocator for C++ objects which are only needed while
+ * one request is being handled.  Deallocation is a no-op; everything
+ * is freed at once by Reset() after the response has been sent.
+ *
+ * The first few kilobytes come from a buffer inside this object, so
+ * typical requests do not touch the heap at all.
+ */
+class RequestArena final : public std::pmr::memory_resource {
+	static constexpr std::size_t INITIAL_SIZE = 2048;
+
+	alignas(std::max_align_t) std::byte initial_buffer[INITIAL_SIZE];
+
+	std::pmr::monotonic_buffer_resource resource{
+		initial_buffer, sizeof(initial_buffer),
+	};
+
+	/**
+	 * The number of bytes allocated since the last Reset().
+	 */
+	std::size_t allocated = 0;
+
+public:
+	RequestArena() noexcept = default;
+
+	RequestArena(const RequestArena &) = delete;
+	RequestArena &operator=(const RequestArena &) = delete;
+
+	std::size_t GetAllocated() const noexcept {
+		return allocated;
+	}
+
+	/**
+	 * Free all allocations at once.
+	 *
+	 * @return the number of bytes which were allocated since the
+	 * last call
+	 */
+	std::size_t Reset() noexcept {
+		resource.release();
+		return std::exchange(allocated, 0);
+	}
+
+private:
+	/* virtual methods from class std::pmr::memory_resource */
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+		void *p = resource.allocate(bytes, alignment);
+		allocated += bytes;
+		return p;
+	}
+
+	void do_deallocate(void *, std::size_t, std::size_t) noexcept override {
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+		return this == &other;
+	}
+};
+
+/**
+ * Recycles #RequestArena objects, so the (large) initial buffer is
+ * not allocated and freed with each request.  This is bound to one
+ * thread; it does not need locking.
+ */
+class RequestArenaPool final {
+	/**
+	 * Keep at most this many unused arenas; more are freed.
+	 */
+	static constexpr std::size_t MAX_UNUSED = 64;
+
+	std::vector<std::unique_ptr<RequestArena>> unused;
+
+public:
+	RequestArenaPool() {
+		unused.reserve(MAX_UNUSED);
+	}
+
+	RequestArenaPool(const RequestArenaPool &) = delete;
+	RequestArenaPool &operator=(const RequestArenaPool &) = delete;
+
+	/**
+	 * Owns a #RequestArena and returns it to the pool when
+	 * destructed.
+	 */
+	class Lease {
+		RequestArenaPool &pool;
+
+		std::unique_ptr<RequestArena> arena;
+
+	public:
+		explicit Lease(RequestArenaPool &_pool)
+			:pool(_pool), arena(pool.Acquire()) {}
+
+		~Lease() noexcept {
+			pool.Release(std::move(arena));
+		}
+
+		Lease(const Lease &) = delete;
+		Lease &operator=(const Lease &) = delete;
+
+		RequestArena &operator*() const noexcept {
+			return *arena;
+		}
+
+		RequestArena *operator->() const noexcept {
+			return arena.get();
+		}
+	};
+
+private:
+	std::unique_ptr<RequestArena> Acquire() {
+		if (unused.empty())
+			return std::make_unique<RequestArena>();
+
+		auto arena = std::move(unused.back());
+		unused.pop_back();
+		return arena;
+	}
+
+	void Release(std::unique_ptr<RequestArena> &&arena) noexcept {
+		if (unused.size() < MAX_UNUSED) {
+			arena->Reset();
+			/* this doesn't allocate because the capacity
+			   was reserved by the constructor */
+			unused.emplace_back(std::move(arena));
+		}
+	}
+};
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Arena.hxx"
+#include "ChildWatch.hxx"
+#include "LuaConfig.hxx"
+#include "ReceiveBatch.hxx"
+#include "SharedCaches.hxx"
+#include "SpawnClient.hxx"
+#include "Stats.hxx"
+#include "io/Logger.hxx"
+#include "event/Loop.hxx"
+#include "config.h"
+
+#ifdef HAVE_CURL
+#include "lib/curl/Global.hxx"
+#endif
+
+#ifdef HAVE_URING
+#include "Uring.hxx"
+#endif
+
+#include <atomic>
+#include <memory>
+
+/**
+ * Everything which is bound to one #EventLoop and therefore to one
+ * thread: the configuration (with the Lua state which runs the
+ * handlers) and the contexts used by actions.  This is the base
+ * class of #Instance (the main thread) and #Worker.
+ */
+class BaseInstance {
+protected:
+	EventLoop event_loop;
+
+#ifdef HAVE_URING
+	/**
+	 * The io_uring backend for connections and listeners of this
+	 * event loop; nullptr if the kernel does not support it
+	 * (then they fall back to epoll).
+	 */
+	std::unique_ptr<UringBackend> uring;
+#endif
+
+#ifdef HAVE_CURL
+	CurlGlobal curl{event_loop};
+#endif
+
+	PassageStats stats;
+
+	/**
+	 * The current configuration; new connections use it.  It is
+	 * replaced by a configuration reload (see
+	 * passage_reload_config()).
+	 */
+	LuaConfigPtr config = std::make_shared<LuaConfig>(stats);
+
+	/**
+	 * Shared by all connections of this event loop.
+	 */
+	ReceiveBatch receive_batch;
+
+	/**
+	 * Recycles the arenas of #PassageRequest objects handled by
+	 * this event loop.
+	 */
+	RequestArenaPool arena_pool;
+
+	SharedCaches &shared_caches;
+
+	/**
+	 * Sends requests to the spawner process (see
+	 * StartSpawner()), whose socket is owned by #Instance.  If
+	 * there is no spawner (or it fails), processes are launched
+	 * directly with posix_spawn().
+	 */
+	SpawnClient spawn_client;
+
+	/**
+	 * The child processes spawned by this thread which occupy a
+	 * #ChildLimiter slot.
+	 */
+	ChildWatchList child_watches{event_loop, stats};
+
+	/**
+	 * The number of connections currently handled by this
+	 * object.  This is atomic because the main thread reads it
+	 * to find the least loaded worker.
+	 */
+	std::atomic_uint n_connections{0};
+
+public:
+	RootLogger logger;
+
+	BaseInstance(SharedCaches &_shared_caches,
+		     SocketDescriptor _spawner) noexcept
+		:shared_caches(_shared_caches),
+		 spawn_client(event_loop, _spawner)
+	{
+#ifdef HAVE_URING
+		try {
+			uring = std::make_unique<UringBackend>(event_loop);
+		} catch (...) {
+			logger(2, "io_uring not available, using epoll: ",
+			       std::current_exception());
+		}
+#endif
+	}
+
+	BaseInstance(const BaseInstance &) = delete;
+	BaseInstance &operator=(const BaseInstance &) = delete;
+
+	auto &GetEventLoop() noexcept {
+		return event_loop;
+	}
+
+#ifdef HAVE_CURL
+	auto &GetCurl() noexcept {
+		return curl;
+	}
+#endif
+
+#ifdef HAVE_URING
+	UringBackend *GetUring() noexcept {
+		return uring.get();
+	}
+#endif
+
+	PassageStats &GetStats() noexcept {
+		return stats;
+	}
+
+	LuaConfig &GetConfig() noexcept {
+		return *config;
+	}
+
+	const LuaConfigPtr &GetConfigPtr() const noexcept {
+		return config;
+	}
+
+	ReceiveBatch &GetReceiveBatch() noexcept {
+		return receive_batch;
+	}
+
+	RequestArenaPool &GetArenaPool() noexcept {
+		return arena_pool;
+	}
+
+	ResponseCache &GetResponseCache() noexcept {
+		return shared_caches.response;
+	}
+
+	CgroupCache &GetCgroupCache() noexcept {
+		return shared_caches.cgroup;
+	}
+
+	PeerAuthCache &GetPeerAuthCache() noexcept {
+		return shared_caches.peer_auth;
+	}
+
+	ChildLimiter &GetChildLimiter() noexcept {
+		return shared_caches.child_limiter;
+	}
+
+	ChildWatchList &GetChildWatches() noexcept {
+		return child_watches;
+	}
+
+	SpawnClient &GetSpawnClient() noexcept {
+		return spawn_client;
+	}
+
+	unsigned GetConnectionCount() const noexcept {
+		return n_connections.load(std::memory_order_relaxed);
+	}
+
+	void OnConnectionCreated() noexcept {
+		n_connections.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void OnConnectionDestroyed() noexcept {
+		n_connections.fetch_sub(1, std::memory_order_relaxed);
+	}
+};
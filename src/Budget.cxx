@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Budget.hxx"
+#include "Stats.hxx"
+#include "event/CoarseTimerEvent.hxx"
+
+#include <fmt/format.h>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * The address of this variable is the registry key of the
+ * #HandlerBudget pointer.
+ */
+static char budget_registry_key;
+
+static HandlerBudget *
+GetHandlerBudget(lua_State *L) noexcept
+{
+	lua_pushlightuserdata(L, &budget_registry_key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	auto *budget = static_cast<HandlerBudget *>(lua_touserdata(L, -1));
+	lua_pop(L, 1);
+	return budget;
+}
+
+HandlerBudget::~HandlerBudget() noexcept
+{
+	if (IsEnabled()) {
+		lua_sethook(main_L, nullptr, 0, 0);
+
+		lua_pushlightuserdata(main_L, &budget_registry_key);
+		lua_pushnil(main_L);
+		lua_rawset(main_L, LUA_REGISTRYINDEX);
+	}
+}
+
+void
+HandlerBudget::Set(uint_least64_t _max_instructions,
+		   Clock::duration _max_duration) noexcept
+{
+	max_instructions = _max_instructions;
+	max_duration = _max_duration;
+
+	lua_pushlightuserdata(main_L, &budget_registry_key);
+	if (IsEnabled())
+		lua_pushlightuserdata(main_L, this);
+	else
+		lua_pushnil(main_L);
+	lua_rawset(main_L, LUA_REGISTRYINDEX);
+}
+
+void
+HandlerBudget::Begin(lua_State *L, std::string_view command,
+		     CoarseTimerEvent &timer)
+{
+	if (!IsEnabled())
+		return;
+
+	invocations.insert_or_assign(L, Invocation{
+			.command = std::string{command},
+			.start = Clock::now(),
+		});
+
+	/* threads created before the budget was configured do not
+	   have the hook yet (with LuaJIT, hooks are global and this
+	   is a no-op) */
+	lua_sethook(L, Hook, LUA_MASKCOUNT, HOOK_INTERVAL);
+
+	/* the hook does not run while the handler waits for an
+	   asynchronous operation */
+	if (max_duration > Clock::duration::zero())
+		timer.Schedule(max_duration);
+}
+
+inline void
+HandlerBudget::SetExceeded(Invocation &invocation) noexcept
+{
+	if (!invocation.exceeded) {
+		invocation.exceeded = true;
+		++stats.budget_exceeded;
+	}
+}
+
+std::string
+HandlerBudget::Expire(lua_State *L)
+{
+	const auto i = invocations.find(L);
+	if (i == invocations.end())
+		return {};
+
+	auto &invocation = i->second;
+	SetExceeded(invocation);
+
+	return fmt::format("Handler for command '{}' has exceeded its budget"sv,
+			   invocation.command);
+}
+
+inline bool
+HandlerBudget::Check(Invocation &invocation) noexcept
+{
+	invocation.instructions += HOOK_INTERVAL;
+
+	if (max_instructions > 0 && invocation.instructions > max_instructions)
+		return true;
+
+	if (max_duration > Clock::duration::zero() &&
+	    Clock::now() - invocation.start > max_duration)
+		return true;
+
+	return false;
+}
+
+void
+HandlerBudget::Hook(lua_State *L, lua_Debug *)
+{
+	auto *budget = GetHandlerBudget(L);
+	if (budget == nullptr)
+		return;
+
+	const auto i = budget->invocations.find(L);
+	if (i == budget->invocations.end())
+		/* not a handler (e.g. the "reload" function) */
+		return;
+
+	auto &invocation = i->second;
+	if (!budget->Check(invocation))
+		return;
+
+	budget->SetExceeded(invocation);
+
+	/* keep raising this error (even if the handler catches it
+	   with pcall()) until the coroutine is dead */
+	lua_pushliteral(L, "Handler for command '");
+	lua_pushlstring(L, invocation.command.data(), invocation.command.size());
+	lua_pushliteral(L, "' has exceeded its budget");
+	lua_concat(L, 3);
+	lua_error(L);
+}
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+extern "C" {
+#include <lua.h>
+}
+
+struct PassageStats;
+class CoarseTimerEvent;
+
+/**
+ * Limits the number of Lua instructions and the time one handler
+ * invocation may use (see passage_handler_budget()).  This is
+ * enforced by a count hook which raises a Lua error when the budget
+ * is exceeded while Lua code runs, and by a timer which aborts
+ * handlers that are suspended (waiting for an asynchronous
+ * operation) when their time is up.
+ */
+class HandlerBudget {
+	/**
+	 * The hook is invoked after this number of Lua
+	 * instructions.
+	 */
+	static constexpr int HOOK_INTERVAL = 1000;
+
+	using Clock = std::chrono::steady_clock;
+
+	lua_State *const main_L;
+
+	PassageStats &stats;
+
+	/**
+	 * The maximum number of Lua instructions per invocation (0
+	 * means unlimited).
+	 */
+	uint_least64_t max_instructions = 0;
+
+	/**
+	 * The maximum wall-clock duration of an invocation (zero
+	 * means unlimited).
+	 */
+	Clock::duration max_duration{};
+
+	struct Invocation {
+		/**
+		 * The command of the request, for the error message.
+		 */
+		std::string command;
+
+		Clock::time_point start;
+
+		uint_least64_t instructions = 0;
+
+		bool exceeded = false;
+	};
+
+	/**
+	 * All handler invocations which are running (or waiting) at
+	 * the moment, keyed by their Lua thread.
+	 */
+	std::unordered_map<lua_State *, Invocation> invocations;
+
+public:
+	HandlerBudget(lua_State *_main_L, PassageStats &_stats) noexcept
+		:main_L(_main_L), stats(_stats) {}
+
+	~HandlerBudget() noexcept;
+
+	HandlerBudget(const HandlerBudget &) = delete;
+	HandlerBudget &operator=(const HandlerBudget &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return max_instructions > 0 || max_duration > Clock::duration::zero();
+	}
+
+	/**
+	 * Configure the budget.  Pass 0/zero to disable a limit.
+	 */
+	void Set(uint_least64_t _max_instructions,
+		 Clock::duration _max_duration) noexcept;
+
+	/**
+	 * A handler is about to be invoked on the given Lua thread.
+	 * Does nothing if no budget is configured.
+	 *
+	 * @param timer if there is a time limit, this timer is
+	 * scheduled to fire when it expires; its handler shall call
+	 * Expire() and abort the invocation
+	 */
+	void Begin(lua_State *L, std::string_view command,
+		   CoarseTimerEvent &timer);
+
+	/**
+	 * The time limit of the invocation on the given Lua thread
+	 * has expired while it was not running.  Count it as
+	 * exceeded.
+	 *
+	 * @return the error message
+	 */
+	std::string Expire(lua_State *L);
+
+	/**
+	 * Has the invocation on the given Lua thread exceeded its
+	 * budget?
+	 */
+	[[gnu::pure]]
+	bool IsExceeded(lua_State *L) const noexcept {
+		const auto i = invocations.find(L);
+		return i != invocations.end() && i->second.exceeded;
+	}
+
+	/**
+	 * The handler invocation on the given Lua thread has
+	 * finished.
+	 */
+	void End(lua_State *L) noexcept {
+		invocations.erase(L);
+	}
+
+private:
+	/**
+	 * @return true if the invocation has exceeded its budget
+	 */
+	bool Check(Invocation &invocation) noexcept;
+
+	void SetExceeded(Invocation &invocation) noexcept;
+
+	static void Hook(lua_State *L, lua_Debug *ar);
+};
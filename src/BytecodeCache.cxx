@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "BytecodeCache.hxx"
+#include "lua/Error.hxx"
+#include "io/Open.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/SpanCast.hxx"
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+#if __has_include(<luajit.h>)
+extern "C" {
+#include <luajit.h>
+}
+#endif
+
+#include <fmt/format.h>
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h> // for O_*
+#include <stdio.h> // for rename()
+#include <unistd.h> // for getpid(), unlink()
+
+#ifdef LUAJIT_VERSION
+static constexpr std::string_view lua_version = LUAJIT_VERSION;
+#else
+static constexpr std::string_view lua_version = LUA_RELEASE;
+#endif
+
+/**
+ * Feed a string into a 64 bit FNV-1a hash (including its null
+ * terminator, to separate it from the next string).
+ */
+static constexpr uint_least64_t
+FNV1aUpdate(uint_least64_t hash, std::string_view s) noexcept
+{
+	for (const char ch : s) {
+		hash ^= static_cast<unsigned char>(ch);
+		hash *= 0x100000001b3ULL;
+	}
+
+	hash *= 0x100000001b3ULL;
+	return hash;
+}
+
+/**
+ * Calculate the cache key of a source file.  The path is part of it
+ * because the bytecode contains the chunk name.
+ */
+static uint_least64_t
+CacheKey(std::string_view path, std::string_view source) noexcept
+{
+	uint_least64_t hash = 0xcbf29ce484222325ULL;
+	hash = FNV1aUpdate(hash, lua_version);
+	hash = FNV1aUpdate(hash, path);
+	hash = FNV1aUpdate(hash, source);
+	return hash;
+}
+
+static std::string
+ReadFile(FileDescriptor fd)
+{
+	std::string result;
+
+	while (true) {
+		char buffer[16384];
+		const auto nbytes = fd.Read(std::as_writable_bytes(std::span{buffer}));
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read");
+
+		if (nbytes == 0)
+			return result;
+
+		result.append(buffer, nbytes);
+	}
+}
+
+static int
+DumpWriter(lua_State *, const void *p, size_t size, void *ud) noexcept
+{
+	auto &bytecode = *(std::string *)ud;
+	bytecode.append((const char *)p, size);
+	return 0;
+}
+
+/**
+ * Write a dump of the function on the top of the stack to the cache.
+ * Errors are ignored; the worst case is that the next start has to
+ * compile the source again.
+ */
+static void
+StoreCache(lua_State *L, const std::string &cache_path) noexcept
+try {
+	std::string bytecode;
+	if (lua_dump(L, DumpWriter, &bytecode) != 0 || bytecode.empty())
+		return;
+
+	/* write to a temporary file and rename it, so other
+	   processes never see a partial dump */
+	const auto tmp_path = fmt::format("{}.{}.tmp", cache_path, getpid());
+
+	UniqueFileDescriptor fd;
+	if (!fd.Open(tmp_path.c_str(),
+		     O_CREAT|O_WRONLY|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0600))
+		return;
+
+	try {
+		fd.FullWrite(AsBytes(bytecode));
+	} catch (...) {
+		unlink(tmp_path.c_str());
+		return;
+	}
+
+	fd.Close();
+
+	if (rename(tmp_path.c_str(), cache_path.c_str()) < 0)
+		unlink(tmp_path.c_str());
+} catch (...) {
+}
+
+void
+LoadCachedFile(lua_State *L, const char *path, const char *cache_dir)
+{
+	const auto source = ReadFile(OpenReadOnly(path));
+	const auto chunk_name = fmt::format("@{}", path);
+	const auto cache_path = fmt::format("{}/{:016x}.luac", cache_dir,
+					    CacheKey(path, source));
+
+	if (UniqueFileDescriptor fd; fd.OpenReadOnly(cache_path.c_str())) {
+		std::string bytecode;
+
+		try {
+			bytecode = ReadFile(fd);
+		} catch (...) {
+			/* ignore the cache and compile the source */
+		}
+
+		if (!bytecode.empty()) {
+			if (luaL_loadbuffer(L, bytecode.data(), bytecode.size(),
+					    chunk_name.c_str()) == 0)
+				return;
+
+			/* pop the error message and compile the
+			   source */
+			lua_pop(L, 1);
+		}
+	}
+
+	if (luaL_loadbuffer(L, source.data(), source.size(),
+			    chunk_name.c_str()) != 0)
+		throw Lua::PopError(L);
+
+	StoreCache(L, cache_path);
+}
+
+void
+RunCachedFile(lua_State *L, const char *path, const char *cache_dir)
+{
+	LoadCachedFile(L, path, cache_dir);
+
+	if (lua_pcall(L, 0, 0, 0) != 0)
+		throw Lua::PopError(L);
+}
+
+static int
+l_cached_loader(lua_State *L)
+try {
+	const char *name = luaL_checkstring(L, 1);
+	const char *cache_dir = lua_tostring(L, lua_upvalueindex(1));
+
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "searchpath");
+	if (!lua_isfunction(L, -1))
+		/* LuaJIT 2.0 has no package.searchpath(); let the
+		   default loader handle this module */
+		return 0;
+
+	lua_pushstring(L, name);
+	lua_getfield(L, -3, "path");
+	lua_call(L, 2, 1);
+
+	if (!lua_isstring(L, -1))
+		/* not found; the default loader will report the
+		   error */
+		return 0;
+
+	const std::string path = lua_tostring(L, -1);
+	LoadCachedFile(L, path.c_str(), cache_dir);
+	return 1;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+void
+InstallCachedLoader(lua_State *L, const char *cache_dir)
+{
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "loaders");
+
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 2);
+		return;
+	}
+
+	/* insert our loader after the "preload" loader, i.e. before
+	   the default Lua file loader */
+	for (int i = lua_objlen(L, -1); i >= 2; --i) {
+		lua_rawgeti(L, -1, i);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	lua_pushstring(L, cache_dir);
+	lua_pushcclosure(L, l_cached_loader, 1);
+	lua_rawseti(L, -2, 2);
+
+	lua_pop(L, 2);
+}
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+struct lua_State;
+
+/**
+ * Load a Lua source file and push the compiled chunk on the stack.
+ * If the given cache directory contains a bytecode dump of this file
+ * (with the same contents, the same path and the same Lua/LuaJIT
+ * version), it is loaded instead of compiling the source; else the
+ * source is compiled and the dump is stored in the cache.
+ *
+ * Failing to write the cache is not an error.
+ *
+ * Throws on error.
+ */
+void
+LoadCachedFile(lua_State *L, const char *path, const char *cache_dir);
+
+/**
+ * Like Lua::RunFile(), but with LoadCachedFile().
+ *
+ * Throws on error.
+ */
+void
+RunCachedFile(lua_State *L, const char *path, const char *cache_dir);
+
+/**
+ * Install a module loader in "package.loaders" which loads Lua
+ * modules with LoadCachedFile(), so require() uses the cache, too.
+ * It needs package.searchpath() (LuaJIT 2.1); without it, this
+ * loader does nothing and modules are loaded the usual way.
+ */
+void
+InstallCachedLoader(lua_State *L, const char *cache_dir);
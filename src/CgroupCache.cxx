@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "CgroupCache.hxx"
+#include "io/Beneath.hxx"
+#include "io/FileAt.hxx"
+#include "io/Open.hxx"
+
+#include <cassert>
+#include <tuple> // for std::forward_as_tuple()
+
+#include <sys/inotify.h>
+
+CgroupCache::CgroupCache(EventLoop &event_loop, const RootLogger &_logger)
+	:logger(_logger), inotify(event_loop, *this)
+{
+}
+
+CgroupCache::~CgroupCache() noexcept = default;
+
+void
+CgroupCache::Disable() noexcept
+{
+	const std::scoped_lock lock{mutex};
+	enabled = false;
+	inotify.Disable();
+	map.clear();
+}
+
+inline void
+CgroupCache::Erase(decltype(map)::iterator i) noexcept
+{
+	/* the Item destructor removes it from #lru */
+	map.erase(i);
+}
+
+CgroupDirectoryPtr
+CgroupCache::Get(std::string_view path)
+{
+	assert(path.starts_with('/'));
+
+	const std::scoped_lock lock{mutex};
+
+	if (const auto i = map.find(path); i != map.end()) {
+		auto &item = i->second;
+
+		/* move to the front of the LRU list */
+		item.unlink();
+		lru.push_front(item);
+
+		return item.directory;
+	}
+
+	if (!sys_fs_cgroup.IsDefined())
+		sys_fs_cgroup = OpenPath("/sys/fs/cgroup");
+
+	const std::string relative{path.substr(1)};
+
+	if (!enabled)
+		return std::make_shared<const UniqueFileDescriptor>(OpenReadOnlyBeneath({sys_fs_cgroup, relative.c_str()}));
+
+	/* add the watch before opening the directory; this way, a
+	   removal in between cannot be missed */
+	int wd;
+	try {
+		wd = inotify.AddWatch(("/sys/fs/cgroup" + std::string{path}).c_str(),
+				      IN_DELETE_SELF|IN_ONLYDIR);
+	} catch (...) {
+		/* probably ENOSPC (fs.inotify.max_user_watches);
+		   this cgroup cannot be cached, but it can still be
+		   used */
+		return std::make_shared<const UniqueFileDescriptor>(OpenReadOnlyBeneath({sys_fs_cgroup, relative.c_str()}));
+	}
+
+	CgroupDirectoryPtr directory;
+
+	try {
+		directory = std::make_shared<const UniqueFileDescriptor>(OpenReadOnlyBeneath({sys_fs_cgroup, relative.c_str()}));
+	} catch (...) {
+		inotify.RemoveWatch(wd);
+		throw;
+	}
+
+	if (map.size() >= MAX_ITEMS) {
+		auto &oldest = lru.back();
+		inotify.RemoveWatch(oldest.watch_descriptor);
+
+		const auto i = map.find(*oldest.path);
+		assert(i != map.end());
+		Erase(i);
+	}
+
+	auto [i, inserted] = map.emplace(std::piecewise_construct,
+					 std::forward_as_tuple(path),
+					 std::forward_as_tuple(CgroupDirectoryPtr{directory}, wd));
+	assert(inserted);
+
+	auto &item = i->second;
+	item.path = &i->first;
+	lru.push_front(item);
+
+	return directory;
+}
+
+void
+CgroupCache::OnInotify(int wd, unsigned mask, const char *) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	/* cgroups are rarely removed, so a linear search is good
+	   enough */
+	for (auto i = map.begin(); i != map.end(); ++i) {
+		if (i->second.watch_descriptor == wd) {
+			/* after IN_DELETE_SELF, the kernel removes the
+			   watch by itself (and sends IN_IGNORED) */
+			if ((mask & (IN_DELETE_SELF|IN_IGNORED)) == 0)
+				inotify.RemoveWatch(wd);
+
+			Erase(i);
+			return;
+		}
+	}
+}
+
+void
+CgroupCache::OnInotifyError(std::exception_ptr error) noexcept
+{
+	logger(1, "inotify failed, disabling the cgroup cache: ", error);
+
+	const std::scoped_lock lock{mutex};
+	enabled = false;
+
+	/* the watches don't need to be removed: the inotify file
+	   descriptor is not used anymore */
+	map.clear();
+}
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "event/InotifyEvent.hxx"
+#include "io/Logger.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <cstddef>
+#include <functional> // for std::equal_to
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class EventLoop;
+
+/**
+ * A (read-only) directory file descriptor of a cgroup.  It remains
+ * valid even after it has been removed from the #CgroupCache.
+ */
+using CgroupDirectoryPtr = std::shared_ptr<const UniqueFileDescriptor>;
+
+/**
+ * Caches directory file descriptors of cgroups (in
+ * /sys/fs/cgroup), so spawning a process in a client's cgroup does
+ * not need to resolve its path each time.  Items are removed when
+ * the cgroup gets deleted (which is detected with inotify) and when
+ * the cache is full (least recently used first).
+ *
+ * This object is shared by all threads, but inotify events are
+ * handled by the #EventLoop passed to the constructor.  Worker
+ * threads call InotifyEvent::AddWatch() and
+ * InotifyEvent::RemoveWatch() directly; this is safe because these
+ * are plain inotify_add_watch() and inotify_rm_watch() system calls
+ * on a file descriptor which stays open until this object is
+ * destructed (after all workers have been joined), and they do not
+ * touch the #EventLoop.  All calls are serialized by #mutex and
+ * happen only while #enabled is set, which is cleared (with the
+ * #mutex held) before InotifyEvent::Disable() unregisters the file
+ * descriptor from the #EventLoop.
+ */
+class CgroupCache final : InotifyHandler {
+	static constexpr std::size_t MAX_ITEMS = 1024;
+
+	struct Hash : std::hash<std::string_view> {
+		using is_transparent = void;
+	};
+
+	struct Item final : AutoUnlinkIntrusiveListHook {
+		/**
+		 * Points to the key of this item in #CgroupCache::map.
+		 */
+		const std::string *path;
+
+		const CgroupDirectoryPtr directory;
+
+		/**
+		 * The inotify watch descriptor which detects the
+		 * removal of this cgroup.
+		 */
+		const int watch_descriptor;
+
+		Item(CgroupDirectoryPtr &&_directory,
+		     int _watch_descriptor) noexcept
+			:directory(std::move(_directory)),
+			 watch_descriptor(_watch_descriptor) {}
+
+		Item(const Item &) = delete;
+		Item &operator=(const Item &) = delete;
+	};
+
+	const RootLogger logger;
+
+	std::mutex mutex;
+
+	InotifyEvent inotify;
+
+	/**
+	 * Set to false if inotify has failed (or Disable() has been
+	 * called); since removed cgroups cannot be detected anymore,
+	 * nothing is cached after that.  Protected by #mutex.
+	 */
+	bool enabled = true;
+
+	/**
+	 * An O_PATH file descriptor of /sys/fs/cgroup; opened by the
+	 * first Get() call.
+	 */
+	UniqueFileDescriptor sys_fs_cgroup;
+
+	/**
+	 * All items; the most recently used one is at the front.
+	 * This must be declared before #map because the #Item
+	 * destructor unlinks it from this list.
+	 */
+	IntrusiveList<Item> lru;
+
+	std::unordered_map<std::string, Item, Hash, std::equal_to<>> map;
+
+public:
+	CgroupCache(EventLoop &event_loop, const RootLogger &_logger);
+	~CgroupCache() noexcept;
+
+	CgroupCache(const CgroupCache &) = delete;
+	CgroupCache &operator=(const CgroupCache &) = delete;
+
+	/**
+	 * Stop watching for removed cgroups.  Must be called in the
+	 * thread of the #EventLoop passed to the constructor.
+	 */
+	void Disable() noexcept;
+
+	/**
+	 * Obtain a read-only directory file descriptor of the given
+	 * cgroup, either from the cache or by opening it.
+	 *
+	 * Throws on error.
+	 *
+	 * @param path the cgroup path (as returned by
+	 * PeerAuth::GetCgroupPath(), i.e. beginning with a
+	 * slash)
+	 */
+	CgroupDirectoryPtr Get(std::string_view path);
+
+private:
+	void Erase(decltype(map)::iterator i) noexcept;
+
+	/* virtual methods from class InotifyHandler */
+	void OnInotify(int wd, unsigned mask, const char *name) noexcept override;
+	void OnInotifyError(std::exception_ptr error) noexcept override;
+};
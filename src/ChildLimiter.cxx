@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ChildLimiter.hxx"
+
+#include <cassert>
+
+template<typename Map, typename K>
+static unsigned
+GetCount(const Map &map, const K &key) noexcept
+{
+	const auto i = map.find(key);
+	return i != map.end() ? i->second : 0U;
+}
+
+template<typename Map, typename K>
+static void
+Decrement(Map &map, const K &key) noexcept
+{
+	const auto i = map.find(key);
+	assert(i != map.end());
+	assert(i->second > 0);
+
+	if (--i->second == 0)
+		map.erase(i);
+}
+
+inline bool
+ChildLimiter::Fits(const ChildOwner &owner) const noexcept
+{
+	return (limits.max_children == 0 ||
+		n_children < limits.max_children) &&
+		(limits.max_per_cgroup == 0 || owner.cgroup.empty() ||
+		 GetCount(per_cgroup, owner.cgroup) < limits.max_per_cgroup) &&
+		(limits.max_per_uid == 0 ||
+		 GetCount(per_uid, owner.uid) < limits.max_per_uid);
+}
+
+inline void
+ChildLimiter::Add(const ChildOwner &owner) noexcept
+{
+	++n_children;
+
+	if (!owner.cgroup.empty()) {
+		if (auto [i, inserted] = per_cgroup.try_emplace(owner.cgroup, 1);
+		    !inserted)
+			++i->second;
+	}
+
+	++per_uid[owner.uid];
+}
+
+void
+ChildLimiter::GrantWaiters() noexcept
+{
+	for (auto i = queue.begin(); i != queue.end();) {
+		if (limits.max_children > 0 && n_children >= limits.max_children)
+			break;
+
+		auto &waiter = *i;
+		if (!Fits(waiter.owner)) {
+			/* this one is held up by its own per-cgroup or
+			   per-uid limit; try the next one */
+			++i;
+			continue;
+		}
+
+		i = queue.erase(i);
+		--queue_length;
+
+		Add(waiter.owner);
+		waiter.OnChildSlotGranted();
+	}
+}
+
+void
+ChildLimiter::SetLimits(const ChildLimits &_limits) noexcept
+{
+	const std::scoped_lock lock{mutex};
+	limits = _limits;
+	GrantWaiters();
+}
+
+ChildLimiter::AcquireResult
+ChildLimiter::Acquire(ChildSlotWaiter &waiter) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	if (Fits(waiter.owner)) {
+		Add(waiter.owner);
+		return AcquireResult::GRANTED;
+	}
+
+	if (queue_length >= limits.max_queue)
+		return AcquireResult::REJECTED;
+
+	queue.push_back(waiter);
+	++queue_length;
+	return AcquireResult::QUEUED;
+}
+
+bool
+ChildLimiter::Cancel(ChildSlotWaiter &waiter) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	if (!waiter.is_linked())
+		return false;
+
+	waiter.unlink();
+	--queue_length;
+	return true;
+}
+
+void
+ChildLimiter::Release(const ChildOwner &owner) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	assert(n_children > 0);
+	--n_children;
+
+	if (!owner.cgroup.empty())
+		Decrement(per_cgroup, owner.cgroup);
+	Decrement(per_uid, owner.uid);
+
+	GrantWaiters();
+}
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "util/IntrusiveList.hxx"
+
+#include <chrono>
+#include <cstddef>
+#include <functional> // for std::equal_to
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility> // for std::exchange()
+
+#include <sys/types.h> // for uid_t
+
+/**
+ * Limits on the number of concurrently running child processes
+ * (see passage_child_limits()).  Zero means unlimited.
+ */
+struct ChildLimits {
+	/**
+	 * The maximum number of children of this process.
+	 */
+	unsigned max_children = 0;
+
+	/**
+	 * The maximum number of children spawned on behalf of
+	 * clients in one cgroup.
+	 */
+	unsigned max_per_cgroup = 0;
+
+	/**
+	 * The maximum number of children spawned on behalf of
+	 * clients with one uid.
+	 */
+	unsigned max_per_uid = 0;
+
+	/**
+	 * The maximum number of requests which wait for a slot;
+	 * requests beyond that are rejected immediately.
+	 */
+	unsigned max_queue = 0;
+
+	/**
+	 * How long a request may wait for a slot.
+	 */
+	std::chrono::steady_clock::duration queue_timeout = std::chrono::seconds{10};
+
+	/**
+	 * The "retry_after" value sent to rejected clients.
+	 */
+	std::chrono::seconds retry_after{1};
+
+	bool IsLimited() const noexcept {
+		return max_children > 0 || max_per_cgroup > 0 ||
+			max_per_uid > 0;
+	}
+};
+
+/**
+ * The client on whose behalf a child process is spawned.
+ */
+struct ChildOwner {
+	/**
+	 * The client's cgroup path; empty if the client has no
+	 * cgroup (or it cannot be determined), which exempts it from
+	 * the per-cgroup limit.  It is recorded even if there is no
+	 * per-cgroup limit, because passage_child_limits() may add
+	 * one while the slot is held.
+	 */
+	std::string cgroup;
+
+	uid_t uid;
+};
+
+class ChildLimiter;
+
+/**
+ * The permission to run one child process.  Its destructor releases
+ * the slot.
+ */
+class ChildSlot {
+	ChildLimiter *limiter = nullptr;
+
+	ChildOwner owner;
+
+public:
+	ChildSlot() noexcept = default;
+
+	ChildSlot(ChildLimiter &_limiter, ChildOwner &&_owner) noexcept
+		:limiter(&_limiter), owner(std::move(_owner)) {}
+
+	ChildSlot(ChildSlot &&src) noexcept
+		:limiter(std::exchange(src.limiter, nullptr)),
+		 owner(std::move(src.owner)) {}
+
+	~ChildSlot() noexcept {
+		Release();
+	}
+
+	ChildSlot &operator=(ChildSlot &&src) noexcept {
+		Release();
+		limiter = std::exchange(src.limiter, nullptr);
+		owner = std::move(src.owner);
+		return *this;
+	}
+
+	bool IsDefined() const noexcept {
+		return limiter != nullptr;
+	}
+
+	void Release() noexcept;
+};
+
+/**
+ * A request which waits in the #ChildLimiter queue.
+ */
+class ChildSlotWaiter : public IntrusiveListHook<IntrusiveHookMode::TRACK> {
+	friend class ChildLimiter;
+
+	ChildOwner owner;
+
+protected:
+	explicit ChildSlotWaiter(ChildOwner &&_owner) noexcept
+		:owner(std::move(_owner)) {}
+
+	~ChildSlotWaiter() noexcept = default;
+
+	const ChildOwner &GetOwner() const noexcept {
+		return owner;
+	}
+
+	ChildOwner &&StealOwner() noexcept {
+		return std::move(owner);
+	}
+
+	/**
+	 * A slot has been assigned to this waiter, which has been
+	 * removed from the queue.  This is called from an arbitrary
+	 * thread with the #ChildLimiter mutex locked.
+	 */
+	virtual void OnChildSlotGranted() noexcept = 0;
+};
+
+/**
+ * Counts the running child processes and enforces #ChildLimits.
+ * Requests over the limit wait in a FIFO queue; a request which
+ * cannot run because of its own per-cgroup or per-uid limit does not
+ * hold up the requests behind it.
+ *
+ * This object is shared by all threads.
+ */
+class ChildLimiter {
+	struct Hash : std::hash<std::string_view> {
+		using is_transparent = void;
+	};
+
+	std::mutex mutex;
+
+	ChildLimits limits;
+
+	unsigned n_children = 0;
+
+	std::unordered_map<std::string, unsigned, Hash, std::equal_to<>> per_cgroup;
+	std::unordered_map<uid_t, unsigned> per_uid;
+
+	IntrusiveList<ChildSlotWaiter> queue;
+	std::size_t queue_length = 0;
+
+public:
+	ChildLimiter() = default;
+
+	ChildLimiter(const ChildLimiter &) = delete;
+	ChildLimiter &operator=(const ChildLimiter &) = delete;
+
+	/**
+	 * Replace the limits.  Waiters which fit into the new limits
+	 * get their slots.
+	 */
+	void SetLimits(const ChildLimits &_limits) noexcept;
+
+	ChildLimits GetLimits() noexcept {
+		const std::scoped_lock lock{mutex};
+		return limits;
+	}
+
+	enum class AcquireResult {
+		/**
+		 * A slot has been assigned to the waiter.
+		 */
+		GRANTED,
+
+		/**
+		 * The waiter has been added to the queue; its
+		 * OnChildSlotGranted() method will be called later.
+		 */
+		QUEUED,
+
+		/**
+		 * The queue is full.
+		 */
+		REJECTED,
+	};
+
+	AcquireResult Acquire(ChildSlotWaiter &waiter) noexcept;
+
+	/**
+	 * Remove the waiter from the queue.
+	 *
+	 * @return false if it was not queued (anymore), i.e. a slot
+	 * has been assigned to it already
+	 */
+	bool Cancel(ChildSlotWaiter &waiter) noexcept;
+
+	/**
+	 * Release a slot which was assigned to the given owner; this
+	 * is called by #ChildSlot.
+	 */
+	void Release(const ChildOwner &owner) noexcept;
+
+private:
+	bool Fits(const ChildOwner &owner) const noexcept;
+	void Add(const ChildOwner &owner) noexcept;
+	void GrantWaiters() noexcept;
+};
+
+inline void
+ChildSlot::Release() noexcept
+{
+	if (limiter != nullptr)
+		std::exchange(limiter, nullptr)->Release(owner);
+}
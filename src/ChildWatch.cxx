@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ChildWatch.hxx"
+#include "ChildLimiter.hxx"
+#include "Stats.hxx"
+#include "event/PipeEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/DeleteDisposer.hxx"
+
+class ChildWatch final : public AutoUnlinkIntrusiveListHook {
+	PassageStats &stats;
+
+	UniqueFileDescriptor pidfd;
+
+	/**
+	 * A pidfd becomes readable when the process exits.
+	 */
+	PipeEvent event;
+
+	ChildSlot slot;
+
+public:
+	ChildWatch(EventLoop &event_loop, PassageStats &_stats,
+		   UniqueFileDescriptor &&_pidfd, ChildSlot &&_slot) noexcept
+		:stats(_stats),
+		 pidfd(std::move(_pidfd)),
+		 event(event_loop, BIND_THIS_METHOD(OnPidfdReady), pidfd),
+		 slot(std::move(_slot))
+	{
+		event.ScheduleRead();
+		++stats.children;
+	}
+
+	~ChildWatch() noexcept {
+		--stats.children;
+	}
+
+private:
+	void OnPidfdReady(unsigned) noexcept {
+		/* the process has exited; this releases the slot */
+		delete this;
+	}
+};
+
+ChildWatchList::ChildWatchList(EventLoop &_event_loop,
+			       PassageStats &_stats) noexcept
+	:event_loop(_event_loop), stats(_stats) {}
+
+ChildWatchList::~ChildWatchList() noexcept
+{
+	Clear();
+}
+
+void
+ChildWatchList::Add(UniqueFileDescriptor &&pidfd, ChildSlot &&slot)
+{
+	if (!pidfd.IsDefined()) {
+		slot.Release();
+		return;
+	}
+
+	list.push_back(*new ChildWatch(event_loop, stats,
+				       std::move(pidfd), std::move(slot)));
+}
+
+void
+ChildWatchList::Clear() noexcept
+{
+	list.clear_and_dispose(DeleteDisposer{});
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "util/IntrusiveList.hxx"
+
+class EventLoop;
+class UniqueFileDescriptor;
+class ChildSlot;
+class ChildWatch;
+struct PassageStats;
+
+/**
+ * Keeps the #ChildSlot of each running child process until the
+ * process exits, which is detected with its pidfd.
+ */
+class ChildWatchList {
+	EventLoop &event_loop;
+
+	PassageStats &stats;
+
+	IntrusiveList<ChildWatch> list;
+
+public:
+	ChildWatchList(EventLoop &_event_loop, PassageStats &_stats) noexcept;
+	~ChildWatchList() noexcept;
+
+	ChildWatchList(const ChildWatchList &) = delete;
+	ChildWatchList &operator=(const ChildWatchList &) = delete;
+
+	/**
+	 * Release the slot when the process exits.  If the pidfd is
+	 * undefined (because the kernel does not support it), the
+	 * slot is released immediately.
+	 */
+	void Add(UniqueFileDescriptor &&pidfd, ChildSlot &&slot);
+
+	/**
+	 * Stop watching all processes and release their slots.
+	 */
+	void Clear() noexcept;
+};
@@ -6,14 +6,18 @@
 #include "Entity.hxx"
 #include "Parser.hxx"
 #include "lib/fmt/RuntimeError.hxx"
+#include "io/Iovec.hxx"
 #include "net/ConnectSocket.hxx"
 #include "net/ReceiveMessage.hxx"
 #include "net/LocalSocketAddress.hxx"
+#include "net/ScmRightsBuilder.hxx"
+#include "net/SendMessage.hxx"
 #include "net/SocketProtocolError.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
 #include "system/Error.hxx"
 #include "util/NumberParser.hxx"
 #include "util/PrintException.hxx"
+#include "util/StringAPI.hxx"
 #include "util/StringCompare.hxx"
 #include "util/StringSplit.hxx"
 #include "util/SpanCast.hxx"
@@ -47,11 +51,32 @@ SendOrThrow(SocketDescriptor fd, std::span<const std::byte> payload)
 		throw MakeErrno("Short send");
 }
 
+/**
+ * @param pass_fd a file descriptor to be passed to the server
+ * (SCM_RIGHTS) or undefined
+ */
 static void
-SendRequest(SocketDescriptor fd, const Entity &request)
+SendRequest(SocketDescriptor fd, const Entity &request,
+	    FileDescriptor pass_fd)
 {
 	const auto payload = request.Serialize();
-	SendOrThrow(fd, AsBytes(payload));
+
+	if (!pass_fd.IsDefined()) {
+		SendOrThrow(fd, AsBytes(payload));
+		return;
+	}
+
+	const struct iovec vec[] = {
+		MakeIovec(AsBytes(payload)),
+	};
+
+	MessageHeader m{vec};
+
+	ScmRightsBuilder<1> rb(m);
+	rb.push_back(pass_fd.Get());
+	rb.Finish(m);
+
+	SendMessage(fd, m, 0);
 }
 
 struct ServerError {
@@ -120,6 +145,7 @@ main(int argc, char **argv)
 try {
 	const char *path = "/run/cm4all/passage/socket";
 	Entity request;
+	FileDescriptor pass_fd = FileDescriptor::Undefined();
 
 	int i = 1;
 	for (i = 1; i < argc && *argv[i] == '-'; ++i) {
@@ -134,6 +160,8 @@ try {
 			}
 
 			request.headers.emplace(name, value);
+		} else if (StringIsEqual(argv[i], "--stdin")) {
+			pass_fd = FileDescriptor{STDIN_FILENO};
 		} else {
 			fmt::print(stderr, "Unknown option: {}\n", argv[i]);
 			throw Usage();
@@ -151,7 +179,7 @@ try {
 		args_tail = request.args.emplace_after(args_tail, argv[i]);
 
 	auto fd = CreateConnect(path);
-	SendRequest(fd, request);
+	SendRequest(fd, request, pass_fd);
 	auto returned_fds = ReceiveResponse(fd);
 
 	if (!returned_fds.empty() && returned_fds.front().IsPipe()) {
@@ -180,7 +208,7 @@ try {
 
 	return EXIT_SUCCESS;
 } catch (Usage) {
-	fmt::print(stderr, "Usage: {} [--server=PATH] [--header=NAME:VALUE ...] COMMAND [ARGS...]\n",
+	fmt::print(stderr, "Usage: {} [--server=PATH] [--header=NAME:VALUE ...] [--stdin] COMMAND [ARGS...]\n",
 		   argv[0]);
 	return EX_USAGE;
 } catch (const ServerError &error) {
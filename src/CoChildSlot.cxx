@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "CoChildSlot.hxx"
+#include "Stats.hxx"
+
+#include <cassert>
+#include <utility> // for std::unreachable()
+
+CoChildSlot::CoChildSlot(EventLoop &event_loop, ChildLimiter &_limiter,
+			 ChildOwner &&_owner,
+			 std::chrono::steady_clock::duration _timeout,
+			 PassageStats &_stats) noexcept
+	:ChildSlotWaiter(std::move(_owner)),
+	 limiter(_limiter), stats(_stats),
+	 granted_event(event_loop, BIND_THIS_METHOD(OnGrantedEvent)),
+	 timeout_event(event_loop, BIND_THIS_METHOD(OnTimeout)),
+	 timeout(_timeout)
+{
+}
+
+CoChildSlot::~CoChildSlot() noexcept
+{
+	if (state != State::QUEUED)
+		return;
+
+	/* the coroutine has been canceled while waiting */
+	if (!limiter.Cancel(*this))
+		/* another thread has assigned a slot to us, but the
+		   InjectEvent has not yet been handled; give it
+		   back */
+		limiter.Release(GetOwner());
+
+	Dequeued();
+}
+
+bool
+CoChildSlot::await_ready() noexcept
+{
+	assert(state == State::INITIAL);
+
+	switch (limiter.Acquire(*this)) {
+	case ChildLimiter::AcquireResult::GRANTED:
+		state = State::GRANTED;
+		return true;
+
+	case ChildLimiter::AcquireResult::QUEUED:
+		state = State::QUEUED;
+		queue_start = std::chrono::steady_clock::now();
+		++stats.child_queue_waits;
+		++stats.child_queue_length;
+		return false;
+
+	case ChildLimiter::AcquireResult::REJECTED:
+		state = State::FAILED;
+		++stats.child_queue_rejected;
+		return true;
+	}
+
+	std::unreachable();
+}
+
+ChildSlot
+CoChildSlot::await_resume() noexcept
+{
+	assert(state == State::GRANTED || state == State::FAILED);
+
+	if (state != State::GRANTED)
+		return {};
+
+	/* ownership of the slot moves to the caller */
+	state = State::INITIAL;
+	return {limiter, StealOwner()};
+}
+
+inline void
+CoChildSlot::Dequeued() noexcept
+{
+	--stats.child_queue_length;
+	stats.child_queue_wait_us +=
+		std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - queue_start).count();
+}
+
+void
+CoChildSlot::OnGrantedEvent() noexcept
+{
+	assert(state == State::QUEUED);
+
+	timeout_event.Cancel();
+	Dequeued();
+	state = State::GRANTED;
+	continuation.resume();
+}
+
+void
+CoChildSlot::OnTimeout() noexcept
+{
+	assert(state == State::QUEUED);
+
+	if (!limiter.Cancel(*this))
+		/* a slot has been assigned to us just now, and
+		   OnGrantedEvent() will be called soon */
+		return;
+
+	Dequeued();
+	++stats.child_queue_timeouts;
+	state = State::FAILED;
+	continuation.resume();
+}
+
+void
+CoChildSlot::OnChildSlotGranted() noexcept
+{
+	granted_event.Schedule();
+}
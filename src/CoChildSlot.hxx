@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "ChildLimiter.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/InjectEvent.hxx"
+
+#include <coroutine>
+#include <cstdint>
+
+struct PassageStats;
+
+/**
+ * Obtain a #ChildSlot from a #ChildLimiter; if none is available,
+ * wait in its queue without blocking the #EventLoop.  The result of
+ * co_await is the slot or an undefined #ChildSlot if the queue is
+ * full or the timeout has expired.
+ */
+class CoChildSlot final : ChildSlotWaiter {
+	ChildLimiter &limiter;
+
+	PassageStats &stats;
+
+	/**
+	 * Wakes up the coroutine after another thread has assigned a
+	 * slot to us.
+	 */
+	InjectEvent granted_event;
+
+	CoarseTimerEvent timeout_event;
+
+	const std::chrono::steady_clock::duration timeout;
+
+	std::chrono::steady_clock::time_point queue_start;
+
+	std::coroutine_handle<> continuation;
+
+	enum class State : uint_least8_t {
+		INITIAL,
+		QUEUED,
+		GRANTED,
+		FAILED,
+	} state = State::INITIAL;
+
+public:
+	/**
+	 * @param _timeout how long to wait in the queue
+	 */
+	CoChildSlot(EventLoop &event_loop, ChildLimiter &_limiter,
+		    ChildOwner &&_owner,
+		    std::chrono::steady_clock::duration _timeout,
+		    PassageStats &_stats) noexcept;
+	~CoChildSlot() noexcept;
+
+	CoChildSlot(const CoChildSlot &) = delete;
+	CoChildSlot &operator=(const CoChildSlot &) = delete;
+
+	bool await_ready() noexcept;
+
+	void await_suspend(std::coroutine_handle<> _continuation) noexcept {
+		continuation = _continuation;
+		timeout_event.Schedule(timeout);
+	}
+
+	ChildSlot await_resume() noexcept;
+
+private:
+	void OnGrantedEvent() noexcept;
+	void OnTimeout() noexcept;
+
+	/**
+	 * The wait in the queue is over; update the statistics.
+	 */
+	void Dequeued() noexcept;
+
+	/* virtual methods from class ChildSlotWaiter */
+	void OnChildSlotGranted() noexcept override;
+};
@@ -5,16 +5,25 @@
 #include "CommandLine.hxx"
 #include "util/StringAPI.hxx"
 
+static constexpr const char *usage =
+	"Usage: cm4all-passage [--config PATH] [--bytecode-cache DIR]";
+
 CommandLine
 ParseCommandLine(int argc, char **argv)
 {
 	CommandLine cmdline;
 
-	if (argc == 3 && StringIsEqual(argv[1], "--config"))
-		cmdline.config_path = argv[2];
-	else if (argc != 1)
-		throw "Usage: cm4all-passage [--config PATH]";
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc)
+			throw usage;
+
+		if (StringIsEqual(argv[i], "--config"))
+			cmdline.config_path = argv[i + 1];
+		else if (StringIsEqual(argv[i], "--bytecode-cache"))
+			cmdline.bytecode_cache = argv[i + 1];
+		else
+			throw usage;
+	}
 
 	return cmdline;
 }
-
@@ -8,6 +8,12 @@
 
 struct CommandLine {
 	std::string config_path = "/etc/cm4all/passage/config.lua";
+
+	/**
+	 * A directory where compiled Lua chunks are cached; empty
+	 * to disable the cache.
+	 */
+	std::string bytecode_cache;
 };
 
 CommandLine
@@ -0,0 +1,520 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Config.hxx"
+#include "BytecodeCache.hxx"
+#include "CommandLine.hxx"
+#include "FfiRequest.hxx"
+#include "Handler.hxx"
+#include "Instance.hxx"
+#include "ChildLimiter.hxx"
+#include "Connection.hxx"
+#include "LCache.hxx"
+#include "LExecTemplate.hxx"
+#include "LResolver.hxx"
+#include "LRule.hxx"
+#include "LStats.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "net/LocalSocketAddress.hxx"
+#include "lua/PushCClosure.hxx"
+#include "lua/Util.hxx"
+#include "lua/Error.hxx"
+#include "lua/LightUserData.hxx"
+#include "lua/RunFile.hxx"
+#include "lua/StringView.hxx"
+#include "lua/io/XattrTable.hxx"
+#include "lua/io/CgroupInfo.hxx"
+#include "lua/net/Socket.hxx"
+#include "lua/net/SocketAddress.hxx"
+#include "lua/net/ControlClient.hxx"
+#include "lua/event/Init.hxx"
+#include "config.h"
+
+#ifdef HAVE_PG
+#include "lua/pg/Init.hxx"
+#endif
+
+#ifdef HAVE_LIBSODIUM
+#include "lua/sodium/Init.hxx"
+#endif
+
+extern "C" {
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include <chrono>
+#include <iterator> // for std::distance()
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <string.h> // for strrchr()
+#include <unistd.h> // for chdir()
+
+#ifdef HAVE_LIBSYSTEMD
+
+static int systemd_magic = 42;
+
+static bool
+IsSystemdMagic(lua_State *L, int idx)
+{
+	return lua_islightuserdata(L, idx) &&
+		lua_touserdata(L, idx) == &systemd_magic;
+}
+
+#endif // HAVE_LIBSYSTEMD
+
+static int
+l_passage_listen(lua_State *L)
+try {
+	auto &instance = *(Instance *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	if (!lua_isfunction(L, 2) && !lua_istable(L, 2))
+		luaL_argerror(L, 2, "function or table expected");
+
+	auto handler = std::make_shared<const PassageHandler>(L, 2);
+
+	if (lua_isstring(L, 1)) {
+		const auto address_string = Lua::ToStringView(L, 1);
+
+		const auto handler_index =
+			instance.GetConfig().AddHandler(std::move(handler));
+		instance.AddListener(LocalSocketAddress{address_string},
+				     handler_index);
+#ifdef HAVE_LIBSYSTEMD
+	} else if (IsSystemdMagic(L, 1)) {
+		const auto handler_index =
+			instance.GetConfig().AddHandler(std::move(handler));
+		instance.AddSystemdListener(handler_index);
+#endif
+	} else
+		luaL_argerror(L, 1, "path expected");
+
+	return 0;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+/**
+ * The passage_listen() implementation for the Lua states of workers
+ * and for reloaded configurations: it only registers the handler;
+ * the socket is managed by the main thread.
+ */
+static int
+l_secondary_passage_listen(lua_State *L)
+try {
+	auto &config = *(LuaConfig *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	if (!lua_isfunction(L, 2) && !lua_istable(L, 2))
+		luaL_argerror(L, 2, "function or table expected");
+
+	config.AddHandler(std::make_shared<const PassageHandler>(L, 2));
+	return 0;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+static int
+l_passage_workers(lua_State *L)
+{
+	auto *instance = (Instance *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	const auto n = luaL_checkinteger(L, 1);
+	if (n < 0 || n > 256)
+		luaL_argerror(L, 1, "Bad number of workers");
+
+	/* this is nullptr in the Lua states of workers, which
+	   ignore this setting */
+	if (instance != nullptr)
+		instance->SetWorkerCount(n);
+
+	return 0;
+}
+
+static int
+l_passage_reload_config(lua_State *L)
+{
+	auto *instance = (Instance *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	luaL_checktype(L, 1, LUA_TBOOLEAN);
+
+	/* this is nullptr in the Lua states of workers and of
+	   reloaded configurations, which ignore this setting */
+	if (instance != nullptr)
+		instance->SetReloadConfig(lua_toboolean(L, 1));
+
+	return 0;
+}
+
+static int
+l_passage_defer_handlers(lua_State *L)
+{
+	auto &config = *(LuaConfig *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	luaL_checktype(L, 1, LUA_TBOOLEAN);
+	config.SetDeferHandlers(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int
+l_passage_handler_budget(lua_State *L)
+{
+	auto &config = *(LuaConfig *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	lua_Integer instructions = 0;
+	lua_Number time = 0;
+
+	lua_getfield(L, 1, "instructions");
+	if (!lua_isnil(L, -1)) {
+		if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) <= 0)
+			return luaL_error(L, "Bad 'instructions' value");
+		instructions = lua_tointeger(L, -1);
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, 1, "time");
+	if (!lua_isnil(L, -1)) {
+		if (!lua_isnumber(L, -1) || lua_tonumber(L, -1) <= 0)
+			return luaL_error(L, "Bad 'time' value");
+		time = lua_tonumber(L, -1);
+	}
+	lua_pop(L, 1);
+
+	config.GetBudget().Set(instructions,
+			       std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<lua_Number>(time)));
+	return 0;
+}
+
+/**
+ * Read an optional non-negative integer field of the table at index
+ * 1.
+ */
+static unsigned
+CheckOptionalCount(lua_State *L, const char *name, unsigned default_value)
+{
+	unsigned value = default_value;
+
+	lua_getfield(L, 1, name);
+	if (!lua_isnil(L, -1)) {
+		if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) < 0 ||
+		    lua_tointeger(L, -1) > std::numeric_limits<int>::max())
+			luaL_error(L, "Bad '%s' value", name);
+		value = lua_tointeger(L, -1);
+	}
+	lua_pop(L, 1);
+
+	return value;
+}
+
+/**
+ * The maximum value of passage_child_limits() "timeout" (in
+ * seconds).
+ */
+static constexpr lua_Number MAX_QUEUE_TIMEOUT = 3600;
+
+static int
+l_passage_child_limits(lua_State *L)
+{
+	auto &limiter = *(ChildLimiter *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	ChildLimits limits;
+	limits.max_children = CheckOptionalCount(L, "max", 0);
+	limits.max_per_cgroup = CheckOptionalCount(L, "per_cgroup", 0);
+	limits.max_per_uid = CheckOptionalCount(L, "per_uid", 0);
+	limits.max_queue = CheckOptionalCount(L, "queue", 64);
+
+	lua_getfield(L, 1, "timeout");
+	if (!lua_isnil(L, -1)) {
+		/* the upper bound keeps duration_cast() from
+		   overflowing (this also rejects NaN) */
+		if (!lua_isnumber(L, -1) ||
+		    !(lua_tonumber(L, -1) > 0 &&
+		      lua_tonumber(L, -1) <= MAX_QUEUE_TIMEOUT))
+			return luaL_error(L, "Bad 'timeout' value");
+		limits.queue_timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<lua_Number>(lua_tonumber(L, -1)));
+	}
+	lua_pop(L, 1);
+
+	limits.retry_after = std::chrono::seconds{CheckOptionalCount(L, "retry_after", 1)};
+
+	limiter.SetLimits(limits);
+	return 0;
+}
+
+static int
+l_passage_invalidate_responses(lua_State *L)
+{
+	auto &cache = *(ResponseCache *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	cache.Invalidate(Lua::CheckStringView(L, 1));
+	return 0;
+}
+
+static void
+SetupConfigState(lua_State *L, BaseInstance &instance, LuaConfig &config)
+{
+	luaL_openlibs(L);
+	Lua::InitResume(L);
+
+#ifdef HAVE_LIBSODIUM
+	Lua::InitSodium(L);
+#endif
+
+	Lua::InitEvent(L, instance.GetEventLoop());
+
+#ifdef HAVE_PG
+	Lua::InitPg(L, instance.GetEventLoop());
+#endif
+
+	Lua::InitSocketAddress(L);
+	Lua::InitSocket(L);
+	Lua::InitControlClient(L);
+	RegisterLuaResolver(L);
+	RegisterLuaStats(L, instance.GetStats());
+	RegisterLuaRule(L, config.GetRules());
+	RegisterLuaCache(L);
+	RegisterLuaExecTemplate(L);
+
+	Lua::SetGlobal(L, "passage_ffi_cdef", passage_ffi_cdef);
+
+#ifdef HAVE_LIBSYSTEMD
+	Lua::SetGlobal(L, "systemd", Lua::LightUserData(&systemd_magic));
+#endif
+
+	Lua::SetGlobal(L, "passage_defer_handlers",
+		       Lua::MakeCClosure(l_passage_defer_handlers,
+					 Lua::LightUserData(&config)));
+	Lua::SetGlobal(L, "passage_handler_budget",
+		       Lua::MakeCClosure(l_passage_handler_budget,
+					 Lua::LightUserData(&config)));
+	Lua::SetGlobal(L, "passage_invalidate_responses",
+		       Lua::MakeCClosure(l_passage_invalidate_responses,
+					 Lua::LightUserData(&instance.GetResponseCache())));
+	Lua::SetGlobal(L, "passage_child_limits",
+		       Lua::MakeCClosure(l_passage_child_limits,
+					 Lua::LightUserData(&instance.GetChildLimiter())));
+}
+
+static void
+SetupMainConfigState(lua_State *L, Instance &instance)
+{
+	SetupConfigState(L, instance, instance.GetConfig());
+
+	Lua::SetGlobal(L, "passage_listen",
+		       Lua::MakeCClosure(l_passage_listen,
+					 Lua::LightUserData(&instance)));
+	Lua::SetGlobal(L, "passage_workers",
+		       Lua::MakeCClosure(l_passage_workers,
+					 Lua::LightUserData(&instance)));
+	Lua::SetGlobal(L, "passage_reload_config",
+		       Lua::MakeCClosure(l_passage_reload_config,
+					 Lua::LightUserData(&instance)));
+}
+
+/**
+ * Set up a Lua state which does not create listeners: the one of a
+ * worker or a reloaded configuration.
+ */
+static void
+SetupSecondaryConfigState(lua_State *L, BaseInstance &instance,
+			  LuaConfig &config)
+{
+	SetupConfigState(L, instance, config);
+
+	Lua::SetGlobal(L, "passage_listen",
+		       Lua::MakeCClosure(l_secondary_passage_listen,
+					 Lua::LightUserData(&config)));
+	Lua::SetGlobal(L, "passage_workers",
+		       Lua::MakeCClosure(l_passage_workers,
+					 Lua::LightUserData(nullptr)));
+	Lua::SetGlobal(L, "passage_reload_config",
+		       Lua::MakeCClosure(l_passage_reload_config,
+					 Lua::LightUserData(nullptr)));
+}
+
+static void
+ChdirContainingDirectory(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	if (slash == nullptr || slash == path)
+		return;
+
+	const std::string parent{path, slash};
+	if (chdir(parent.c_str()) < 0)
+		throw FmtErrno("Failed to change to {}", parent);
+}
+
+static void
+LoadConfigFile(lua_State *L, const CommandLine &cmdline)
+{
+	const char *path = cmdline.config_path.c_str();
+
+	ChdirContainingDirectory(path);
+
+	if (!cmdline.bytecode_cache.empty()) {
+		const char *cache_dir = cmdline.bytecode_cache.c_str();
+		InstallCachedLoader(L, cache_dir);
+		RunCachedFile(L, path, cache_dir);
+	} else
+		Lua::RunFile(L, path);
+
+	if (chdir("/") < 0)
+		throw FmtErrno("Failed to change to {}", "/");
+}
+
+static void
+SetupRuntimeState(lua_State *L)
+{
+	Lua::SetGlobal(L, "passage_listen", nullptr);
+	Lua::SetGlobal(L, "passage_workers", nullptr);
+	Lua::SetGlobal(L, "passage_reload_config", nullptr);
+	Lua::SetGlobal(L, "passage_defer_handlers", nullptr);
+	Lua::SetGlobal(L, "passage_rule", nullptr);
+	Lua::SetGlobal(L, "passage_handler_budget", nullptr);
+	Lua::SetGlobal(L, "passage_child_limits", nullptr);
+
+	Lua::InitXattrTable(L);
+	Lua::RegisterCgroupInfo(L);
+
+	PassageConnection::Register(L);
+
+	UnregisterLuaResolver(L);
+}
+
+/**
+ * Load the configuration file into a Lua state which does not create
+ * listeners (see SetupSecondaryConfigState()).
+ *
+ * @param instance the #BaseInstance the configuration is loaded for
+ */
+static void
+LoadSecondaryConfig(const Instance &main, BaseInstance &instance,
+		    LuaConfig &config)
+{
+	const auto L = config.GetLuaState();
+
+	SetupSecondaryConfigState(L, instance, config);
+
+	LoadConfigFile(L, main.GetCommandLine());
+
+	if (config.GetHandlerCount() != main.GetHandlerCount())
+		throw std::runtime_error("Configuration file has registered a different number of listeners");
+
+	SetupRuntimeState(L);
+}
+
+void
+LoadConfig(Instance &instance)
+{
+	const auto L = instance.GetConfig().GetLuaState();
+
+	SetupMainConfigState(L, instance);
+
+	LoadConfigFile(L, instance.GetCommandLine());
+
+	instance.Check();
+
+	SetupRuntimeState(L);
+
+	/* the Lua states of the workers are set up by this thread
+	   before they are started because LoadConfigFile() changes
+	   the current directory of the whole process */
+	for (unsigned i = 0; i < instance.GetWorkerCount(); ++i) {
+		auto &worker = instance.AddWorker();
+		LoadSecondaryConfig(instance, worker, worker.GetConfig());
+	}
+}
+
+void
+ReloadConfig(Instance &instance) noexcept
+{
+	auto &workers = instance.GetWorkers();
+
+	auto main_config = std::make_shared<LuaConfig>(instance.GetStats());
+	std::vector<LuaConfigPtr> worker_configs(std::distance(workers.begin(),
+							       workers.end()));
+
+	try {
+		LoadSecondaryConfig(instance, instance, *main_config);
+
+		/* the Lua states of running workers are created in
+		   their own threads because they may register
+		   objects in the worker's #EventLoop; Call() waits
+		   for completion, so the current directory is never
+		   changed concurrently */
+		auto c = worker_configs.begin();
+		for (auto &worker : workers) {
+			worker.Call([&instance, &worker, &new_config = *c]{
+				new_config = std::make_shared<LuaConfig>(worker.GetStats());
+				LoadSecondaryConfig(instance, worker, *new_config);
+			});
+
+			++c;
+		}
+	} catch (...) {
+		instance.logger(1, "Failed to reload the configuration: ",
+				std::current_exception());
+
+		/* free the new Lua states in the threads they
+		   belong to */
+		auto c = worker_configs.begin();
+		for (auto &worker : workers) {
+			if (*c) {
+				try {
+					worker.Call([&new_config = *c]{
+						new_config.reset();
+					});
+				} catch (...) {
+				}
+			}
+
+			++c;
+		}
+
+		return;
+	}
+
+	/* all configurations have been loaded successfully; now
+	   switch all threads to them */
+
+	instance.SetConfig(std::move(main_config));
+
+	auto c = worker_configs.begin();
+	for (auto &worker : workers)
+		worker.SetConfig(std::move(*c++));
+
+	/* cached responses were generated by the old handlers */
+	instance.GetResponseCache().Clear();
+
+	instance.logger(2, "configuration reloaded");
+}
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+class Instance;
+
+/**
+ * Load the configuration file into the Lua state of the main thread
+ * and create all workers (but do not start them).
+ *
+ * Throws on error.
+ */
+void
+LoadConfig(Instance &instance);
+
+/**
+ * Load the configuration file again into new Lua states and let new
+ * connections of the main thread and of all workers use them.
+ * Existing connections keep using the old configuration, and the
+ * listener sockets remain open.
+ *
+ * Errors are logged; in that case, the old configuration remains
+ * active everywhere.
+ */
+void
+ReloadConfig(Instance &instance) noexcept;
@@ -2,46 +2,32 @@
 // Copyright CM4all GmbH
 // author: Max Kellermann <max.kellermann@ionos.com>
 
-#include "Instance.hxx"
+#include "Connection.hxx"
+#include "BaseInstance.hxx"
 #include "Parser.hxx"
-#include "Entity.hxx"
+#include "EntityView.hxx"
 #include "LRequest.hxx"
 #include "LAction.hxx"
-#include "Action.hxx"
-#include "SendControl.hxx"
-#include "ExecPipe.hxx"
-#include "lua/Error.hxx"
-#include "io/Beneath.hxx"
-#include "io/FileAt.hxx"
 #include "io/Iovec.hxx"
-#include "io/Open.hxx"
-#include "io/UniqueFileDescriptor.hxx"
 #include "net/SocketAddress.hxx"
 #include "net/SocketProtocolError.hxx"
 #include "net/ScmRightsBuilder.hxx"
 #include "net/SendMessage.hxx"
-#include "util/ScopeExit.hxx"
+#include "util/DeleteDisposer.hxx"
 #include "util/SpanCast.hxx"
-#include "util/Macros.hxx"
-#include "util/Compiler.h"
-
-#ifdef HAVE_CURL
-#include "lib/curl/CoRequest.hxx"
-#include "lib/curl/Easy.hxx"
-#include "lib/curl/Setup.hxx"
-#include "lib/curl/Slist.hxx"
-#include "http/Method.hxx"
-#include "co/Task.hxx"
+
+#ifdef HAVE_URING
+#include "system/Error.hxx"
 #endif
 
 #include <fmt/format.h>
 
-#include <utility> // for std::unreachable()
+#include <utility> // for std::exchange()
 
 using std::string_view_literals::operator""sv;
 
 static std::string
-MakeLoggerDomain(const SocketPeerAuth &auth, SocketAddress)
+MakeLoggerDomain(const PeerAuth &auth, SocketAddress)
 {
 	if (!auth.HaveCred())
 		return "connection";
@@ -49,23 +35,50 @@ MakeLoggerDomain(const SocketPeerAuth &auth, SocketAddress)
 	return fmt::format("pid={} uid={}", auth.GetPid(), auth.GetUid());
 }
 
-PassageConnection::PassageConnection(Instance &_instance,
-				     Lua::ValuePtr _handler,
+PassageConnection::PassageConnection(BaseInstance &_instance,
+				     LuaConfigPtr _config,
+				     std::size_t _handler_index,
 				     const RootLogger &parent_logger,
 				     UniqueSocketDescriptor &&_fd,
 				     SocketAddress address)
-	:instance(_instance), handler(std::move(_handler)),
-	 peer_auth(_fd),
+	:instance(_instance), config(std::move(_config)),
+	 handler(config->GetHandler(_handler_index)),
+	 handler_index(_handler_index),
+	 peer_auth(_fd, instance.GetPeerAuthCache(), instance.GetStats()),
 	 logger(parent_logger, MakeLoggerDomain(peer_auth, address).c_str()),
 	 auto_close(handler->GetState()),
-	 listener(instance.GetEventLoop(), std::move(_fd), *this),
-	 thread(handler->GetState())
+	 socket(std::move(_fd)),
+	 event(instance.GetEventLoop(), BIND_THIS_METHOD(OnSocketReady), socket),
+	 resume_event(instance.GetEventLoop(), BIND_THIS_METHOD(OnResume))
 {
+#ifdef HAVE_URING
+	StartReceive();
+#else
+	event.ScheduleRead();
+#endif
+
+	instance.OnConnectionCreated();
 }
 
 PassageConnection::~PassageConnection() noexcept
 {
-	thread.Cancel();
+	if (destroyed_flag != nullptr)
+		*destroyed_flag = true;
+
+	requests.clear_and_dispose(DeleteDisposer{});
+
+#ifdef HAVE_URING
+	if (uring_receive != nullptr)
+		uring_receive->Cancel();
+
+	if (auto *uring = instance.GetUring())
+		/* queued responses refer to the socket by its file
+		   descriptor number, so they must be submitted
+		   before the socket gets closed */
+		uring->Submit();
+#endif
+
+	instance.OnConnectionDestroyed();
 }
 
 void
@@ -76,29 +89,26 @@ PassageConnection::Register(lua_State *L)
 }
 
 void
-PassageConnection::SendResponse(SocketAddress address, std::string_view status)
-{
-	assert(pending_response);
-
-	pending_response = false;
-	listener.Reply(address, AsBytes(status));
-}
-
-void
-PassageConnection::SendResponse(SocketAddress address, std::string_view status,
+PassageConnection::SendResponse(std::span<const struct iovec> vec,
 				FileDescriptor fd, FileDescriptor fd2)
 {
-	assert(pending_response);
-	assert(fd.IsDefined());
-
-	pending_response = false;
-
-	const struct iovec vec[] = {
-		MakeIovec(AsBytes(status)),
-	};
+	assert(fd.IsDefined() || !fd2.IsDefined());
+
+#ifdef HAVE_URING
+	if (auto *uring = instance.GetUring()) {
+		/* all responses generated in this event loop
+		   iteration are submitted with one system call */
+		UringSendMessage(*uring, socket, vec, fd, fd2);
+		return;
+	}
+#endif
 
 	MessageHeader m{vec};
-	m.SetAddress(address);
+
+	if (!fd.IsDefined()) {
+		SendMessage(socket, m, MSG_DONTWAIT|MSG_NOSIGNAL);
+		return;
+	}
 
 	ScmRightsBuilder<2> rb(m);
 	rb.push_back(fd.Get());
@@ -106,252 +116,272 @@ PassageConnection::SendResponse(SocketAddress address, std::string_view status,
 		rb.push_back(fd2.Get());
 	rb.Finish(m);
 
-	SendMessage(listener.GetSocket(), m, MSG_DONTWAIT|MSG_NOSIGNAL);
+	SendMessage(socket, m, MSG_DONTWAIT|MSG_NOSIGNAL);
 }
 
 void
-PassageConnection::SendResponse(SocketAddress address, const Entity &response)
+PassageConnection::Abort(std::exception_ptr &&error) noexcept
 {
-	SendResponse(address, response.Serialize());
+	logger(1, std::move(error));
+	delete this;
 }
 
-inline void
-PassageConnection::SendError(SocketAddress address, const Action &action)
+inline bool
+PassageConnection::SendCachedResponse(const EntityView &request,
+				      std::string_view id)
 {
-	Entity response{
-		.command = std::string{"ERROR"sv},
-		.headers = action.response_headers,
-	};
-
-	if (!action.param.empty())
-		response.args.emplace_front(action.param);
+	auto &stats = instance.GetStats();
 
-	SendResponse(address, response);
-}
-
-#ifdef HAVE_CURL
-
-struct HttpRequest {
-	CurlEasy curl;
-	CurlSlist headers;
-};
+	const auto key = ResponseCache::MakeRequestKey(handler_index, request);
 
-static HttpRequest
-ActionToHttpRequest(const Action &action)
-{
-	HttpRequest request{
-		.curl = CurlEasy{action.param.c_str()},
-	};
-
-	Curl::Setup(request.curl);
-	request.curl.SetFailOnError();
+	std::string response;
+	try {
+		response = instance.GetResponseCache().Get(key, peer_auth);
+	} catch (...) {
+		/* the client's cgroup cannot be determined; treat
+		   this like a cache miss and let the handler
+		   decide */
+	}
 
-	if (action.http_method != HttpMethod::UNDEFINED)
-		request.curl.SetOption(CURLOPT_CUSTOMREQUEST,
-				       http_method_to_string(action.http_method));
+	if (response.empty()) {
+		++stats.response_cache_misses;
+		return false;
+	}
 
-	for (const auto &[name, value] : action.request_headers)
-		request.headers.Append(fmt::format("{}: {}"sv, name, value).c_str());
+	++stats.response_cache_hits;
 
-	request.curl.SetRequestHeaders(request.headers.Get());
+	if (id.data() == nullptr) {
+		const struct iovec vec[] = {
+			MakeIovec(AsBytes(response)),
+		};
 
-	if (action.body)
-		request.curl.SetRequestBody(*action.body);
+		SendResponse(vec, FileDescriptor::Undefined(),
+			     FileDescriptor::Undefined());
+	} else {
+		/* the cached response was serialized without
+		   "request_id"; insert it as the first header */
+		const std::string_view r{response};
+		const auto first_line_length = r.find_first_of("\n\0"sv);
+		const auto first_line = r.substr(0, first_line_length);
+		auto rest = first_line_length == r.npos
+			? std::string_view{}
+			: r.substr(first_line_length);
+		if (rest.starts_with('\n'))
+			/* skip the newline which starts the
+			   header block */
+			rest.remove_prefix(1);
+
+		const struct iovec vec[] = {
+			MakeIovec(AsBytes(first_line)),
+			MakeIovec(AsBytes("\nrequest_id:"sv)),
+			MakeIovec(AsBytes(id)),
+			MakeIovec(AsBytes("\n"sv)),
+			MakeIovec(AsBytes(rest)),
+		};
+
+		SendResponse(vec, FileDescriptor::Undefined(),
+			     FileDescriptor::Undefined());
+	}
 
-	return request;
+	stats.AddRequest(0);
+	return true;
 }
 
-static Co::Task<Entity>
-DoHttpRequest(CurlGlobal &curl, const Action &action)
+inline void
+PassageConnection::StartRequest(std::string_view payload,
+				UniqueFileDescriptor &&fd)
 {
-	auto response = co_await Curl::CoRequest(curl, ActionToHttpRequest(action).curl,
-						 {.max_size = action.max_size});
-
-	Entity entity{
-		.command = std::string{"OK"sv},
-		.body = std::move(response.body),
-	};
+	const auto request = ParseEntityView(payload);
+
+	const auto id = request.FindHeader("request_id"sv);
+	if (id.data() == nullptr) {
+		/* without a request id, the client cannot tell
+		   responses apart, so only one request may be in
+		   flight */
+		if (!requests.empty())
+			throw SocketProtocolError{"Received another datagram while handling request"};
+	} else {
+		if (id.empty())
+			throw SocketProtocolError{"Empty request_id"};
 
-	co_return entity;
-}
+		std::size_t n = 0;
+		for (const auto &i : requests) {
+			if (!i.HasId())
+				throw SocketProtocolError{"Received another datagram while handling request"};
 
-#endif // HAVE_CURL
+			if (i.GetId() == id)
+				throw SocketProtocolError{"Duplicate request_id"};
 
-inline void
-PassageConnection::DoExecPipe(SocketAddress address, const Action &action)
-{
-	assert(action.type == Action::Type::EXEC_PIPE);
+			++n;
+		}
 
-	char *argv[Action::MAX_EXEC + 1];
-	unsigned n = 0;
-	for (const auto &i : action.exec)
-		argv[n++] = const_cast<char *>(i.c_str());
-	argv[n] = nullptr;
+		if (n >= MAX_REQUESTS)
+			throw SocketProtocolError{"Too many pending requests"};
+	}
 
-	char *env[Action::MAX_ENV + 1];
-	n = 0;
-	for (const auto &i : action.env)
-		env[n++] = const_cast<char *>(i.c_str());
+	const auto *rule = config->GetRules().Find(request.command, peer_auth);
 
-	env[n] = nullptr;
+	if (rule == nullptr && instance.GetResponseCache().IsUsed() &&
+	    SendCachedResponse(request, id))
+		/* answered from the cache without invoking Lua */
+		return;
 
-	UniqueFileDescriptor cgroup;
-	if (action.cgroup_client) {
-		const auto path = peer_auth.GetCgroupPath();
-		if (path.empty())
-			throw std::runtime_error("Client has no cgroup");
+	auto *r = new PassageRequest(*this, config->GetThreadPool(), id,
+				     std::move(fd));
+	requests.push_back(*r);
 
-		const auto sys_fs_cgroup = OpenPath("/sys/fs/cgroup");
-		cgroup = OpenReadOnlyBeneath({sys_fs_cgroup, std::string{path.substr(1)}.c_str()});
+	if (rule != nullptr) {
+		/* a static rule: perform its prebuilt action without
+		   invoking Lua */
+		++instance.GetStats().rule_hits;
+		r->Run(rule->action, request.body);
+		return;
 	}
 
-	auto result = ExecPipe(argv[0], argv, env,
-			       cgroup,
-			       action.stderr);
-
-	SendResponse(address, "OK", result.stdout_pipe, result.stderr_pipe);
-}
-
-Co::InvokeTask
-PassageConnection::Do(SocketAddress address, const Action &action)
-{
-	assert(pending_response);
-
-	switch (action.type) {
-	case Action::Type::UNDEFINED:
-		std::unreachable();
-
-	case Action::Type::ERROR:
-		SendError(address, action);
-		break;
-
-	case Action::Type::FADE_CHILDREN:
-		FadeChildren(action.address,
-			     action.param.empty() ? nullptr : action.param.c_str());
-		break;
-
-	case Action::Type::FLUSH_HTTP_CACHE:
-		FlushHttpCache(action.address, action.param.c_str());
-		break;
-
-	case Action::Type::EXEC_PIPE:
-		DoExecPipe(address, action);
-		break;
-
-#ifdef HAVE_CURL
-	case Action::Type::HTTP_REQUEST:
-		SendResponse(address,
-			     (co_await DoHttpRequest(instance.GetCurl(), action)).Serialize());
-		break;
-#endif // HAVE_CURL
+	const auto *function = handler->Find(request.command);
+	if (function == nullptr) {
+		/* no Lua code needs to run for this request */
+		r->Reject("Unknown command"sv);
+		return;
 	}
 
-	co_return;
+	if (!r->Prepare(*function, payload, request))
+		/* the request has already been answered and
+		   destroyed */
+		return;
+
+	if (config->IsDeferHandlers()) {
+		/* invoke the handler after all connections have been
+		   read */
+		unstarted_requests.push_back(r);
+		resume_event.Schedule();
+	} else
+		/* this may destroy the request if the handler
+		   finishes synchronously */
+		r->Resume();
 }
 
-bool
-PassageConnection::OnUdpDatagram(std::span<const std::byte> payload,
-				 std::span<UniqueFileDescriptor> fds,
-				 SocketAddress address, int)
+inline bool
+PassageConnection::OnDatagram(std::span<const std::byte> payload,
+			      bool truncated, bool excess_fds,
+			      UniqueFileDescriptor &&fd) noexcept
 try {
 	if (payload.empty()) {
 		delete this;
 		return false;
 	}
 
-	if (!fds.empty())
-		throw SocketProtocolError{"Client unexpectedly passed file descriptors"};
-
-	if (pending_response)
-		throw SocketProtocolError{"Received another datagram while handling request"};
+	if (excess_fds)
+		throw SocketProtocolError{"Client passed too many file descriptors"};
 
-	assert(!invoke_task);
+	try {
+		if (truncated)
+			throw SocketProtocolError{"Datagram too large"};
 
-	pending_response = true;
+		StartRequest(ToStringView(payload), std::move(fd));
+	} catch (...) {
+		/* the request was not accepted; reply with an
+		   (untagged) error before closing the connection */
+		const struct iovec vec[] = {
+			MakeIovec(AsBytes("ERROR"sv)),
+		};
 
-	auto request = ParseEntity(ToStringView(payload));
-
-	/* create a new thread for the handler coroutine */
-	const auto L = thread.CreateThread(*this);
-
-	handler->Push(L);
-
-	NewLuaRequest(L, auto_close,
-		      std::move(request), peer_auth);
-
-	Lua::Resume(L, 1);
+		SendResponse(vec, FileDescriptor::Undefined(),
+			     FileDescriptor::Undefined());
+		throw;
+	}
 
 	return true;
 } catch (...) {
-	if (pending_response)
-		SendResponse(address, "ERROR");
-
 	logger(1, std::current_exception());
 	delete this;
 	return false;
 }
 
-bool
-PassageConnection::OnUdpHangup()
-{
-	delete this;
-	return false;
+void
+PassageConnection::OnSocketReady(unsigned events) noexcept
+try {
+	auto &batch = instance.GetReceiveBatch();
+	const std::size_t n = batch.Receive(socket);
+
+	bool destroyed = false;
+	assert(destroyed_flag == nullptr);
+	destroyed_flag = &destroyed;
+
+	for (std::size_t i = 0; i < n; ++i) {
+		const auto datagram = batch[i];
+		if (!OnDatagram(datagram.payload, datagram.truncated,
+				datagram.excess_fds, batch.StealFd(i)) ||
+		    destroyed)
+			return;
+	}
+
+	destroyed_flag = nullptr;
+
+	if (n == 0 && (events & (SocketEvent::HANGUP|SocketEvent::ERROR)) != 0)
+		delete this;
+} catch (...) {
+	Abort(std::current_exception());
 }
 
 void
-PassageConnection::OnUdpError(std::exception_ptr &&error) noexcept
+PassageConnection::OnResume() noexcept
 {
-	logger(1, std::move(error));
-	delete this;
-}
+	bool destroyed = false;
+	assert(destroyed_flag == nullptr);
+	destroyed_flag = &destroyed;
+
+	for (auto *r : std::exchange(unstarted_requests, {})) {
+		r->Resume();
+		if (destroyed)
+			return;
+	}
 
-void
-PassageConnection::OnLuaFinished(lua_State *L) noexcept
-try {
-	assert(!invoke_task);
+	destroyed_flag = nullptr;
+}
 
-	const Lua::ScopeCheckStack check_thread_stack(L);
+#ifdef HAVE_URING
 
-	if (!lua_isnil(L, -1)) {
-		auto *action = CheckLuaAction(L, -1);
-		if (action == nullptr)
-			throw std::runtime_error("Wrong return type from Lua handler");
+inline void
+PassageConnection::StartReceive() noexcept
+{
+	if (auto *uring = instance.GetUring()) {
+		auto *r = new UringReceive(*uring, socket, *this);
+
+		try {
+			r->Start();
+			uring_receive = r;
+			return;
+		} catch (...) {
+			r->Cancel();
+			logger(2, std::current_exception());
+		}
+	}
 
-		invoke_task = Do(nullptr, *action);
-		invoke_task.Start(BIND_THIS_METHOD(OnCoComplete));
-	} else if (pending_response)
-		SendResponse(nullptr, "OK");
-} catch (...) {
-	OnLuaError(L, std::current_exception());
+	event.ScheduleRead();
 }
 
 void
-PassageConnection::OnLuaError(lua_State *, std::exception_ptr &&error) noexcept
-try {
-	assert(!invoke_task);
-
-	logger(1, std::move(error));
-
-	if (pending_response)
-		SendResponse(nullptr, "ERROR");
-} catch (...) {
-	logger(1, std::move(error));
-	delete this;
+PassageConnection::OnUringDatagram(std::span<const std::byte> payload,
+				   bool truncated, bool excess_fds,
+				   UniqueFileDescriptor &&fd) noexcept
+{
+	OnDatagram(payload, truncated, excess_fds, std::move(fd));
 }
 
-inline void
-PassageConnection::OnCoComplete(std::exception_ptr &&error) noexcept
-try {
-	if (error) {
-		logger(1, std::move(error));
+void
+PassageConnection::OnUringReceiveError(int error) noexcept
+{
+	uring_receive = nullptr;
 
-		if (pending_response)
-			SendResponse(nullptr, "ERROR");
-	} else {
-		if (pending_response)
-			SendResponse(nullptr, "OK");
+	if (error == EINVAL || error == EOPNOTSUPP) {
+		/* this kernel does not support multishot recvmsg();
+		   fall back to epoll */
+		event.ScheduleRead();
+		return;
 	}
-} catch (...) {
-	logger(1, std::move(error));
-	delete this;
+
+	Abort(std::make_exception_ptr(MakeErrno(error, "Failed to receive")));
 }
+
+#endif
@@ -4,56 +4,113 @@
 
 #pragma once
 
+#include "Request.hxx"
+#include "Handler.hxx"
+#include "LuaConfig.hxx"
+#include "PeerAuth.hxx"
 #include "lua/AutoCloseList.hxx"
-#include "lua/CoRunner.hxx"
-#include "lua/Resume.hxx"
-#include "lua/ValuePtr.hxx"
-#include "event/net/UdpListener.hxx"
-#include "event/net/UdpHandler.hxx"
-#include "net/linux/PeerAuth.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
 #include "io/Logger.hxx"
-#include "io/UniqueFileDescriptor.hxx"
-#include "co/InvokeTask.hxx"
 #include "util/IntrusiveList.hxx"
+#include "config.h"
 
-#include <cstdint>
+#ifdef HAVE_URING
+#include "Uring.hxx"
+#endif
+
+#include <cstddef>
+#include <span>
 #include <string_view>
+#include <vector>
+
+struct iovec;
+struct EntityView;
 
-struct Action;
-struct Entity;
-class Instance;
-class UniqueSocketDescriptor;
+class BaseInstance;
 class FileDescriptor;
+class UniqueFileDescriptor;
 
 class PassageConnection final
-	: public AutoUnlinkIntrusiveListHook,
-	  Lua::ResumeListener,
-	  UdpHandler
+	: public AutoUnlinkIntrusiveListHook
+#ifdef HAVE_URING
+	, UringReceiveHandler
+#endif
 {
-	Instance &instance;
+	/**
+	 * The maximum number of requests with a "request_id" header
+	 * which may be in flight at the same time.
+	 */
+	static constexpr std::size_t MAX_REQUESTS = 64;
+
+	BaseInstance &instance;
+
+	/**
+	 * The configuration this connection was created with.  This
+	 * reference keeps its Lua state alive even if the
+	 * configuration gets reloaded.
+	 */
+	const LuaConfigPtr config;
+
+	const PassageHandlerPtr handler;
 
-	const Lua::ValuePtr handler;
+	/**
+	 * The index of #handler in #config; it is part of the
+	 * #ResponseCache key.
+	 */
+	const std::size_t handler_index;
 
-	const SocketPeerAuth peer_auth;
+	const PeerAuth peer_auth;
 
 	ChildLogger logger;
 
 	Lua::AutoCloseList auto_close;
 
-	UdpListener listener;
+	UniqueSocketDescriptor socket;
+
+	SocketEvent event;
 
+#ifdef HAVE_URING
 	/**
-	 * The Lua thread which runs the handler coroutine.
+	 * The multishot receive operation which is used instead of
+	 * #event if io_uring is available.
 	 */
-	Lua::CoRunner thread;
+	UringReceive *uring_receive = nullptr;
+#endif
 
-	Co::InvokeTask invoke_task;
+	/**
+	 * Invokes the handlers of #unstarted_requests if
+	 * LuaConfig::IsDeferHandlers() is enabled.
+	 */
+	DeferEvent resume_event;
+
+	/**
+	 * The requests currently being handled.
+	 */
+	IntrusiveList<PassageRequest> requests;
+
+	/**
+	 * Requests which have been received but whose handler has not
+	 * yet been invoked; see #resume_event.
+	 */
+	std::vector<PassageRequest *> unstarted_requests;
 
-	bool pending_response = false;
+	/**
+	 * If this is not nullptr, then the destructor sets the
+	 * pointed-to variable to true.  This allows a method which
+	 * invokes Lua handlers in a loop to find out whether a
+	 * handler has destroyed this connection.
+	 */
+	bool *destroyed_flag = nullptr;
 
 public:
-	PassageConnection(Instance &_instance,
-			  Lua::ValuePtr _handler,
+	/**
+	 * @param handler_index the index of the passage_listen() call
+	 * which created the listener
+	 */
+	PassageConnection(BaseInstance &_instance,
+			  LuaConfigPtr _config, std::size_t handler_index,
 			  const RootLogger &parent_logger,
 			  UniqueSocketDescriptor &&_fd, SocketAddress address);
 
@@ -61,27 +118,92 @@ public:
 
 	static void Register(lua_State *L);
 
+	BaseInstance &GetInstance() const noexcept {
+		return instance;
+	}
+
+	LuaConfig &GetConfig() const noexcept {
+		return *config;
+	}
+
+	std::size_t GetHandlerIndex() const noexcept {
+		return handler_index;
+	}
+
+	const PeerAuth &GetPeerAuth() const noexcept {
+		return peer_auth;
+	}
+
+	Lua::AutoCloseList &GetAutoClose() noexcept {
+		return auto_close;
+	}
+
+	const ChildLogger &GetLogger() const noexcept {
+		return logger;
+	}
+
+	/**
+	 * Send a response datagram consisting of the given buffers,
+	 * optionally with file descriptors (SCM_RIGHTS), with one
+	 * sendmsg() call.
+	 */
+	void SendResponse(std::span<const struct iovec> vec,
+			  FileDescriptor fd, FileDescriptor fd2);
+
+	/**
+	 * A fatal error has occurred; log it and close the
+	 * connection (which destroys all of its requests).
+	 */
+	void Abort(std::exception_ptr &&error) noexcept;
+
 private:
-	void DoExecPipe(SocketAddress address, const Action &action);
-	Co::InvokeTask Do(SocketAddress address, const Action &action);
-
-	void SendResponse(SocketAddress address, std::string_view status);
-	void SendResponse(SocketAddress address, std::string_view status,
-			  FileDescriptor fd,
-			  FileDescriptor fd2=FileDescriptor::Undefined());
-	void SendResponse(SocketAddress address, const Entity &response);
-	void SendError(SocketAddress address, const Action &action);
-
-	void OnCoComplete(std::exception_ptr &&error) noexcept;
-
-	/* virtual methods from class UdpHandler */
-	bool OnUdpDatagram(std::span<const std::byte> payload,
-			   std::span<UniqueFileDescriptor> fds,
-			   SocketAddress address, int uid) override;
-	bool OnUdpHangup() override;
-	void OnUdpError(std::exception_ptr &&error) noexcept override;
-
-	/* virtual methods from class Lua::ResumeListener */
-	void OnLuaFinished(lua_State *L) noexcept override;
-	void OnLuaError(lua_State *L, std::exception_ptr &&error) noexcept override;
+	/**
+	 * Look up the request in the #ResponseCache and send the
+	 * cached response.
+	 *
+	 * @param id the "request_id" header value (or nullptr)
+	 * @return true if a cached response was sent
+	 */
+	bool SendCachedResponse(const EntityView &request,
+				std::string_view id);
+
+	/**
+	 * Parse the payload and start handling it as a new request
+	 * (or schedule it if handlers are deferred).
+	 *
+	 * @param fd the file descriptor passed by the client with
+	 * this request (or undefined)
+	 */
+	void StartRequest(std::string_view payload,
+			  UniqueFileDescriptor &&fd);
+
+	/**
+	 * Handle one received datagram.
+	 *
+	 * @param excess_fds did the client pass more than one file
+	 * descriptor?
+	 * @param fd the file descriptor passed by the client (if
+	 * exactly one)
+	 * @return false if this object has been destroyed
+	 */
+	bool OnDatagram(std::span<const std::byte> payload,
+			bool truncated, bool excess_fds,
+			UniqueFileDescriptor &&fd) noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+	void OnResume() noexcept;
+
+#ifdef HAVE_URING
+	/**
+	 * Start receiving with io_uring if available, or else with
+	 * #event.
+	 */
+	void StartReceive() noexcept;
+
+	/* virtual methods from class UringReceiveHandler */
+	void OnUringDatagram(std::span<const std::byte> payload,
+			     bool truncated, bool excess_fds,
+			     UniqueFileDescriptor &&fd) noexcept override;
+	void OnUringReceiveError(int error) noexcept override;
+#endif
 };
@@ -4,9 +4,10 @@
 
 #pragma once
 
+#include "HeaderMap.hxx"
+
 #include <string>
 #include <forward_list>
-#include <map>
 
 /**
  * A request or response.
@@ -14,7 +15,7 @@
 struct Entity {
 	std::string command;
 	std::forward_list<std::string> args;
-	std::map<std::string, std::string, std::less<>> headers;
+	HeaderMap headers;
 	std::string body;
 
 	std::string Serialize() const noexcept;
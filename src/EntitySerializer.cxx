@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "EntitySerializer.hxx"
+#include "Entity.hxx"
+#include "Verify.hxx"
+#include "io/Iovec.hxx"
+#include "util/SpanCast.hxx"
+
+#include <algorithm> // for std::count_if()
+
+using std::string_view_literals::operator""sv;
+
+enum class Quoting {
+	/**
+	 * The parameter can be sent as-is.
+	 */
+	NONE,
+
+	/**
+	 * The parameter needs to be enclosed in quotes, but nothing
+	 * needs to be escaped; the value can still be sent from its
+	 * original storage.
+	 */
+	QUOTE,
+
+	/**
+	 * The parameter needs to be escaped and thus copied.
+	 */
+	ESCAPE,
+};
+
+[[gnu::pure]]
+static constexpr bool
+NeedsEscape(char ch) noexcept
+{
+	return ch == '\\' || ch == '"' ||
+		/* these characters are not legal and will be
+		   replaced with a space */
+		(ch != ' ' && IsWhitespaceOrNull(ch));
+}
+
+[[gnu::pure]]
+static Quoting
+GetQuoting(std::string_view value) noexcept
+{
+	if (IsValidUnquotedParameter(value))
+		return Quoting::NONE;
+
+	if (std::any_of(value.begin(), value.end(), NeedsEscape))
+		return Quoting::ESCAPE;
+
+	return Quoting::QUOTE;
+}
+
+[[gnu::pure]]
+static std::size_t
+GetEscapedSize(std::string_view value) noexcept
+{
+	return 2 + value.size() +
+		std::count_if(value.begin(), value.end(), [](char ch){
+			return ch == '\\' || ch == '"';
+		});
+}
+
+static void
+AppendEscapedParameter(std::pmr::string &dest, std::string_view value) noexcept
+{
+	dest.push_back('"');
+
+	for (char ch : value) {
+		if (ch == '\\' || ch == '"')
+			dest.push_back('\\');
+		else if (IsWhitespaceOrNull(ch))
+			/* TODO these characters are not legal, we
+			   should probably better throw an
+			   exception */
+			ch = ' ';
+
+		dest.push_back(ch);
+	}
+
+	dest.push_back('"');
+}
+
+static constexpr std::string_view space = " "sv;
+static constexpr std::string_view quote = "\""sv;
+static constexpr std::string_view colon = ":"sv;
+static constexpr std::string_view newline = "\n"sv;
+static constexpr std::string_view null_byte = "\0"sv;
+
+EntitySerializer::EntitySerializer(const Entity &entity,
+				   std::pmr::memory_resource *r,
+				   std::span<const HeaderView> extra_headers)
+	:vec(r), escaped(r)
+{
+	std::pmr::vector<std::string_view> args{r};
+	args.assign(entity.args.begin(), entity.args.end());
+
+	Build(entity.command, args, extra_headers, entity.headers, entity.body);
+}
+
+EntitySerializer::EntitySerializer(std::string_view command,
+				   std::span<const std::string_view> args,
+				   const HeaderMap &headers,
+				   std::string_view body,
+				   std::pmr::memory_resource *r,
+				   std::span<const HeaderView> extra_headers)
+	:vec(r), escaped(r)
+{
+	Build(command, args, extra_headers, headers, body);
+}
+
+void
+EntitySerializer::Build(std::string_view command,
+			std::span<const std::string_view> args,
+			std::span<const HeaderView> extra_headers,
+			const HeaderMap &headers,
+			std::string_view body)
+{
+	/* first pass: calculate the number of buffers and the size
+	   of the escape buffer */
+
+	std::size_t n_vec = 1, escaped_size = 0;
+
+	for (const auto i : args) {
+		switch (GetQuoting(i)) {
+		case Quoting::NONE:
+			n_vec += 2;
+			break;
+
+		case Quoting::QUOTE:
+			n_vec += 4;
+			break;
+
+		case Quoting::ESCAPE:
+			n_vec += 2;
+			escaped_size += GetEscapedSize(i);
+			break;
+		}
+	}
+
+	if (!extra_headers.empty() || !headers.empty())
+		n_vec += 1 + 4 * (extra_headers.size() + headers.size());
+
+	if (!body.empty())
+		n_vec += 2;
+
+	vec.reserve(n_vec);
+	escaped.reserve(escaped_size);
+
+	/* second pass: fill the buffers */
+
+	const auto add = [this](std::string_view s){
+		vec.push_back(MakeIovec(AsBytes(s)));
+		size += s.size();
+	};
+
+	add(command);
+
+	for (const auto i : args) {
+		add(space);
+
+		switch (GetQuoting(i)) {
+		case Quoting::NONE:
+			add(i);
+			break;
+
+		case Quoting::QUOTE:
+			add(quote);
+			add(i);
+			add(quote);
+			break;
+
+		case Quoting::ESCAPE:
+			{
+				const std::size_t position = escaped.size();
+				AppendEscapedParameter(escaped, i);
+				add(std::string_view{escaped}.substr(position));
+			}
+			break;
+		}
+	}
+
+	if (!extra_headers.empty() || !headers.empty())
+		add(newline);
+
+	for (const auto &[name, value] : extra_headers) {
+		add(name);
+		add(colon);
+		add(value);
+		add(newline);
+	}
+
+	for (const auto &[name, value] : headers) {
+		add(name);
+		add(colon);
+		add(value);
+		add(newline);
+	}
+
+	if (!body.empty()) {
+		add(null_byte);
+		add(body);
+	}
+}
+
+std::string
+EntitySerializer::ToString() const
+{
+	std::string result;
+	result.reserve(size);
+
+	for (const auto &i : vec)
+		result.append(static_cast<const char *>(i.iov_base), i.iov_len);
+
+	return result;
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility> // for std::pair
+#include <vector>
+
+#include <sys/uio.h> // for struct iovec
+
+struct Entity;
+class HeaderMap;
+
+/**
+ * Serializes an #Entity into a list of buffers suitable for
+ * sendmsg().  The buffers point into the #Entity (which must
+ * therefore remain valid and unmodified while this object is used);
+ * only parameters which need to be escaped are copied.
+ *
+ * The total size and the number of buffers are calculated up front,
+ * so there is at most one allocation for the #iovec array and one
+ * for escaped parameters, both from the given memory resource.
+ */
+class EntitySerializer {
+public:
+	/**
+	 * A header which is not stored in a #HeaderMap.
+	 */
+	using HeaderView = std::pair<std::string_view, std::string_view>;
+
+private:
+	std::pmr::vector<struct iovec> vec;
+
+	/**
+	 * Storage for escaped parameters.  Its capacity is reserved
+	 * in advance, so pointers to it remain valid.
+	 */
+	std::pmr::string escaped;
+
+	std::size_t size = 0;
+
+public:
+	/**
+	 * @param extra_headers headers to be sent in addition to (and
+	 * before) the ones in the #HeaderMap
+	 */
+	explicit EntitySerializer(const Entity &entity,
+				  std::pmr::memory_resource *r=std::pmr::get_default_resource(),
+				  std::span<const HeaderView> extra_headers={});
+
+	/**
+	 * Serialize an entity whose parts are not stored in an
+	 * #Entity object.  This avoids copying them into one.
+	 */
+	EntitySerializer(std::string_view command,
+			 std::span<const std::string_view> args,
+			 const HeaderMap &headers,
+			 std::string_view body,
+			 std::pmr::memory_resource *r=std::pmr::get_default_resource(),
+			 std::span<const HeaderView> extra_headers={});
+
+	/* not copyable or movable because #vec may point into
+	   #escaped, which may use the small-string buffer */
+	EntitySerializer(const EntitySerializer &) = delete;
+	EntitySerializer &operator=(const EntitySerializer &) = delete;
+
+	std::span<const struct iovec> GetVector() const noexcept {
+		return vec;
+	}
+
+	/**
+	 * The total number of bytes.
+	 */
+	std::size_t GetSize() const noexcept {
+		return size;
+	}
+
+	/**
+	 * Copy everything into a std::string.
+	 */
+	std::string ToString() const;
+
+private:
+	void Build(std::string_view command,
+		   std::span<const std::string_view> args,
+		   std::span<const HeaderView> extra_headers,
+		   const HeaderMap &headers,
+		   std::string_view body);
+};
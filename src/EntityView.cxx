@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "EntityView.hxx"
+#include "Entity.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+
+#include <cassert>
+
+std::string_view
+EntityView::NextArgument(std::string_view &line) noexcept
+{
+	line = StripLeft(line);
+	if (line.empty())
+		return {};
+
+	if (line.front() != '"') {
+		const auto [value, rest] = Split(line, ' ');
+		line = rest;
+		return value;
+	}
+
+	for (std::size_t i = 1; i < line.size(); ++i) {
+		const char ch = line[i];
+
+		if (ch == '"') {
+			const auto value = line.substr(0, i + 1);
+			line = line.substr(i + 1);
+			if (!line.empty())
+				/* skip the space after the closing quote */
+				line = line.substr(1);
+			return value;
+		}
+
+		if (ch == '\\')
+			++i;
+	}
+
+	/* unreachable because the parser has verified the syntax
+	   already */
+	assert(false);
+	line = {};
+	return {};
+}
+
+std::string_view
+EntityView::DecodeArgument(std::string_view raw, std::string &buffer) noexcept
+{
+	assert(!raw.empty());
+
+	if (raw.front() != '"')
+		return raw;
+
+	assert(raw.size() >= 2);
+	assert(raw.back() == '"');
+
+	const auto quoted = raw.substr(1, raw.size() - 2);
+	if (quoted.find('\\') == quoted.npos)
+		/* fast path: nothing to unescape */
+		return quoted;
+
+	buffer.clear();
+
+	for (std::size_t i = 0; i < quoted.size(); ++i) {
+		char ch = quoted[i];
+		if (ch == '\\' && i + 1 < quoted.size())
+			ch = quoted[++i];
+
+		buffer.push_back(ch);
+	}
+
+	return buffer;
+}
+
+EntityView::Header
+EntityView::NextHeader(std::string_view &rest) noexcept
+{
+	const auto [line, next] = Split(rest, '\n');
+	rest = next;
+	if (line.empty())
+		return {};
+
+	const auto [name, value] = Split(line, ':');
+	return {name, StripLeft(value)};
+}
+
+std::string_view
+EntityView::FindHeader(std::string_view name) const noexcept
+{
+	for (auto rest = headers;;) {
+		const auto i = NextHeader(rest);
+		if (i.name.data() == nullptr || i.name == name)
+			return i.value;
+	}
+}
+
+static constexpr std::string_view
+Relocate(std::string_view s, const char *old_payload,
+	 const char *new_payload) noexcept
+{
+	if (s.data() == nullptr)
+		return s;
+
+	return {new_payload + (s.data() - old_payload), s.size()};
+}
+
+EntityView
+EntityView::Relocate(const char *old_payload,
+		     const char *new_payload) const noexcept
+{
+	return {
+		.command = ::Relocate(command, old_payload, new_payload),
+		.args = ::Relocate(args, old_payload, new_payload),
+		.headers = ::Relocate(headers, old_payload, new_payload),
+		.body = ::Relocate(body, old_payload, new_payload),
+	};
+}
+
+Entity
+EntityView::ToEntity() const
+{
+	Entity entity{
+		.command = std::string{command},
+	};
+
+	auto args_tail = entity.args.before_begin();
+	ForEachArgument([&entity, &args_tail](std::string_view value){
+		args_tail = entity.args.emplace_after(args_tail, value);
+	});
+
+	ForEachHeader([&entity](std::string_view name, std::string_view value){
+		entity.headers.emplace(name, value);
+	});
+
+	if (!body.empty())
+		entity.body = std::string{body};
+
+	return entity;
+}
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <concepts>
+#include <string>
+#include <string_view>
+
+struct Entity;
+
+/**
+ * A parsed request or response which does not own any of its data;
+ * all fields point into the payload it was parsed from (see
+ * ParseEntityView()).  The payload has already been verified, but
+ * quoted arguments are decoded only when they are being accessed.
+ */
+struct EntityView {
+	std::string_view command;
+
+	/**
+	 * The raw argument list, i.e. the rest of the first line
+	 * after the command.  Use ForEachArgument() to decode it.
+	 */
+	std::string_view args;
+
+	/**
+	 * The raw header lines.  Use ForEachHeader() or FindHeader()
+	 * to access them.
+	 */
+	std::string_view headers;
+
+	std::string_view body;
+
+	/**
+	 * Invoke the given function for each (decoded) argument.  The
+	 * std::string_view passed to it is only valid during the
+	 * call.
+	 */
+	void ForEachArgument(std::invocable<std::string_view> auto f) const {
+		std::string buffer;
+
+		for (auto line = args;;) {
+			const auto raw = NextArgument(line);
+			if (raw.data() == nullptr)
+				break;
+
+			f(DecodeArgument(raw, buffer));
+		}
+	}
+
+	/**
+	 * Invoke the given function for each header.  Duplicate
+	 * headers are passed as well; the first one is the one that
+	 * counts.
+	 */
+	void ForEachHeader(std::invocable<std::string_view, std::string_view> auto f) const {
+		for (auto rest = headers;;) {
+			const auto [name, value] = NextHeader(rest);
+			if (name.data() == nullptr)
+				break;
+
+			f(name, value);
+		}
+	}
+
+	/**
+	 * Look up a header value.
+	 *
+	 * @return the value or a std::string_view with nullptr data
+	 * if there is no such header
+	 */
+	[[gnu::pure]]
+	std::string_view FindHeader(std::string_view name) const noexcept;
+
+	/**
+	 * Return a copy of this object pointing into another copy of
+	 * the payload it was parsed from.
+	 */
+	[[gnu::pure]]
+	EntityView Relocate(const char *old_payload,
+			    const char *new_payload) const noexcept;
+
+	/**
+	 * Decode and copy everything into a new #Entity.
+	 */
+	Entity ToEntity() const;
+
+private:
+	/**
+	 * Split the next raw argument from the (already verified)
+	 * argument list.
+	 *
+	 * @return the raw argument (including quotes) or a
+	 * std::string_view with nullptr data at the end of the list
+	 */
+	static std::string_view NextArgument(std::string_view &line) noexcept;
+
+	/**
+	 * Decode a raw argument.  If no unescaping is necessary, the
+	 * return value points into @p raw; else it points into @p
+	 * buffer.
+	 */
+	static std::string_view DecodeArgument(std::string_view raw,
+					       std::string &buffer) noexcept;
+
+	struct Header {
+		std::string_view name, value;
+	};
+
+	/**
+	 * Split the next header from the (already verified) header
+	 * block.
+	 *
+	 * @return the header or a #Header with nullptr name at the
+	 * end of the block
+	 */
+	static Header NextHeader(std::string_view &rest) noexcept;
+};
@@ -4,31 +4,70 @@
 
 #include "ExecPipe.hxx"
 #include "Action.hxx" // for StderrOption
+#include "SpawnClient.hxx"
 #include "lib/fmt/SystemError.hxx"
 #include "io/Pipe.hxx"
+#include "system/Error.hxx"
 #include "util/ScopeExit.hxx"
 
+#include <cerrno>
+#include <stdexcept>
+#include <utility> // for std::pair
+
 #include <signal.h>
 #include <spawn.h>
+#include <unistd.h>
 
-ExecPipeResult
-ExecPipe(const char *path, const char *const*args,
-	 const char *const*env,
-	 FileDescriptor cgroup,
-	 StderrOption stderr_option)
+static std::pair<UniqueFileDescriptor, UniqueFileDescriptor>
+CreateStderrPipe(StderrOption stderr_option)
 {
-	auto [r, w] = CreatePipe();
-
-	UniqueFileDescriptor stderr_r, stderr_w;
 	switch (stderr_option) {
 	case StderrOption::JOURNAL:
 		break;
 
 	case StderrOption::PIPE:
-		std::tie(stderr_r, stderr_w) = CreatePipe();
-		break;
+		return CreatePipe();
 	}
 
+	return {};
+}
+
+UniqueFileDescriptor
+CreateStdinPipe(std::span<const std::byte> data)
+{
+	auto [r, w] = CreatePipe();
+
+	if (data.empty())
+		return std::move(r);
+
+	/* nobody reads from the pipe yet; don't block if it is
+	   full */
+	w.SetNonBlocking();
+
+	const auto nbytes = w.Write(data);
+	if (nbytes < 0)
+		throw MakeErrno("Failed to write to pipe");
+
+	if (static_cast<std::size_t>(nbytes) < data.size())
+		/* the pipe buffer cannot be enlarged reliably:
+		   F_SETPIPE_SZ fails with EPERM in exactly the case
+		   where the buffer is small (the user has exceeded
+		   /proc/sys/fs/pipe-user-pages-soft) */
+		throw std::runtime_error{"Data does not fit into the pipe buffer"};
+
+	return std::move(r);
+}
+
+ExecPipeResult
+ExecPipe(const char *path, const char *const*args,
+	 const char *const*env,
+	 FileDescriptor stdin_fd,
+	 FileDescriptor cgroup,
+	 StderrOption stderr_option)
+{
+	auto [r, w] = CreatePipe();
+	auto [stderr_r, stderr_w] = CreateStderrPipe(stderr_option);
+
 	posix_spawnattr_t attr;
 	posix_spawnattr_init(&attr);
 	AtScopeExit(&attr) { posix_spawnattr_destroy(&attr); };
@@ -52,20 +91,93 @@ ExecPipe(const char *path, const char *const*args,
 	posix_spawn_file_actions_init(&file_actions);
 	AtScopeExit(&file_actions) { posix_spawn_file_actions_destroy(&file_actions); };
 
+	if (stdin_fd.IsDefined())
+		posix_spawn_file_actions_adddup2(&file_actions, stdin_fd.Get(), STDIN_FILENO);
+
         posix_spawn_file_actions_adddup2(&file_actions, w.Get(), STDOUT_FILENO);
 
 	if (stderr_w.IsDefined())
 		posix_spawn_file_actions_adddup2(&file_actions, stderr_w.Get(), STDERR_FILENO);
 
-	pid_t pid;
-	if (int error = posix_spawn(&pid, path, &file_actions, &attr,
+	/* obtain the pidfd while creating the process; opening it
+	   later would race with the main thread's ZombieReaper,
+	   which may collect the process (and its pid may get
+	   reused) in the meantime */
+	int pidfd;
+	int error = pidfd_spawn(&pidfd, path, &file_actions, &attr,
+				const_cast<char *const *>(args),
+				const_cast<char *const *>(env));
+	if (error == ENOSYS) {
+		/* the kernel does not support clone3(); without a
+		   pidfd, the process is not counted by the
+		   ChildLimiter */
+		pid_t pid;
+		error = posix_spawn(&pid, path, &file_actions, &attr,
 				    const_cast<char *const *>(args),
 				    const_cast<char *const *>(env));
-	    error != 0)
+		pidfd = -1;
+	}
+
+	if (error != 0)
 		throw FmtErrno(error, "Failed to execute {:?}", path);
 
 	return {
 		.stdout_pipe = std::move(r),
 		.stderr_pipe = std::move(stderr_r),
+		.pidfd = pidfd >= 0
+			? UniqueFileDescriptor{AdoptTag{}, pidfd}
+			: UniqueFileDescriptor{},
+	};
+}
+
+Co::Task<ExecPipeResult>
+CoExecPipe(SpawnClient &spawner,
+	   const char *path, const char *const*args,
+	   const char *const*env,
+	   FileDescriptor stdin_fd,
+	   FileDescriptor cgroup,
+	   StderrOption stderr_option)
+{
+	if (!spawner.IsEnabled())
+		co_return ExecPipe(path, args, env, stdin_fd, cgroup, stderr_option);
+
+	auto [r, w] = CreatePipe();
+	auto [stderr_r, stderr_w] = CreateStderrPipe(stderr_option);
+
+	SpawnRequest request{path, args, env, stdin_fd, w, stderr_w, cgroup};
+	if (!co_await spawner.Send(request))
+		co_return ExecPipe(path, args, env, stdin_fd, cgroup, stderr_option);
+
+	/* the spawner has received its own copies of these */
+	w.Close();
+	stderr_w.Close();
+
+	auto response = co_await CoSpawnResponse{spawner.GetEventLoop(), std::move(request.response_socket)};
+
+	if (!response) {
+		/* the spawner has died; if it has died after
+		   clone3(), the program may be executed twice, but
+		   that is better than failing all requests from now
+		   on */
+		spawner.Disable("Spawner has died");
+		co_return ExecPipe(path, args, env, stdin_fd, cgroup, stderr_option);
+	}
+
+	if (response->error == ENOSYS) {
+		spawner.Disable("clone3() not supported");
+		co_return ExecPipe(path, args, env, stdin_fd, cgroup, stderr_option);
+	}
+
+	if (response->error != 0)
+		throw FmtErrno(response->error, "Failed to execute {:?}", path);
+
+	/* wait for execve() without blocking the spawner or the
+	   EventLoop */
+	co_await CoSpawnExec{spawner.GetEventLoop(), std::move(response->exec_pipe), path};
+
+	co_return ExecPipeResult{
+		.stdout_pipe = std::move(r),
+		.stderr_pipe = std::move(stderr_r),
+		.pidfd = std::move(response->pidfd),
 	};
 }
@@ -5,10 +5,14 @@
 #pragma once
 
 #include "io/UniqueFileDescriptor.hxx"
+#include "co/Task.hxx"
 
+#include <cstddef>
 #include <cstdint>
+#include <span>
 
 enum class StderrOption : uint_least8_t;
+class SpawnClient;
 
 struct ExecPipeResult {
 	/**
@@ -18,15 +22,51 @@ struct ExecPipeResult {
 	UniqueFileDescriptor stdout_pipe;
 
 	UniqueFileDescriptor stderr_pipe;
+
+	/**
+	 * A pidfd referring to the child process (undefined if the
+	 * kernel does not support it).
+	 */
+	UniqueFileDescriptor pidfd;
 };
 
+/**
+ * Create a pipe which contains the given data, to be used as a
+ * child's stdin.  The write end is closed, so the child reads
+ * end-of-file after the data.  The data must fit into the pipe
+ * buffer, which is 64 kB by default, but only one page if the user
+ * has exceeded /proc/sys/fs/pipe-user-pages-soft.
+ *
+ * Throws on error.
+ *
+ * @return the read end of the pipe
+ */
+UniqueFileDescriptor
+CreateStdinPipe(std::span<const std::byte> data);
+
 /**
  * Launch a process with a pipe connected to STDOUT.
  *
  * @param args a nullptr-terminated list of command-line arguments
+ * @param stdin_fd the child's stdin (or undefined to inherit ours)
  */
 ExecPipeResult
 ExecPipe(const char *path, const char *const*args,
 	 const char *const*env,
+	 FileDescriptor stdin_fd,
 	 FileDescriptor cgroup,
 	 StderrOption stderr_option);
+
+/**
+ * Like ExecPipe(), but let the spawner process (see StartSpawner())
+ * launch the process, and wait for it without blocking the
+ * #EventLoop.  Falls back to ExecPipe() if the spawner is not
+ * available (or fails).
+ */
+Co::Task<ExecPipeResult>
+CoExecPipe(SpawnClient &spawner,
+	   const char *path, const char *const*args,
+	   const char *const*env,
+	   FileDescriptor stdin_fd,
+	   FileDescriptor cgroup,
+	   StderrOption stderr_option);
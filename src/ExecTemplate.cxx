@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ExecTemplate.hxx"
+#include "Action.hxx"
+
+#include <algorithm> // for std::copy()
+
+static std::size_t
+TotalLength(const std::vector<std::string> &v) noexcept
+{
+	std::size_t result = 0;
+	for (const auto &i : v)
+		result += i.size() + 1;
+	return result;
+}
+
+static char *
+CopyStrings(const std::vector<std::string> &src, char *dest,
+	    const char **pointers) noexcept
+{
+	for (const auto &i : src) {
+		*pointers++ = dest;
+		dest = std::copy(i.begin(), i.end(), dest);
+		*dest++ = '\0';
+	}
+
+	*pointers = nullptr;
+	return dest;
+}
+
+ExecTemplate::ExecTemplate(const ExecPipeAction &src)
+	:strings(new char[TotalLength(src.exec) + TotalLength(src.env)]),
+	 pointers(new const char *[src.exec.size() + 1 + src.env.size() + 1]),
+	 n_args(src.exec.size()),
+	 stdin_option(src.stdin),
+	 stderr_option(src.stderr),
+	 cgroup_client(src.cgroup_client)
+{
+	char *p = strings.get();
+	p = CopyStrings(src.exec, p, pointers.get());
+	CopyStrings(src.env, p, pointers.get() + n_args + 1);
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+struct ExecPipeAction;
+enum class StdinOption : uint_least8_t;
+enum class StderrOption : uint_least8_t;
+
+/**
+ * A prebuilt exec_pipe() command line (see
+ * passage_exec_template()).  All strings are stored in one buffer,
+ * and the argument and environment pointer arrays are ready to be
+ * passed to execve(), so instantiating it does not need to convert
+ * anything.
+ *
+ * This object is immutable and may be shared by all threads.
+ */
+class ExecTemplate {
+	/**
+	 * All strings, each null-terminated.
+	 */
+	std::unique_ptr<char[]> strings;
+
+	/**
+	 * The arguments and the environment, each terminated with
+	 * nullptr.
+	 */
+	std::unique_ptr<const char *[]> pointers;
+
+	std::size_t n_args;
+
+	StdinOption stdin_option;
+
+	StderrOption stderr_option;
+
+	bool cgroup_client;
+
+public:
+	explicit ExecTemplate(const ExecPipeAction &src);
+
+	ExecTemplate(const ExecTemplate &) = delete;
+	ExecTemplate &operator=(const ExecTemplate &) = delete;
+
+	/**
+	 * The nullptr-terminated program path and arguments.
+	 */
+	const char *const*GetArgv() const noexcept {
+		return pointers.get();
+	}
+
+	/**
+	 * The program path and the arguments (without the nullptr
+	 * terminator).
+	 */
+	std::span<const char *const> GetArgs() const noexcept {
+		return {pointers.get(), n_args};
+	}
+
+	/**
+	 * The nullptr-terminated environment.
+	 */
+	const char *const*GetEnv() const noexcept {
+		return pointers.get() + n_args + 1;
+	}
+
+	StdinOption GetStdinOption() const noexcept {
+		return stdin_option;
+	}
+
+	StderrOption GetStderrOption() const noexcept {
+		return stderr_option;
+	}
+
+	bool IsCgroupClient() const noexcept {
+		return cgroup_client;
+	}
+};
+
+using ExecTemplatePtr = std::shared_ptr<const ExecTemplate>;
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A read-only plain C view of a request for the LuaJIT FFI.  Field
+ * accesses through the "passage.request" userdata go through a C
+ * function (__index) which the JIT cannot compile; accesses to this
+ * struct via ffi.cast() can be traced.
+ *
+ * The layout must match #passage_ffi_cdef.
+ */
+
+struct PassageFfiString {
+	const char *data;
+	std::size_t size;
+};
+
+struct PassageFfiHeader {
+	PassageFfiString name, value;
+};
+
+struct PassageFfiRequest {
+	PassageFfiString command;
+	PassageFfiString body;
+
+	/**
+	 * The decoded arguments.
+	 */
+	const PassageFfiString *args;
+
+	const PassageFfiHeader *headers;
+
+	uint32_t n_args, n_headers;
+
+	/**
+	 * The client's credentials; -1 if unknown.
+	 */
+	int64_t pid, uid, gid;
+};
+
+/**
+ * The declarations to be passed to ffi.cdef(); available to Lua as
+ * the global variable "passage_ffi_cdef".
+ */
+inline constexpr char passage_ffi_cdef[] = R"(
+struct passage_string {
+	const char *data;
+	size_t size;
+};
+
+struct passage_header {
+	struct passage_string name, value;
+};
+
+struct passage_request {
+	struct passage_string command;
+	struct passage_string body;
+	const struct passage_string *args;
+	const struct passage_header *headers;
+	uint32_t n_args, n_headers;
+	int64_t pid, uid, gid;
+};
+)";
+
+static_assert(sizeof(PassageFfiString) == 2 * sizeof(void *));
+static_assert(sizeof(PassageFfiHeader) == 2 * sizeof(PassageFfiString));
+static_assert(offsetof(PassageFfiRequest, args) == 2 * sizeof(PassageFfiString));
+static_assert(offsetof(PassageFfiRequest, n_args) == offsetof(PassageFfiRequest, headers) + sizeof(void *));
+static_assert(offsetof(PassageFfiRequest, pid) == offsetof(PassageFfiRequest, n_args) + 8);
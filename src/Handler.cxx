@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Handler.hxx"
+#include "Verify.hxx"
+#include "lua/StringView.hxx"
+
+#include <stdexcept>
+#include <tuple> // for std::forward_as_tuple()
+#include <utility> // for std::piecewise_construct
+
+extern "C" {
+#include <lua.h>
+}
+
+PassageHandler::PassageHandler(lua_State *_L, int idx)
+	:L(_L)
+{
+	if (lua_isfunction(L, idx)) {
+		fallback.emplace(L, Lua::StackIndex(idx));
+		return;
+	}
+
+	if (!lua_istable(L, idx))
+		throw std::invalid_argument{"function or table expected"};
+
+	for (lua_pushnil(L); lua_next(L, idx) != 0; lua_pop(L, 1)) {
+		/* check the key type without lua_isstring(), because
+		   converting a number key in place would confuse
+		   lua_next() */
+		if (lua_type(L, -2) != LUA_TSTRING)
+			throw std::invalid_argument{"command name expected"};
+
+		if (!lua_isfunction(L, -1))
+			throw std::invalid_argument{"function expected"};
+
+		const auto command = Lua::ToStringView(L, -2);
+		const Lua::StackIndex value(lua_gettop(L));
+
+		if (command == FALLBACK_KEY) {
+			fallback.emplace(L, value);
+			continue;
+		}
+
+		if (!CheckCharsNonEmpty(command, IsValidCommandChar))
+			throw std::invalid_argument{"malformed command name"};
+
+		commands.emplace(std::piecewise_construct,
+				 std::forward_as_tuple(command),
+				 std::forward_as_tuple(L, value));
+	}
+}
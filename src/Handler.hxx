@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "lua/Value.hxx"
+
+#include <functional> // for std::equal_to
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * The handler of a passage_listen() call: either one Lua function
+ * which handles all commands, or a table mapping command names to
+ * Lua functions (with an optional fallback).  The table is converted
+ * to a hash map when the configuration is loaded, so dispatching a
+ * request does not involve any Lua string comparisons.
+ */
+class PassageHandler {
+	/**
+	 * Allows looking up a std::string_view without constructing a
+	 * std::string.
+	 */
+	struct Hash : std::hash<std::string_view> {
+		using is_transparent = void;
+	};
+
+	lua_State *const L;
+
+	std::unordered_map<std::string, Lua::Value, Hash, std::equal_to<>> commands;
+
+	/**
+	 * The function for commands which are not in #commands.
+	 */
+	std::optional<Lua::Value> fallback;
+
+public:
+	/**
+	 * The table key of the fallback handler.  It cannot collide
+	 * with a command name because "*" is not a valid command
+	 * character.
+	 */
+	static constexpr std::string_view FALLBACK_KEY = "*";
+
+	/**
+	 * Create a handler from the function or table at the given
+	 * stack index.
+	 *
+	 * Throws std::invalid_argument if the value is malformed.
+	 */
+	PassageHandler(lua_State *_L, int idx);
+
+	PassageHandler(const PassageHandler &) = delete;
+	PassageHandler &operator=(const PassageHandler &) = delete;
+
+	lua_State *GetState() const noexcept {
+		return L;
+	}
+
+	/**
+	 * Find the function which handles the given command.
+	 *
+	 * @return the function or nullptr if the command is not
+	 * handled
+	 */
+	[[gnu::pure]]
+	const Lua::Value *Find(std::string_view command) const noexcept {
+		if (const auto i = commands.find(command); i != commands.end())
+			return &i->second;
+
+		return fallback ? &*fallback : nullptr;
+	}
+};
+
+using PassageHandlerPtr = std::shared_ptr<const PassageHandler>;
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <tuple> // for std::forward_as_tuple()
+#include <utility>
+#include <vector>
+
+/**
+ * A container for name/value pairs (headers) which is a flat vector
+ * sorted by name.  It implements a subset of the std::map API.
+ *
+ * Since there are usually only very few headers, this is cheaper
+ * than a std::map both to build and to look up: one allocation for
+ * all items and no pointer chasing.
+ */
+class HeaderMap {
+public:
+	using value_type = std::pair<std::string, std::string>;
+
+private:
+	/**
+	 * The number of items reserved on the first insertion; this
+	 * should be enough for nearly all requests.
+	 */
+	static constexpr std::size_t INITIAL_CAPACITY = 8;
+
+	using Vector = std::vector<value_type>;
+	Vector items;
+
+public:
+	using iterator = Vector::iterator;
+	using const_iterator = Vector::const_iterator;
+	using size_type = Vector::size_type;
+
+	HeaderMap() noexcept = default;
+
+	HeaderMap(std::initializer_list<value_type> init) {
+		items.reserve(init.size());
+		for (const auto &[name, value] : init)
+			emplace(name, value);
+	}
+
+	bool operator==(const HeaderMap &) const noexcept = default;
+
+	bool empty() const noexcept {
+		return items.empty();
+	}
+
+	size_type size() const noexcept {
+		return items.size();
+	}
+
+	void clear() noexcept {
+		items.clear();
+	}
+
+	iterator begin() noexcept {
+		return items.begin();
+	}
+
+	iterator end() noexcept {
+		return items.end();
+	}
+
+	const_iterator begin() const noexcept {
+		return items.begin();
+	}
+
+	const_iterator end() const noexcept {
+		return items.end();
+	}
+
+	[[gnu::pure]]
+	iterator find(std::string_view name) noexcept {
+		auto i = LowerBound(name);
+		return i != end() && i->first == name ? i : end();
+	}
+
+	[[gnu::pure]]
+	const_iterator find(std::string_view name) const noexcept {
+		auto i = LowerBound(name);
+		return i != end() && i->first == name ? i : end();
+	}
+
+	[[gnu::pure]]
+	bool contains(std::string_view name) const noexcept {
+		return find(name) != end();
+	}
+
+	/**
+	 * Insert a new item unless one with the same name exists
+	 * already (like std::map::emplace()).
+	 */
+	std::pair<iterator, bool> emplace(std::string_view name,
+					  std::string_view value) {
+		if (items.capacity() == 0)
+			items.reserve(INITIAL_CAPACITY);
+
+		auto i = LowerBound(name);
+		if (i != end() && i->first == name)
+			return {i, false};
+
+		/* nearly all headers arrive sorted (or there is just
+		   one), and then this is just an append */
+		i = items.emplace(i, std::piecewise_construct,
+				  std::forward_as_tuple(name),
+				  std::forward_as_tuple(value));
+		return {i, true};
+	}
+
+	/**
+	 * Insert a new item or replace the value of an existing one
+	 * (like std::map::insert_or_assign()).
+	 */
+	iterator insert_or_assign(std::string_view name, std::string_view value) {
+		auto [i, inserted] = emplace(name, value);
+		if (!inserted)
+			i->second = value;
+		return i;
+	}
+
+private:
+	[[gnu::pure]]
+	iterator LowerBound(std::string_view name) noexcept {
+		return std::lower_bound(items.begin(), items.end(), name,
+					[](const value_type &a, std::string_view b){
+						return std::string_view{a.first} < b;
+					});
+	}
+
+	[[gnu::pure]]
+	const_iterator LowerBound(std::string_view name) const noexcept {
+		return std::lower_bound(items.begin(), items.end(), name,
+					[](const value_type &a, std::string_view b){
+						return std::string_view{a.first} < b;
+					});
+	}
+};
@@ -4,34 +4,39 @@
 
 #include "Instance.hxx"
 #include "Listener.hxx"
+#include "Config.hxx"
 #include "net/SocketConfig.hxx"
 #include "system/Error.hxx"
 
-extern "C" {
-#include <lauxlib.h>
-}
-
 #ifdef HAVE_LIBSYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
 
+#include <iterator> // for std::next()
 #include <stdexcept>
 
-Instance::Instance()
-	:sighup_event(event_loop, SIGHUP, BIND_THIS_METHOD(OnReload)),
-	 lua_state(luaL_newstate())
+Instance::Instance(const CommandLine &_cmdline,
+		   UniqueSocketDescriptor &&_spawner)
+	:BaseInstance(process_caches, _spawner),
+	 sighup_event(event_loop, SIGHUP, BIND_THIS_METHOD(OnReload)),
+	 cmdline(_cmdline),
+	 spawner_socket(std::move(_spawner))
 {
 	shutdown_listener.Enable();
 	sighup_event.Enable();
 }
 
-Instance::~Instance() noexcept = default;
+Instance::~Instance() noexcept
+{
+	/* release the slots now, because the #ChildLimiter (in
+	   #process_caches) is destroyed before our base class */
+	child_watches.Clear();
+}
 
 inline void
-Instance::AddListener(UniqueSocketDescriptor &&fd, Lua::ValuePtr &&handler)
+Instance::AddListener(UniqueSocketDescriptor &&fd, std::size_t handler_index)
 {
-	listeners.emplace_front(event_loop, *this, std::move(handler),
-				logger);
+	listeners.emplace_front(*this, handler_index, logger);
 	listeners.front().Listen(std::move(fd));
 }
 
@@ -53,15 +58,15 @@ MakeListener(SocketAddress address)
 }
 
 void
-Instance::AddListener(SocketAddress address, Lua::ValuePtr &&handler)
+Instance::AddListener(SocketAddress address, std::size_t handler_index)
 {
-	AddListener(MakeListener(address), std::move(handler));
+	AddListener(MakeListener(address), handler_index);
 }
 
 #ifdef HAVE_LIBSYSTEMD
 
 void
-Instance::AddSystemdListener(Lua::ValuePtr &&handler)
+Instance::AddSystemdListener(std::size_t handler_index)
 {
 	int n = sd_listen_fds(true);
 	if (n < 0)
@@ -70,13 +75,57 @@ Instance::AddSystemdListener(Lua::ValuePtr &&handler)
 	if (n == 0)
 		throw std::runtime_error("No systemd socket");
 
+	/* all sockets share one handler, i.e. one handler index */
 	for (unsigned i = 0; i < unsigned(n); ++i)
 		AddListener(UniqueSocketDescriptor(AdoptTag{}, SD_LISTEN_FDS_START + i),
-			    Lua::ValuePtr(handler));
+			    handler_index);
 }
 
 #endif // HAVE_LIBSYSTEMD
 
+Worker &
+Instance::AddWorker()
+{
+	return workers.emplace_front(process_caches, spawner_socket);
+}
+
+void
+Instance::StartWorkers()
+{
+	for (auto &i : workers)
+		i.Start();
+
+	next_worker = workers.begin();
+}
+
+Worker *
+Instance::FindLeastLoadedWorker() noexcept
+{
+	if (workers.empty())
+		return nullptr;
+
+	/* start searching at the worker after the one selected
+	   last time; this way, connections are distributed
+	   round-robin as long as the loads are equal, e.g. while the
+	   workers have not yet picked up the connections passed to
+	   them */
+	auto best = next_worker;
+	auto i = next_worker;
+	do {
+		if (i->GetConnectionCount() < best->GetConnectionCount())
+			best = i;
+
+		if (++i == workers.end())
+			i = workers.begin();
+	} while (i != next_worker);
+
+	next_worker = std::next(best);
+	if (next_worker == workers.end())
+		next_worker = workers.begin();
+
+	return &*best;
+}
+
 void
 Instance::Check()
 {
@@ -89,16 +138,28 @@ Instance::OnShutdown() noexcept
 {
 	shutdown_listener.Disable();
 	sighup_event.Disable();
+	process_caches.cgroup.Disable();
 
 #ifdef HAVE_LIBSYSTEMD
 	systemd_watchdog.Disable();
 #endif
 
+	for (auto &i : workers)
+		i.Stop();
+
 	event_loop.Break();
 }
 
 void
 Instance::OnReload(int) noexcept
 {
-	reload.Start();
+	if (reload_config) {
+		ReloadConfig(*this);
+		return;
+	}
+
+	config->StartReload();
+
+	for (auto &i : workers)
+		i.Reload();
 }
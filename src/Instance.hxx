@@ -4,32 +4,31 @@
 
 #pragma once
 
+#include "BaseInstance.hxx"
 #include "Listener.hxx"
-#include "lua/ReloadRunner.hxx"
-#include "lua/State.hxx"
-#include "lua/ValuePtr.hxx"
+#include "Worker.hxx"
 #include "spawn/ZombieReaper.hxx"
-#include "io/Logger.hxx"
-#include "event/Loop.hxx"
 #include "event/ShutdownListener.hxx"
 #include "event/SignalEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
 #include "config.h"
 
 #ifdef HAVE_LIBSYSTEMD
 #include "event/systemd/Watchdog.hxx"
 #endif
 
-#ifdef HAVE_CURL
-#include "lib/curl/Global.hxx"
-#endif
-
+#include <cstddef>
 #include <forward_list>
 
+struct CommandLine;
 class SocketAddress;
-class UniqueSocketDescriptor;
 
-class Instance final {
-	EventLoop event_loop;
+/**
+ * The main thread: it loads the configuration, accepts connections
+ * and handles signals.  Without workers, it also handles all
+ * requests.
+ */
+class Instance final : public BaseInstance {
 	ShutdownListener shutdown_listener{event_loop, BIND_THIS_METHOD(OnShutdown)};
 	SignalEvent sighup_event;
 
@@ -37,55 +36,123 @@ class Instance final {
 	Systemd::Watchdog systemd_watchdog{event_loop};
 #endif
 
-#ifdef HAVE_CURL
-	CurlGlobal curl{event_loop};
-#endif
-
 	ZombieReaper zombie_reaper{event_loop};
 
-	Lua::State lua_state;
+	const CommandLine &cmdline;
 
-	Lua::ReloadRunner reload{lua_state.get()};
+	/**
+	 * This is declared before #workers because they use it.
+	 */
+	SharedCaches process_caches{event_loop, logger};
+
+	/**
+	 * The socket connected to the spawner process (may be
+	 * undefined).  This is declared before #workers because they
+	 * use it.
+	 */
+	const UniqueSocketDescriptor spawner_socket;
 
 	std::forward_list<PassageListener> listeners;
 
-public:
-	RootLogger logger;
+	/**
+	 * The number of workers requested by passage_workers().
+	 */
+	unsigned n_workers = 0;
 
-	Instance();
-	~Instance() noexcept;
+	/**
+	 * If true, then SIGHUP reloads the configuration file
+	 * instead of calling the Lua "reload" function; see
+	 * passage_reload_config().
+	 */
+	bool reload_config = false;
 
-	auto &GetEventLoop() noexcept {
-		return event_loop;
-	}
+	std::forward_list<Worker> workers;
 
-#ifdef HAVE_CURL
-	auto &GetCurl() noexcept {
-		return curl;
-	}
-#endif
+	/**
+	 * Where FindLeastLoadedWorker() starts searching, so
+	 * connections are distributed round-robin among workers with
+	 * the same load.
+	 */
+	std::forward_list<Worker>::iterator next_worker;
 
-	lua_State *GetLuaState() {
-		return lua_state.get();
-	}
+public:
+	/**
+	 * @param _spawner the socket returned by StartSpawner() (or
+	 * undefined)
+	 */
+	Instance(const CommandLine &_cmdline,
+		 UniqueSocketDescriptor &&_spawner);
+	~Instance() noexcept;
 
-	void AddListener(UniqueSocketDescriptor &&fd,
-			 Lua::ValuePtr &&handler);
+	const CommandLine &GetCommandLine() const noexcept {
+		return cmdline;
+	}
 
-	void AddListener(SocketAddress address,
-			 Lua::ValuePtr &&handler);
+	/**
+	 * @param handler_index the index of the handler in the
+	 * #LuaConfig
+	 */
+	void AddListener(SocketAddress address, std::size_t handler_index);
 
 #ifdef HAVE_LIBSYSTEMD
 	/**
 	 * Listen for incoming connections on sockets passed by systemd
 	 * (systemd socket activation).
 	 */
-	void AddSystemdListener(Lua::ValuePtr &&handler);
+	void AddSystemdListener(std::size_t handler_index);
 #endif // HAVE_LIBSYSTEMD
 
+	std::size_t GetHandlerCount() const noexcept {
+		return config->GetHandlerCount();
+	}
+
+	void SetWorkerCount(unsigned n) noexcept {
+		n_workers = n;
+	}
+
+	unsigned GetWorkerCount() const noexcept {
+		return n_workers;
+	}
+
+	void SetReloadConfig(bool value) noexcept {
+		reload_config = value;
+	}
+
+	std::forward_list<Worker> &GetWorkers() noexcept {
+		return workers;
+	}
+
+	/**
+	 * Replace the configuration of the main thread.  Existing
+	 * connections keep using the old one.
+	 */
+	void SetConfig(LuaConfigPtr &&new_config) noexcept {
+		config = std::move(new_config);
+	}
+
+	/**
+	 * Create a new (not yet started) #Worker.  Its Lua state
+	 * needs to be set up and its configuration loaded before
+	 * StartWorkers() is called.
+	 */
+	Worker &AddWorker();
+
+	void StartWorkers();
+
+	/**
+	 * Find the #Worker with the fewest connections.
+	 *
+	 * @return nullptr if there are no workers (i.e. all
+	 * connections are handled by the main thread)
+	 */
+	Worker *FindLeastLoadedWorker() noexcept;
+
 	void Check();
 
 private:
+	void AddListener(UniqueSocketDescriptor &&fd,
+			 std::size_t handler_index);
+
 	void OnShutdown() noexcept;
 	void OnReload(int) noexcept;
 };
@@ -8,14 +8,6 @@
 #include "lua/Util.hxx"
 
 struct LAction : Action {
-	LAction(lua_State *L, Lua::StackIndex request_idx) {
-		// fenv.request = request
-		lua_newtable(L);
-		Lua::SetTable(L, Lua::RelativeStackIndex{-1},
-			      "request", request_idx);
-		lua_setfenv(L, -2);
-	}
-
 	LAction(lua_State *L, Lua::StackIndex request_idx, Action &&_action)
 		:Action(std::move(_action)) {
 		// fenv.request = request
@@ -42,12 +34,6 @@ RegisterLuaAction(lua_State *L)
 	lua_pop(L, 1);
 }
 
-Action *
-NewLuaAction(lua_State *L, int request_idx)
-{
-	return LuaAction::New(L, L, Lua::StackIndex(request_idx));
-}
-
 Action *
 NewLuaAction(lua_State *L, int request_idx, Action &&action)
 {
@@ -14,9 +14,6 @@ RegisterLuaAction(lua_State *L);
  * @param request_idx the index of the associated #Request instance on
  * the Lua stack
  */
-Action *
-NewLuaAction(lua_State *L, int request_idx);
-
 Action *
 NewLuaAction(lua_State *L, int request_idx, Action &&action);
 
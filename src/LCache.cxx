@@ -0,0 +1,338 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LCache.hxx"
+#include "LruCache.hxx"
+#include "lua/Class.hxx"
+#include "lua/Error.hxx"
+#include "lua/StringView.hxx"
+#include "lua/Util.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <chrono>
+#include <concepts> // for std::invocable
+#include <cstring> // for std::memcpy()
+#include <functional> // for std::less
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * A #LruCache which can be used by several threads.
+ */
+class SharedCache {
+	std::mutex mutex;
+
+	LruCache cache;
+
+	const LruCache::Clock::duration default_ttl;
+
+public:
+	SharedCache(std::size_t max_size,
+		    LruCache::Clock::duration _default_ttl) noexcept
+		:cache(max_size), default_ttl(_default_ttl) {}
+
+	LruCache::Clock::duration GetDefaultTtl() const noexcept {
+		return default_ttl;
+	}
+
+	/**
+	 * Invoke the given function with the locked #LruCache.
+	 */
+	decltype(auto) With(std::invocable<LruCache &> auto f) {
+		const std::scoped_lock lock{mutex};
+		return f(cache);
+	}
+};
+
+using SharedCachePtr = std::shared_ptr<SharedCache>;
+
+/**
+ * All caches created by passage_cache(), by name.  Expired entries
+ * are purged when a new cache is created.
+ */
+static struct {
+	std::mutex mutex;
+	std::map<std::string, std::weak_ptr<SharedCache>, std::less<>> caches;
+} registry;
+
+static constexpr char lua_cache_class[] = "passage.cache";
+typedef Lua::Class<SharedCachePtr, lua_cache_class> LuaCache;
+
+/**
+ * The first byte of a serialized value which identifies its Lua
+ * type.
+ */
+enum class ValueType : char {
+	STRING = 's',
+	NUMBER = 'n',
+	TRUE = 't',
+	FALSE = 'f',
+};
+
+static std::string
+SerializeValue(lua_State *L, int idx)
+{
+	std::string result;
+
+	switch (lua_type(L, idx)) {
+	case LUA_TSTRING:
+		{
+			const auto s = Lua::ToStringView(L, idx);
+			result.reserve(1 + s.size());
+			result.push_back(static_cast<char>(ValueType::STRING));
+			result.append(s);
+		}
+		break;
+
+	case LUA_TNUMBER:
+		{
+			const lua_Number n = lua_tonumber(L, idx);
+			result.push_back(static_cast<char>(ValueType::NUMBER));
+			result.append(reinterpret_cast<const char *>(&n), sizeof(n));
+		}
+		break;
+
+	case LUA_TBOOLEAN:
+		result.push_back(static_cast<char>(lua_toboolean(L, idx)
+						   ? ValueType::TRUE
+						   : ValueType::FALSE));
+		break;
+
+	default:
+		luaL_argerror(L, idx, "string, number or boolean expected");
+	}
+
+	return result;
+}
+
+static void
+PushValue(lua_State *L, std::string_view s)
+{
+	const auto type = static_cast<ValueType>(s.front());
+	s.remove_prefix(1);
+
+	switch (type) {
+	case ValueType::STRING:
+		Lua::Push(L, s);
+		return;
+
+	case ValueType::NUMBER:
+		{
+			lua_Number n;
+			std::memcpy(&n, s.data(), sizeof(n));
+			lua_pushnumber(L, n);
+		}
+		return;
+
+	case ValueType::TRUE:
+		lua_pushboolean(L, true);
+		return;
+
+	case ValueType::FALSE:
+		lua_pushboolean(L, false);
+		return;
+	}
+
+	lua_pushnil(L);
+}
+
+static LruCache::Clock::duration
+CheckTtl(lua_State *L, int idx)
+{
+	const lua_Number ttl = luaL_checknumber(L, idx);
+	if (ttl <= 0)
+		luaL_argerror(L, idx, "Bad TTL");
+
+	return std::chrono::duration_cast<LruCache::Clock::duration>(std::chrono::duration<lua_Number>(ttl));
+}
+
+static int
+l_cache_get(lua_State *L)
+try {
+	if (lua_gettop(L) != 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	auto &cache = **LuaCache::Check(L, 1);
+	const auto key = Lua::CheckStringView(L, 2);
+	const auto now = LruCache::Clock::now();
+
+	/* copy the value while the cache is locked; serialized
+	   values are never empty, so an empty string means "not
+	   found" */
+	const auto value = cache.With([key, now](LruCache &c){
+		const auto *v = c.Get(key, now);
+		return v != nullptr ? *v : std::string{};
+	});
+
+	if (value.empty())
+		lua_pushnil(L);
+	else
+		PushValue(L, value);
+	return 1;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+static int
+l_cache_set(lua_State *L)
+try {
+	const int top = lua_gettop(L);
+	if (top < 3 || top > 4)
+		return luaL_error(L, "Invalid parameter count");
+
+	auto &cache = **LuaCache::Check(L, 1);
+	const auto key = Lua::CheckStringView(L, 2);
+
+	if (lua_isnil(L, 3)) {
+		cache.With([key](LruCache &c){ c.Remove(key); });
+		return 0;
+	}
+
+	const auto value = SerializeValue(L, 3);
+	const auto ttl = top >= 4 && !lua_isnil(L, 4)
+		? CheckTtl(L, 4)
+		: cache.GetDefaultTtl();
+	const auto expires = LruCache::Clock::now() + ttl;
+
+	cache.With([key, &value, expires](LruCache &c){
+		c.Set(key, value, expires);
+	});
+
+	return 0;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+static int
+l_cache_delete(lua_State *L)
+try {
+	if (lua_gettop(L) != 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	auto &cache = **LuaCache::Check(L, 1);
+	const auto key = Lua::CheckStringView(L, 2);
+
+	lua_pushboolean(L, cache.With([key](LruCache &c){
+		return c.Remove(key);
+	}));
+	return 1;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+static void
+SetCounter(lua_State *L, const char *name, uint_least64_t value)
+{
+	Lua::SetField(L, Lua::RelativeStackIndex{-1}, name,
+		      static_cast<lua_Integer>(value));
+}
+
+static int
+l_cache_stats(lua_State *L)
+{
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	auto &cache = **LuaCache::Check(L, 1);
+
+	LruCache::Stats stats;
+	std::size_t items, size;
+
+	cache.With([&](const LruCache &c){
+		stats = c.GetStats();
+		items = c.GetItemCount();
+		size = c.GetSize();
+	});
+
+	lua_newtable(L);
+	SetCounter(L, "hits", stats.hits);
+	SetCounter(L, "misses", stats.misses);
+	SetCounter(L, "evictions", stats.evictions);
+	SetCounter(L, "expirations", stats.expirations);
+	SetCounter(L, "items", items);
+	SetCounter(L, "size", size);
+	return 1;
+}
+
+static SharedCachePtr
+MakeSharedCache(std::string_view name, std::size_t max_size,
+		LruCache::Clock::duration default_ttl)
+{
+	const std::scoped_lock lock{registry.mutex};
+
+	if (const auto i = registry.caches.find(name);
+	    i != registry.caches.end()) {
+		if (auto existing = i->second.lock())
+			return existing;
+	}
+
+	std::erase_if(registry.caches, [](const auto &i){
+		return i.second.expired();
+	});
+
+	auto cache = std::make_shared<SharedCache>(max_size, default_ttl);
+	registry.caches.insert_or_assign(std::string{name}, cache);
+	return cache;
+}
+
+static int
+l_passage_cache(lua_State *L)
+try {
+	const int top = lua_gettop(L);
+	if (top < 1 || top > 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	const auto name = Lua::CheckStringView(L, 1);
+
+	lua_Integer max_size = 16 * 1024 * 1024;
+	LruCache::Clock::duration default_ttl = std::chrono::minutes{1};
+
+	if (top >= 2) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		lua_getfield(L, 2, "size");
+		if (!lua_isnil(L, -1)) {
+			if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) <= 0)
+				return luaL_error(L, "Bad 'size' value");
+			max_size = lua_tointeger(L, -1);
+		}
+		lua_pop(L, 1);
+
+		lua_getfield(L, 2, "ttl");
+		if (!lua_isnil(L, -1))
+			default_ttl = CheckTtl(L, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+
+	LuaCache::New(L, MakeSharedCache(name, static_cast<std::size_t>(max_size),
+					 default_ttl));
+	return 1;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+void
+RegisterLuaCache(lua_State *L)
+{
+	using namespace Lua;
+
+	LuaCache::Register(L);
+
+	lua_newtable(L);
+	SetField(L, RelativeStackIndex{-1}, "get", l_cache_get);
+	SetField(L, RelativeStackIndex{-1}, "set", l_cache_set);
+	SetField(L, RelativeStackIndex{-1}, "delete", l_cache_delete);
+	SetField(L, RelativeStackIndex{-1}, "stats", l_cache_stats);
+	lua_setfield(L, -2, "__index");
+
+	lua_pop(L, 1);
+
+	SetGlobal(L, "passage_cache", l_passage_cache);
+}
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+struct lua_State;
+
+/**
+ * Register the global function passage_cache() which returns a
+ * named #LruCache.  Caches with the same name are shared by all Lua
+ * states of this process (i.e. all workers and reloaded
+ * configurations).
+ */
+void
+RegisterLuaCache(lua_State *L);
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LExecTemplate.hxx"
+#include "ExecTemplate.hxx"
+#include "Action.hxx"
+#include "LAction.hxx"
+#include "LRequest.hxx"
+#include "lua/Class.hxx"
+#include "lua/Error.hxx"
+#include "lua/StringView.hxx"
+#include "lua/Util.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <memory>
+
+static constexpr char lua_exec_template_class[] = "passage.exec_template";
+typedef Lua::Class<ExecTemplatePtr, lua_exec_template_class> LuaExecTemplate;
+
+/**
+ * tmpl:exec_pipe(request, [ARG, ...]): create an exec_pipe action
+ * from the template, with the given arguments appended.
+ */
+static int
+l_exec_template_exec_pipe(lua_State *L)
+try {
+	const int top = lua_gettop(L);
+	if (top < 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	const auto &exec_template = *LuaExecTemplate::Check(L, 1);
+	CheckLuaRequest(L, 2);
+
+	const std::size_t n_args = top - 2;
+	if (exec_template->GetArgs().size() + n_args > ExecPipeAction::MAX_EXEC)
+		return luaL_error(L, "Too many arguments");
+
+	ExecTemplateAction action{.exec_template = exec_template};
+	action.args.reserve(n_args);
+
+	for (int i = 3; i <= top; ++i) {
+		if (!lua_isstring(L, i))
+			luaL_argerror(L, i, "string expected");
+
+		action.args.emplace_back(Lua::ToStringView(L, i));
+	}
+
+	NewLuaAction(L, 2, std::move(action));
+	return 1;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+static int
+l_passage_exec_template(lua_State *L)
+try {
+	const int top = lua_gettop(L);
+	if (top < 1 || top > 2)
+		return luaL_error(L, "Invalid parameter count");
+
+	ExecPipeAction action;
+	ParseLuaExecPipe(action, L, 1, top >= 2 ? 2 : 0);
+
+	LuaExecTemplate::New(L, std::make_shared<const ExecTemplate>(action));
+	return 1;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+void
+RegisterLuaExecTemplate(lua_State *L)
+{
+	using namespace Lua;
+
+	LuaExecTemplate::Register(L);
+
+	lua_newtable(L);
+	SetField(L, RelativeStackIndex{-1}, "exec_pipe", l_exec_template_exec_pipe);
+	lua_setfield(L, -2, "__index");
+
+	lua_pop(L, 1);
+
+	SetGlobal(L, "passage_exec_template", l_passage_exec_template);
+}
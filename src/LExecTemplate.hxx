@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+struct lua_State;
+
+/**
+ * Register the global function passage_exec_template() which
+ * returns a prebuilt exec_pipe() command line (#ExecTemplate).
+ */
+void
+RegisterLuaExecTemplate(lua_State *L);
@@ -3,9 +3,12 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "LRequest.hxx"
-#include "Entity.hxx"
+#include "EntityView.hxx"
+#include "FfiRequest.hxx"
 #include "LAction.hxx"
 #include "Action.hxx"
+#include "PeerAuth.hxx"
+#include "ResponseCache.hxx"
 #include "Verify.hxx"
 #include "lua/AutoCloseList.hxx"
 #include "lua/CheckArg.hxx"
@@ -17,7 +20,6 @@
 #include "lua/io/CgroupInfo.hxx"
 #include "lua/net/SocketAddress.hxx"
 #include "net/control/Protocol.hxx"
-#include "net/linux/PeerAuth.hxx"
 #include "io/Beneath.hxx"
 #include "io/FileAt.hxx"
 #include "util/StringAPI.hxx"
@@ -34,21 +36,39 @@
 
 #include <fmt/core.h>
 
+#include <algorithm> // for std::copy(), std::ranges::lower_bound()
+#include <chrono>
+#include <cstdint>
+#include <iterator> // for std::end()
+#include <new> // for placement new
+
 #include <assert.h>
 #include <sys/socket.h>
 #include <string.h>
 
 using std::string_view_literals::operator""sv;
 
-class RichRequest : public Entity {
+/**
+ * The request object passed to the Lua handler.  It is allocated
+ * together with a copy of the request payload in one Lua userdata
+ * (see NewLuaRequest()), and the #EntityView points into that copy;
+ * attributes are converted to Lua values only when the handler
+ * accesses them.
+ */
+class RichRequest : public EntityView {
 	Lua::AutoCloseList *auto_close;
 
-	const SocketPeerAuth &peer_auth;
+	const PeerAuth &peer_auth;
+
+	/**
+	 * Set by request:cache_response().
+	 */
+	ResponseCacheHint cache_hint;
 
 public:
 	RichRequest(lua_State *L, Lua::AutoCloseList &_auto_close,
-		    Entity &&src, const SocketPeerAuth &_peer_auth)
-		:Entity(std::move(src)),
+		    const EntityView &src, const PeerAuth &_peer_auth)
+		:EntityView(src),
 		 auto_close(&_auto_close),
 		 peer_auth(_peer_auth)
 	{
@@ -67,14 +87,28 @@ public:
 		return 0;
 	}
 
+	const ResponseCacheHint &GetCacheHint() const noexcept {
+		return cache_hint;
+	}
+
+	void SetCacheHint(const ResponseCacheHint &_cache_hint) noexcept {
+		cache_hint = _cache_hint;
+	}
+
 	int Index(lua_State *L);
+
+private:
+	/**
+	 * Push a new userdata containing a #PassageFfiRequest.
+	 */
+	void PushFfiView(lua_State *L) const;
 };
 
 static constexpr char lua_request_class[] = "passage.request";
 typedef Lua::Class<RichRequest, lua_request_class> LuaRequest;
 
 static void
-LuaTableToHeaderMap(std::map<std::string, std::string, std::less<>> &dest,
+LuaTableToHeaderMap(HeaderMap &dest,
 		    lua_State *L, int table_idx)
 {
 	Lua::ForEach(L, table_idx, [L, &dest](auto key_idx, auto value_idx){
@@ -103,10 +137,9 @@ NewErrorAction(lua_State *L)
 	if (top < 1 || top > 3)
 		return luaL_error(L, "Invalid parameters");
 
-	auto &action = *NewLuaAction(L, 1);
-	action.type = Action::Type::ERROR;
+	ErrorAction action;
 	if (top >= 2 && !lua_isnil(L, 2)) {
-		action.param = Lua::CheckStringView(L, 2);
+		action.message = Lua::CheckStringView(L, 2);
 	}
 
 	if (top >= 3) {
@@ -114,6 +147,7 @@ NewErrorAction(lua_State *L)
 		LuaTableToHeaderMap(action.response_headers, L, 3);
 	}
 
+	NewLuaAction(L, 1, std::move(action));
 	return 1;
 }
 
@@ -137,11 +171,14 @@ NewFadeChildrenAction(lua_State *L)
 		child_tag = luaL_checkstring(L, 3);
 	}
 
-	auto &action = *NewLuaAction(L, 1);
-	action.type = Action::Type::FADE_CHILDREN;
-	action.address = std::move(address);
+	FadeChildrenAction action{
+		.address = std::move(address),
+	};
+
 	if (child_tag != nullptr)
-		action.param = child_tag;
+		action.tag = child_tag;
+
+	NewLuaAction(L, 1, std::move(action));
 	return 1;
 }
 
@@ -162,13 +199,30 @@ NewFlushHttpCacheAction(lua_State *L)
 
 	const char *child_tag = luaL_checkstring(L, 3);
 
-	auto &action = *NewLuaAction(L, 1);
-	action.type = Action::Type::FLUSH_HTTP_CACHE;
-	action.address = std::move(address);
-	action.param = child_tag;
+	NewLuaAction(L, 1, FlushHttpCacheAction{
+			.address = std::move(address),
+			.tag = child_tag,
+		});
 	return 1;
 }
 
+static StdinOption
+ParseStdinOption(lua_State *L, int idx)
+{
+	if (lua_type(L, idx) != LUA_TSTRING)
+		luaL_error(L, "Bad 'stdin' option");
+
+	const auto value = Lua::ToStringView(L, idx);
+	if (value == "body"sv)
+		return StdinOption::BODY;
+	else if (value == "fd"sv)
+		return StdinOption::FD;
+	else {
+		luaL_error(L, "Bad 'stdin' value");
+		std::unreachable();
+	}
+}
+
 static StderrOption
 ParseStderrOption(lua_State *L, std::string_view value)
 {
@@ -198,10 +252,10 @@ ParseStderrOption(lua_State *L, int idx)
  * parameter to exec() / exec_raw().
  */
 static void
-CollectExecEnv(Action &action, lua_State *L, Lua::AnyStackIndex auto idx)
+CollectExecEnv(ExecPipeAction &action, lua_State *L, Lua::AnyStackIndex auto idx)
 {
 	Lua::ForEach(L, idx, [L, &action](auto name_idx, auto value_idx){
-		if (action.env.full())
+		if (action.env.size() >= ExecPipeAction::MAX_ENV)
 			luaL_error(L, "Too many environment variables");
 
 		if (lua_type(L, Lua::GetStackIndex(name_idx)) != LUA_TSTRING)
@@ -219,14 +273,16 @@ CollectExecEnv(Action &action, lua_State *L, Lua::AnyStackIndex auto idx)
  * Collect parameters from the "options" table passed to exec_pipe().
  */
 static void
-CollectExecOptions(Action &action, lua_State *L, Lua::AnyStackIndex auto idx)
+CollectExecOptions(ExecPipeAction &action, lua_State *L, Lua::AnyStackIndex auto idx)
 {
 	Lua::ForEach(L, idx, [L, &action](auto key_idx, auto value_idx){
 		if (lua_type(L, Lua::GetStackIndex(key_idx)) != LUA_TSTRING)
 			luaL_error(L, "Option key is not a string");
 
 		const auto key = Lua::ToStringView(L, Lua::GetStackIndex(key_idx));
-		if (key == "stderr"sv) {
+		if (key == "stdin"sv) {
+			action.stdin = ParseStdinOption(L, Lua::GetStackIndex(value_idx));
+		} else if (key == "stderr"sv) {
 			action.stderr = ParseStderrOption(L, Lua::GetStackIndex(value_idx));
 		} else if (key == "env"sv) {
 			CollectExecEnv(action, L, value_idx);
@@ -244,25 +300,18 @@ CollectExecOptions(Action &action, lua_State *L, Lua::AnyStackIndex auto idx)
 	});
 }
 
-static int
-NewExecPipeAction(lua_State *L)
+void
+ParseLuaExecPipe(ExecPipeAction &action, lua_State *L,
+		 int argv_idx, int options_idx)
 {
-	const auto top = lua_gettop(L);
-	if (top < 2 || top > 3)
-		return luaL_error(L, "Invalid parameters");
+	if (!lua_istable(L, argv_idx))
+		luaL_argerror(L, argv_idx, "array expected");
 
-	if (!lua_istable(L, 2))
-		luaL_argerror(L, 2, "array expected");
-
-	Action action{
-		.type = Action::Type::EXEC_PIPE,
-	};
-
-	for (lua_pushnil(L); lua_next(L, 2); lua_pop(L, 1)) {
+	for (lua_pushnil(L); lua_next(L, argv_idx); lua_pop(L, 1)) {
 		if (!lua_isstring(L, -1))
 			luaL_error(L, "string expected");
 
-		if (action.exec.full())
+		if (action.exec.size() >= ExecPipeAction::MAX_EXEC)
 			luaL_error(L, "Too many arguments");
 
 		action.exec.emplace_back(Lua::CheckStringView(L, -1));
@@ -271,13 +320,64 @@ NewExecPipeAction(lua_State *L)
 	if (action.exec.empty())
 		luaL_error(L, "Not enough arguments");
 
-	if (top >= 3)
-		CollectExecOptions(action, L, 3);
+	if (options_idx != 0)
+		CollectExecOptions(action, L, options_idx);
+}
+
+static int
+NewExecPipeAction(lua_State *L)
+{
+	const auto top = lua_gettop(L);
+	if (top < 2 || top > 3)
+		return luaL_error(L, "Invalid parameters");
+
+	ExecPipeAction action;
+	ParseLuaExecPipe(action, L, 2, top >= 3 ? 3 : 0);
 
 	NewLuaAction(L, 1, std::move(action));
 	return 1;
 }
 
+static ResponseCacheScope
+ParseResponseCacheScope(lua_State *L, int idx)
+{
+	const auto value = Lua::CheckStringView(L, idx);
+	if (value == "uid"sv)
+		return ResponseCacheScope::UID;
+	else if (value == "cgroup"sv)
+		return ResponseCacheScope::CGROUP;
+	else {
+		luaL_argerror(L, idx, "Bad scope");
+		std::unreachable();
+	}
+}
+
+static int
+CacheResponse(lua_State *L)
+{
+	const auto top = lua_gettop(L);
+	if (top < 2 || top > 3)
+		return luaL_error(L, "Invalid parameters");
+
+	auto &request = *LuaRequest::Check(L, 1);
+	if (request.IsStale())
+		return luaL_error(L, "Stale object");
+
+	const lua_Number ttl = luaL_checknumber(L, 2);
+	if (ttl <= 0)
+		luaL_argerror(L, 2, "Bad TTL");
+
+	ResponseCacheHint hint{
+		.ttl = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<lua_Number>(ttl)),
+	};
+
+	if (top >= 3 && !lua_isnil(L, 3))
+		hint.scope = ParseResponseCacheScope(L, 3);
+
+	request.SetCacheHint(hint);
+	return 0;
+}
+
 #ifdef HAVE_CURL
 
 static std::string
@@ -314,7 +414,7 @@ ParseHttpQuery(lua_State *L, Lua::RelativeStackIndex query_idx)
 }
 
 static void
-ParseHttpHeaders(std::map<std::string, std::string, std::less<>> &headers,
+ParseHttpHeaders(HeaderMap &headers,
 		 lua_State *L, Lua::RelativeStackIndex query_idx)
 {
 	luaL_checktype(L, Lua::GetStackIndex(query_idx), LUA_TTABLE);
@@ -350,14 +450,14 @@ ParseHttpMethod(const char *s)
 }
 
 static void
-ParseHttpRequest(Action &action, lua_State *L, int request_idx)
+ParseHttpRequest(HttpRequestAction &action, lua_State *L, int request_idx)
 {
 	if (lua_isstring(L, request_idx)) {
 		const auto value = Lua::ToStringView(L, request_idx);
 		if (value.empty())
 			throw std::invalid_argument{"Bad URL"};
 
-		action.param = value;
+		action.url = value;
 		return;
 	}
 
@@ -411,7 +511,7 @@ ParseHttpRequest(Action &action, lua_State *L, int request_idx)
 		url.append(query);
 	}
 
-	action.param = std::move(url);
+	action.url = std::move(url);
 }
 
 static int
@@ -421,13 +521,12 @@ try {
 	if (top != 2)
 		return luaL_error(L, "Invalid parameters");
 
-	Action action{
+	HttpRequestAction action{
 		.max_size = 64 * 1024ZU,
 		.http_method = HttpMethod::UNDEFINED,
-		.type = Action::Type::HTTP_REQUEST,
 	};
 
-	ParseHttpRequest(action, L, 2),
+	ParseHttpRequest(action, L, 2);
 
 	NewLuaAction(L, 1, std::move(action));
 	return 1;
@@ -437,18 +536,124 @@ try {
 
 #endif // HAVE_CURL
 
-static constexpr struct luaL_Reg request_methods [] = {
-	{"error", NewErrorAction},
-	{"fade_children", NewFadeChildrenAction},
-	{"flush_http_cache", NewFlushHttpCacheAction},
-	{"exec_pipe", NewExecPipeAction},
+enum class RequestAttribute : uint_least8_t {
+	METHOD,
+	COMMAND,
+	ARGS,
+	HEADERS,
+	BODY,
+	PID,
+	UID,
+	GID,
+	CGROUP,
+	FFI,
+};
+
+struct RequestAttributeEntry {
+	std::string_view name;
+	RequestAttribute attribute;
+
+	/**
+	 * The C function for #RequestAttribute::METHOD.
+	 */
+	lua_CFunction method = nullptr;
+};
+
+/**
+ * All methods and attributes of the request object, sorted by name
+ * for binary search.
+ */
+static constexpr RequestAttributeEntry request_attributes[] = {
+	{"args"sv, RequestAttribute::ARGS},
+	{"body"sv, RequestAttribute::BODY},
+	{"cache_response"sv, RequestAttribute::METHOD, CacheResponse},
+	{"cgroup"sv, RequestAttribute::CGROUP},
+	{"command"sv, RequestAttribute::COMMAND},
+	{"error"sv, RequestAttribute::METHOD, NewErrorAction},
+	{"exec_pipe"sv, RequestAttribute::METHOD, NewExecPipeAction},
+	{"fade_children"sv, RequestAttribute::METHOD, NewFadeChildrenAction},
+	{"ffi"sv, RequestAttribute::FFI},
+	{"flush_http_cache"sv, RequestAttribute::METHOD, NewFlushHttpCacheAction},
+	{"gid"sv, RequestAttribute::GID},
+	{"headers"sv, RequestAttribute::HEADERS},
 #ifdef HAVE_CURL
-	{"http_request", NewHttpRequestAction},
-	{"http_get", NewHttpRequestAction}, // pre 0.25 legacy
+	{"http_get"sv, RequestAttribute::METHOD, NewHttpRequestAction}, // pre 0.25 legacy
+	{"http_request"sv, RequestAttribute::METHOD, NewHttpRequestAction},
 #endif
-	{nullptr, nullptr}
+	{"pid"sv, RequestAttribute::PID},
+	{"uid"sv, RequestAttribute::UID},
 };
 
+static_assert(std::ranges::is_sorted(request_attributes, {},
+				     &RequestAttributeEntry::name));
+
+static constexpr PassageFfiString
+ToFfiString(std::string_view s) noexcept
+{
+	return {s.data(), s.size()};
+}
+
+inline void
+RichRequest::PushFfiView(lua_State *L) const
+{
+	/* count everything first so one userdata is enough */
+	std::size_t n_args = 0, args_size = 0;
+	ForEachArgument([&n_args, &args_size](std::string_view a){
+		++n_args;
+		args_size += a.size();
+	});
+
+	std::size_t n_headers = 0;
+	ForEachHeader([&n_headers](std::string_view, std::string_view){
+		++n_headers;
+	});
+
+	/* decoded arguments may live in a temporary buffer, so they
+	   are copied into the userdata; everything else points into
+	   the payload copy owned by this object, which the fenv
+	   cache keeps alive */
+	auto *view = static_cast<PassageFfiRequest *>(lua_newuserdata(L, sizeof(PassageFfiRequest) +
+								      n_args * sizeof(PassageFfiString) +
+								      n_headers * sizeof(PassageFfiHeader) +
+								      args_size));
+	auto *args_array = reinterpret_cast<PassageFfiString *>(view + 1);
+	auto *headers_array = reinterpret_cast<PassageFfiHeader *>(args_array + n_args);
+	char *args_buffer = reinterpret_cast<char *>(headers_array + n_headers);
+
+	*view = {
+		.command = ToFfiString(command),
+		.body = ToFfiString(body),
+		.args = args_array,
+		.headers = headers_array,
+		.n_args = static_cast<uint32_t>(n_args),
+		.n_headers = static_cast<uint32_t>(n_headers),
+		.pid = peer_auth.HaveCred() ? peer_auth.GetPid() : -1,
+		.uid = peer_auth.HaveCred() ? static_cast<int64_t>(peer_auth.GetUid()) : -1,
+		.gid = peer_auth.HaveCred() ? static_cast<int64_t>(peer_auth.GetGid()) : -1,
+	};
+
+	ForEachArgument([&args_array, &args_buffer](std::string_view a){
+		*args_array++ = {args_buffer, a.size()};
+		args_buffer = std::copy(a.begin(), a.end(), args_buffer);
+	});
+
+	ForEachHeader([&headers_array](std::string_view name, std::string_view value){
+		*headers_array++ = {ToFfiString(name), ToFfiString(value)};
+	});
+}
+
+[[gnu::pure]]
+static const RequestAttributeEntry *
+FindRequestAttribute(std::string_view name) noexcept
+{
+	const auto i = std::ranges::lower_bound(request_attributes, name, {},
+						&RequestAttributeEntry::name);
+	if (i == std::end(request_attributes) || i->name != name)
+		return nullptr;
+
+	return i;
+}
+
 inline int
 RichRequest::Index(lua_State *L)
 try {
@@ -458,80 +663,108 @@ try {
 		return luaL_error(L, "Invalid parameters");
 
 	constexpr Lua::StackIndex name_idx{2};
-	const char *const name = luaL_checkstring(L, 2);
+	std::size_t name_length;
+	const char *const name_data = luaL_checklstring(L, 2, &name_length);
+	const std::string_view name{name_data, name_length};
 
 	if (IsStale())
 		return luaL_error(L, "Stale object");
 
-	for (const auto *i = request_methods; i->name != nullptr; ++i) {
-		if (StringIsEqual(i->name, name)) {
-			Lua::Push(L, i->func);
-			return 1;
-		}
-	}
-
-	// look it up in the fenv (our cache)
+	/* look it up in the fenv (our cache); since Lua strings are
+	   interned, this is just one pointer hash lookup */
 	if (Lua::GetFenvCache(L, 1, name_idx))
 		return 1;
 
-	if (StringIsEqual(name, "command")) {
+	const auto *attribute = FindRequestAttribute(name);
+	if (attribute == nullptr)
+		return luaL_error(L, "Unknown attribute");
+
+	switch (attribute->attribute) {
+	case RequestAttribute::METHOD:
+		Lua::Push(L, attribute->method);
+		break;
+
+	case RequestAttribute::COMMAND:
 		Lua::Push(L, command);
-		return 1;
-	} else if (StringIsEqual(name, "args")) {
+		break;
+
+	case RequestAttribute::ARGS:
 		lua_newtable(L);
 
-		lua_Integer i = 1;
-		for (const auto &a : args)
-			SetTable(L, RelativeStackIndex{-1}, i++, a);
+		{
+			lua_Integer i = 1;
+			ForEachArgument([L, &i](std::string_view a){
+				SetTable(L, RelativeStackIndex{-1}, i++, a);
+			});
+		}
 
-		return 1;
-	} else if (StringIsEqual(name, "headers")) {
+		break;
+
+	case RequestAttribute::HEADERS:
 		lua_newtable(L);
 
-		for (const auto &i : headers)
-			SetTable(L, RelativeStackIndex{-1}, i.first, i.second);
+		ForEachHeader([L](std::string_view header_name, std::string_view value){
+			/* the first one of duplicate headers wins */
+			Lua::Push(L, header_name);
+			lua_rawget(L, -2);
+			const bool exists = !lua_isnil(L, -1);
+			lua_pop(L, 1);
 
-		// copy a reference to the fenv (our cache)
-		Lua::SetFenvCache(L, 1, name_idx, Lua::RelativeStackIndex{-1});
+			if (!exists)
+				SetTable(L, RelativeStackIndex{-1}, header_name, value);
+		});
 
-		return 1;
-	} else if (StringIsEqual(name, "body")) {
+		break;
+
+	case RequestAttribute::BODY:
 		if (body.empty())
 			return 0;
 
 		Lua::Push(L, body);
-		return 1;
-	} else if (StringIsEqual(name, "pid")) {
+		break;
+
+	case RequestAttribute::PID:
 		if (!peer_auth.HaveCred())
 			return 0;
 
 		Lua::Push(L, static_cast<lua_Integer>(peer_auth.GetPid()));
-		return 1;
-	} else if (StringIsEqual(name, "uid")) {
+		break;
+
+	case RequestAttribute::UID:
 		if (!peer_auth.HaveCred())
 			return 0;
 
 		Lua::Push(L, static_cast<lua_Integer>(peer_auth.GetUid()));
-		return 1;
-	} else if (StringIsEqual(name, "gid")) {
+		break;
+
+	case RequestAttribute::GID:
 		if (!peer_auth.HaveCred())
 			return 0;
 
 		Lua::Push(L, static_cast<lua_Integer>(peer_auth.GetGid()));
-		return 1;
-	} else if (StringIsEqual(name, "cgroup")) {
-		const auto path = peer_auth.GetCgroupPath();
-		if (path.empty())
-			return 0;
+		break;
 
-		Lua::NewCgroupInfo(L, *auto_close, path);
+	case RequestAttribute::CGROUP:
+		{
+			const auto path = peer_auth.GetCgroupPath();
+			if (path.empty())
+				return 0;
 
-		// copy a reference to the fenv (our cache)
-		Lua::SetFenvCache(L, 1, name_idx, Lua::RelativeStackIndex{-1});
+			Lua::NewCgroupInfo(L, *auto_close, path);
+		}
 
-		return 1;
-	} else
-		return luaL_error(L, "Unknown attribute");
+		break;
+
+	case RequestAttribute::FFI:
+		PushFfiView(L);
+		break;
+	}
+
+	/* all attributes are immutable, so copy a reference to the
+	   fenv (our cache) and skip all of the above next time */
+	Lua::SetFenvCache(L, 1, name_idx, Lua::RelativeStackIndex{-1});
+
+	return 1;
 } catch (...) {
 	Lua::RaiseCurrent(L);
 }
@@ -547,16 +780,41 @@ RegisterLuaRequest(lua_State *L)
 	lua_pop(L, 1);
 }
 
-Entity *
+EntityView *
 NewLuaRequest(lua_State *L, Lua::AutoCloseList &auto_close,
-	      Entity &&src, const SocketPeerAuth &peer_auth)
+	      std::string_view payload, const EntityView &src,
+	      const PeerAuth &peer_auth)
 {
-	return LuaRequest::New(L, L, auto_close,
-			       std::move(src), peer_auth);
+	/* allocate the RichRequest and a copy of the payload in one
+	   userdata, so the request costs just one allocation */
+	void *p = lua_newuserdata(L, sizeof(RichRequest) + payload.size());
+	char *const copy = reinterpret_cast<char *>(static_cast<RichRequest *>(p) + 1);
+	std::copy(payload.begin(), payload.end(), copy);
+
+	auto *request = ::new(p) RichRequest(L, auto_close,
+					     src.Relocate(payload.data(), copy),
+					     peer_auth);
+
+	luaL_getmetatable(L, lua_request_class);
+	lua_setmetatable(L, -2);
+
+	return request;
 }
 
-Entity &
+EntityView &
 CastLuaRequest(lua_State *L, int idx)
 {
 	return LuaRequest::Cast(L, idx);
 }
+
+EntityView &
+CheckLuaRequest(lua_State *L, int idx)
+{
+	return *LuaRequest::Check(L, idx);
+}
+
+const ResponseCacheHint &
+GetLuaRequestCacheHint(const EntityView &request) noexcept
+{
+	return static_cast<const RichRequest &>(request).GetCacheHint();
+}
@@ -4,17 +4,57 @@
 
 #pragma once
 
+#include <string_view>
+
 struct lua_State;
-struct Entity;
-class SocketPeerAuth;
+struct EntityView;
+struct ExecPipeAction;
+struct ResponseCacheHint;
+class PeerAuth;
 namespace Lua { class AutoCloseList; }
 
 void
 RegisterLuaRequest(lua_State *L);
 
-Entity *
+/**
+ * Create a new request object and push it on the Lua stack.
+ *
+ * @param payload the payload which was parsed into @p src; it will
+ * be copied into the new object
+ * @param src the parsed request (pointing into @p payload)
+ */
+EntityView *
 NewLuaRequest(lua_State *L, Lua::AutoCloseList &auto_close,
-	      Entity &&src, const SocketPeerAuth &peer_auth);
+	      std::string_view payload, const EntityView &src,
+	      const PeerAuth &peer_auth);
 
-Entity &
+EntityView &
 CastLuaRequest(lua_State *L, int idx);
+
+/**
+ * Like CastLuaRequest(), but raise a Lua error if the value at the
+ * given index is not a request object.
+ */
+EntityView &
+CheckLuaRequest(lua_State *L, int idx);
+
+/**
+ * Return the hint set by request:cache_response().
+ *
+ * @param request a pointer returned by NewLuaRequest()
+ */
+[[gnu::pure]]
+const ResponseCacheHint &
+GetLuaRequestCacheHint(const EntityView &request) noexcept;
+
+/**
+ * Parse the parameters of exec_pipe() into an #ExecPipeAction.
+ * Raises a Lua error on failure.
+ *
+ * @param argv_idx the stack index of the argument array
+ * @param options_idx the stack index of the options table or 0 if
+ * there is none
+ */
+void
+ParseLuaExecPipe(ExecPipeAction &action, lua_State *L,
+		 int argv_idx, int options_idx);
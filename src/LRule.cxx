@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LRule.hxx"
+#include "LRequest.hxx"
+#include "Rule.hxx"
+#include "Verify.hxx"
+#include "lua/Error.hxx"
+#include "lua/ForEach.hxx"
+#include "lua/LightUserData.hxx"
+#include "lua/PushCClosure.hxx"
+#include "lua/StringView.hxx"
+#include "lua/Util.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <algorithm> // for std::find()
+#include <iterator> // for std::end()
+#include <optional>
+#include <string>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr std::string_view rule_keys[] = {
+	"command"sv,
+	"uid"sv,
+	"gid"sv,
+	"cgroup"sv,
+	"error"sv,
+	"exec_pipe"sv,
+	"options"sv,
+};
+
+static void
+CheckRuleKeys(lua_State *L, int table_idx)
+{
+	Lua::ForEach(L, table_idx, [L](auto key_idx, auto){
+		if (lua_type(L, Lua::GetStackIndex(key_idx)) != LUA_TSTRING)
+			luaL_error(L, "Rule key is not a string");
+
+		const auto key = Lua::ToStringView(L, Lua::GetStackIndex(key_idx));
+		if (std::find(std::begin(rule_keys), std::end(rule_keys), key) == std::end(rule_keys))
+			luaL_error(L, "Unknown rule key");
+	});
+}
+
+/**
+ * Push the given field of the table at index 1.
+ *
+ * @return true if the field exists (the value is left on the
+ * stack), false if it is nil (nothing is left on the stack)
+ */
+static bool
+GetRuleField(lua_State *L, const char *name)
+{
+	lua_getfield(L, 1, name);
+	if (!lua_isnil(L, -1))
+		return true;
+
+	lua_pop(L, 1);
+	return false;
+}
+
+static std::string_view
+GetRuleString(lua_State *L, const char *name)
+{
+	if (!GetRuleField(L, name))
+		return {};
+
+	if (lua_type(L, -1) != LUA_TSTRING)
+		luaL_error(L, "Bad '%s' value", name);
+
+	/* the string remains valid because the table holds a
+	   reference to it */
+	const auto value = Lua::ToStringView(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+static std::optional<lua_Integer>
+GetRuleId(lua_State *L, const char *name)
+{
+	if (!GetRuleField(L, name))
+		return std::nullopt;
+
+	if (!lua_isnumber(L, -1))
+		luaL_error(L, "Bad '%s' value", name);
+
+	const lua_Integer value = lua_tointeger(L, -1);
+	if (value < 0)
+		luaL_error(L, "Bad '%s' value", name);
+
+	lua_pop(L, 1);
+	return value;
+}
+
+static int
+l_passage_rule(lua_State *L)
+try {
+	auto &rules = *(RuleSet *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 1)
+		return luaL_error(L, "Invalid parameter count");
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	CheckRuleKeys(L, 1);
+
+	Rule rule;
+
+	rule.command = GetRuleString(L, "command");
+	if (!rule.command.empty() &&
+	    !CheckCharsNonEmpty(rule.command, IsValidCommandChar))
+		luaL_error(L, "Bad 'command' value");
+
+	if (const auto uid = GetRuleId(L, "uid"))
+		rule.uid = *uid;
+
+	if (const auto gid = GetRuleId(L, "gid"))
+		rule.gid = *gid;
+
+	rule.cgroup = GetRuleString(L, "cgroup");
+	if (!rule.cgroup.empty() && rule.cgroup.front() != '/')
+		luaL_error(L, "Bad 'cgroup' value");
+
+	if (GetRuleField(L, "error")) {
+		if (lua_type(L, -1) != LUA_TSTRING)
+			luaL_error(L, "Bad 'error' value");
+
+		rule.action = ErrorAction{
+			.message = std::string{Lua::ToStringView(L, -1)},
+		};
+
+		lua_pop(L, 1);
+
+		if (GetRuleField(L, "exec_pipe"))
+			luaL_error(L, "Only one action allowed");
+
+		if (GetRuleField(L, "options"))
+			luaL_error(L, "'options' requires 'exec_pipe'");
+	} else if (GetRuleField(L, "exec_pipe")) {
+		const int argv_idx = lua_gettop(L);
+		const int options_idx = GetRuleField(L, "options")
+			? lua_gettop(L)
+			: 0;
+
+		ExecPipeAction action;
+		ParseLuaExecPipe(action, L, argv_idx, options_idx);
+		rule.action = std::move(action);
+
+		lua_settop(L, 1);
+	} else
+		luaL_error(L, "No action");
+
+	rules.Add(std::move(rule));
+	return 0;
+} catch (...) {
+	Lua::RaiseCurrent(L);
+}
+
+void
+RegisterLuaRule(lua_State *L, RuleSet &rules)
+{
+	Lua::SetGlobal(L, "passage_rule",
+		       Lua::MakeCClosure(l_passage_rule,
+					 Lua::LightUserData(&rules)));
+}
@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+struct lua_State;
+class RuleSet;
+
+/**
+ * Register the global function passage_rule() which adds a static
+ * rule to the given #RuleSet.
+ */
+void
+RegisterLuaRule(lua_State *L, RuleSet &rules);
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LStats.hxx"
+#include "Stats.hxx"
+#include "lua/LightUserData.hxx"
+#include "lua/PushCClosure.hxx"
+#include "lua/Util.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+static void
+SetCounter(lua_State *L, const char *name, uint_least64_t value)
+{
+	Lua::SetField(L, Lua::RelativeStackIndex{-1}, name,
+		      static_cast<lua_Integer>(value));
+}
+
+static int
+l_passage_stats(lua_State *L)
+{
+	const auto &stats = *(const PassageStats *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_gettop(L) != 0)
+		return luaL_error(L, "Invalid parameter count");
+
+	lua_newtable(L);
+	SetCounter(L, "requests", stats.requests);
+	SetCounter(L, "arena_bytes", stats.arena_bytes);
+	SetCounter(L, "arena_peak", stats.arena_peak);
+	SetCounter(L, "rule_hits", stats.rule_hits);
+	SetCounter(L, "response_cache_hits", stats.response_cache_hits);
+	SetCounter(L, "response_cache_misses", stats.response_cache_misses);
+	SetCounter(L, "response_cache_stores", stats.response_cache_stores);
+	SetCounter(L, "peer_cache_hits", stats.peer_cache_hits);
+	SetCounter(L, "peer_cache_misses", stats.peer_cache_misses);
+	SetCounter(L, "budget_exceeded", stats.budget_exceeded);
+	SetCounter(L, "thread_pool_hits", stats.thread_pool_hits);
+	SetCounter(L, "thread_pool_misses", stats.thread_pool_misses);
+	SetCounter(L, "thread_pool_idle", stats.thread_pool_idle);
+	SetCounter(L, "children", stats.children);
+	SetCounter(L, "child_queue_length", stats.child_queue_length);
+	SetCounter(L, "child_queue_waits", stats.child_queue_waits);
+	SetCounter(L, "child_queue_wait_us", stats.child_queue_wait_us);
+	SetCounter(L, "child_queue_rejected", stats.child_queue_rejected);
+	SetCounter(L, "child_queue_timeouts", stats.child_queue_timeouts);
+	return 1;
+}
+
+void
+RegisterLuaStats(lua_State *L, PassageStats &stats)
+{
+	Lua::SetGlobal(L, "passage_stats",
+		       Lua::MakeCClosure(l_passage_stats,
+					 Lua::LightUserData(&stats)));
+}
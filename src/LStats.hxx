@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+struct lua_State;
+struct PassageStats;
+
+/**
+ * Register the global function passage_stats() which returns a table
+ * with the current values of the given #PassageStats.
+ */
+void
+RegisterLuaStats(lua_State *L, PassageStats &stats);
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LThreadPool.hxx"
+#include "Stats.hxx"
+
+LuaThreadPool::~LuaThreadPool() noexcept
+{
+	for (const auto &i : idle)
+		Discard(i);
+}
+
+LuaThreadPool::Thread
+LuaThreadPool::Acquire()
+{
+	if (!idle.empty()) {
+		const auto thread = idle.back();
+		idle.pop_back();
+
+		++stats.thread_pool_hits;
+		stats.thread_pool_idle = idle.size();
+		return thread;
+	}
+
+	++stats.thread_pool_misses;
+
+	Thread thread;
+	thread.L = lua_newthread(main_L);
+
+	/* this pops the thread from the main stack */
+	thread.ref = luaL_ref(main_L, LUA_REGISTRYINDEX);
+
+	return thread;
+}
+
+void
+LuaThreadPool::Release(Thread thread) noexcept
+{
+	/* a coroutine which has yielded cannot be reset (and
+	   something may still want to resume it), and a coroutine
+	   which has failed is dead */
+	if (lua_status(thread.L) != 0 || idle.size() >= MAX_IDLE) {
+		Discard(thread);
+		return;
+	}
+
+	/* drop leftovers such as the handler's return values */
+	lua_settop(thread.L, 0);
+
+	idle.push_back(thread);
+	stats.thread_pool_idle = idle.size();
+}
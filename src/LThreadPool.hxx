@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+struct PassageStats;
+
+/**
+ * A pool of Lua threads (coroutines) for running handlers.  Creating
+ * a new thread for each request generates garbage which the Lua GC
+ * has to collect on the hot path; instead, threads whose coroutine
+ * has finished normally are put back into this pool and reused.
+ *
+ * All threads created by this pool are anchored in the Lua registry
+ * until they are discarded.
+ */
+class LuaThreadPool {
+	/**
+	 * Do not keep more than this number of idle threads.
+	 */
+	static constexpr std::size_t MAX_IDLE = 256;
+
+	lua_State *const main_L;
+
+	PassageStats &stats;
+
+public:
+	struct Thread {
+		lua_State *L = nullptr;
+
+		/**
+		 * The registry reference which anchors the thread.
+		 */
+		int ref = LUA_NOREF;
+
+		operator bool() const noexcept {
+			return L != nullptr;
+		}
+	};
+
+private:
+	std::vector<Thread> idle;
+
+public:
+	LuaThreadPool(lua_State *_main_L, PassageStats &_stats) noexcept
+		:main_L(_main_L), stats(_stats) {}
+
+	~LuaThreadPool() noexcept;
+
+	LuaThreadPool(const LuaThreadPool &) = delete;
+	LuaThreadPool &operator=(const LuaThreadPool &) = delete;
+
+	/**
+	 * Obtain a thread with an empty stack, either from the pool
+	 * or a new one.
+	 */
+	Thread Acquire();
+
+	/**
+	 * Return a thread obtained by Acquire().  It is put back into
+	 * the pool if its coroutine has finished normally (or was
+	 * never started); threads which are suspended or have failed
+	 * cannot be reused and are discarded.
+	 */
+	void Release(Thread thread) noexcept;
+
+private:
+	void Discard(Thread thread) noexcept {
+		luaL_unref(main_L, LUA_REGISTRYINDEX, thread.ref);
+	}
+};
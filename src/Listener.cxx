@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Listener.hxx"
+#include "Instance.hxx"
+#include "Connection.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/SocketAddress.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#ifdef HAVE_URING
+#include "system/Error.hxx"
+#endif
+
+PassageListener::PassageListener(Instance &_instance,
+				 std::size_t _handler_index,
+				 const RootLogger &_logger) noexcept
+	:ServerSocket(_instance.GetEventLoop()),
+	 instance(_instance),
+	 handler_index(_handler_index),
+	 logger(_logger)
+{
+}
+
+PassageListener::~PassageListener() noexcept
+{
+	connections.clear_and_dispose(DeleteDisposer{});
+
+#ifdef HAVE_URING
+	if (uring_accept != nullptr) {
+		uring_accept->Cancel();
+		instance.GetUring()->Submit();
+	}
+#endif
+}
+
+void
+PassageListener::Listen(UniqueSocketDescriptor &&fd) noexcept
+{
+#ifdef HAVE_URING
+	if (auto *uring = instance.GetUring()) {
+		auto *a = new UringAccept(*uring, fd, *this);
+
+		try {
+			a->Start();
+			uring_socket = std::move(fd);
+			uring_accept = a;
+			return;
+		} catch (...) {
+			a->Cancel();
+			logger(2, std::current_exception());
+		}
+	}
+#endif
+
+	ServerSocket::Listen(std::move(fd));
+}
+
+void
+PassageListener::OnAccept(UniqueSocketDescriptor fd,
+			  SocketAddress address) noexcept
+try {
+	if (auto *worker = instance.FindLeastLoadedWorker()) {
+		worker->AddConnection(handler_index, std::move(fd), address);
+		return;
+	}
+
+	auto *c = new PassageConnection(instance, instance.GetConfigPtr(),
+					handler_index, logger,
+					std::move(fd), address);
+	connections.push_back(*c);
+} catch (...) {
+	OnAcceptError(std::current_exception());
+}
+
+void
+PassageListener::OnAcceptError(std::exception_ptr error) noexcept
+{
+	logger(1, std::move(error));
+}
+
+#ifdef HAVE_URING
+
+void
+PassageListener::OnUringAccept(UniqueSocketDescriptor &&fd) noexcept
+{
+	OnAccept(std::move(fd), nullptr);
+}
+
+void
+PassageListener::OnUringAcceptError(int error) noexcept
+{
+	uring_accept = nullptr;
+
+	if (error != EINVAL && error != EOPNOTSUPP)
+		OnAcceptError(std::make_exception_ptr(MakeErrno(error, "Failed to accept")));
+
+	/* continue with epoll */
+	ServerSocket::Listen(std::move(uring_socket));
+}
+
+#endif
@@ -2,15 +2,77 @@
 // Copyright CM4all GmbH
 // author: Max Kellermann <max.kellermann@ionos.com>
 
-#ifndef LISTENER_HXX
-#define LISTENER_HXX
+#pragma once
 
-#include "Connection.hxx"
-#include "event/net/TemplateServerSocket.hxx"
-#include "lua/ValuePtr.hxx"
+#include "event/net/ServerSocket.hxx"
+#include "io/Logger.hxx"
+#include "util/IntrusiveList.hxx"
+#include "config.h"
 
-typedef TemplateServerSocket<PassageConnection,
-			     Instance &, Lua::ValuePtr,
-			     RootLogger> PassageListener;
+#ifdef HAVE_URING
+#include "Uring.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#endif
+
+#include <cstddef>
+
+class Instance;
+class PassageConnection;
+
+/**
+ * Accepts connections on one socket.  They are either handled by
+ * this thread or (if workers are configured) passed to the least
+ * loaded #Worker.
+ */
+class PassageListener final
+	: ServerSocket
+#ifdef HAVE_URING
+	, UringAcceptHandler
+#endif
+{
+	Instance &instance;
+
+	/**
+	 * The index of the passage_listen() call which created this
+	 * listener; it identifies the handler in the current
+	 * #LuaConfig (of the main thread or of a worker).
+	 */
+	const std::size_t handler_index;
+
+	RootLogger logger;
+
+	IntrusiveList<PassageConnection> connections;
+
+#ifdef HAVE_URING
+	/**
+	 * The listener socket if it is handled by #uring_accept
+	 * instead of #ServerSocket.
+	 */
+	UniqueSocketDescriptor uring_socket;
+
+	UringAccept *uring_accept = nullptr;
+#endif
+
+public:
+	PassageListener(Instance &_instance, std::size_t _handler_index,
+			const RootLogger &_logger) noexcept;
+	~PassageListener() noexcept;
+
+	/**
+	 * Start accepting connections on the given socket, using a
+	 * multishot io_uring accept operation if available.
+	 */
+	void Listen(UniqueSocketDescriptor &&fd) noexcept;
+
+private:
+	/* virtual methods from class ServerSocket */
+	void OnAccept(UniqueSocketDescriptor fd,
+		      SocketAddress address) noexcept override;
+	void OnAcceptError(std::exception_ptr error) noexcept override;
 
+#ifdef HAVE_URING
+	/* virtual methods from class UringAcceptHandler */
+	void OnUringAccept(UniqueSocketDescriptor &&fd) noexcept override;
+	void OnUringAcceptError(int error) noexcept override;
 #endif
+};
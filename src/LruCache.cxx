@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LruCache.hxx"
+
+#include <cassert>
+#include <tuple> // for std::forward_as_tuple()
+
+inline void
+LruCache::Erase(decltype(map)::iterator i) noexcept
+{
+	assert(size >= i->second.GetSize());
+
+	size -= i->second.GetSize();
+
+	/* the Item destructor removes it from #lru */
+	map.erase(i);
+}
+
+const std::string *
+LruCache::Get(std::string_view key, Clock::time_point now) noexcept
+{
+	const auto i = map.find(key);
+	if (i == map.end()) {
+		++stats.misses;
+		return nullptr;
+	}
+
+	auto &item = i->second;
+	if (now >= item.expires) {
+		Erase(i);
+		++stats.expirations;
+		++stats.misses;
+		return nullptr;
+	}
+
+	++stats.hits;
+
+	/* move to the front of the LRU list */
+	item.unlink();
+	lru.push_front(item);
+
+	return &item.value;
+}
+
+void
+LruCache::MakeRoom(std::size_t needed) noexcept
+{
+	while (size + needed > max_size && !lru.empty()) {
+		const auto i = map.find(*lru.back().key);
+		assert(i != map.end());
+
+		Erase(i);
+		++stats.evictions;
+	}
+}
+
+void
+LruCache::Set(std::string_view key, std::string_view value,
+	      Clock::time_point expires)
+{
+	Remove(key);
+
+	const std::size_t item_size = key.size() + value.size() + ITEM_OVERHEAD;
+	if (item_size > max_size)
+		return;
+
+	MakeRoom(item_size);
+
+	auto [i, inserted] = map.emplace(std::piecewise_construct,
+					 std::forward_as_tuple(key),
+					 std::forward_as_tuple(value, expires));
+	assert(inserted);
+
+	auto &item = i->second;
+	item.key = &i->first;
+	lru.push_front(item);
+	size += item_size;
+}
+
+bool
+LruCache::Remove(std::string_view key) noexcept
+{
+	const auto i = map.find(key);
+	if (i == map.end())
+		return false;
+
+	Erase(i);
+	return true;
+}
+
+std::size_t
+LruCache::RemovePrefix(std::string_view prefix) noexcept
+{
+	std::size_t n = 0;
+
+	for (auto i = map.begin(); i != map.end();) {
+		if (i->first.starts_with(prefix)) {
+			Erase(i++);
+			++n;
+		} else
+			++i;
+	}
+
+	return n;
+}
+
+void
+LruCache::Clear() noexcept
+{
+	map.clear();
+	size = 0;
+}
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "util/IntrusiveList.hxx"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional> // for std::equal_to
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * A map from strings to strings with a bound on the total size of
+ * its items.  Each item has an expiry time; when the cache is full,
+ * the least recently used items are evicted.
+ *
+ * This class is not thread-safe.
+ */
+class LruCache {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * The estimated overhead of each item in addition to the
+	 * sizes of its key and value.
+	 */
+	static constexpr std::size_t ITEM_OVERHEAD = 128;
+
+	struct Stats {
+		uint_least64_t hits = 0, misses = 0;
+
+		/**
+		 * The number of items which have been removed to make
+		 * room for new ones.
+		 */
+		uint_least64_t evictions = 0;
+
+		/**
+		 * The number of items which have been found to be
+		 * expired by Get().
+		 */
+		uint_least64_t expirations = 0;
+	};
+
+private:
+	struct Hash : std::hash<std::string_view> {
+		using is_transparent = void;
+	};
+
+	struct Item final : AutoUnlinkIntrusiveListHook {
+		/**
+		 * Points to the key of this item in #LruCache::map.
+		 */
+		const std::string *key;
+
+		std::string value;
+
+		Clock::time_point expires;
+
+		Item(std::string_view _value,
+		     Clock::time_point _expires) noexcept
+			:value(_value), expires(_expires) {}
+
+		Item(const Item &) = delete;
+		Item &operator=(const Item &) = delete;
+
+		std::size_t GetSize() const noexcept {
+			return key->size() + value.size() + ITEM_OVERHEAD;
+		}
+	};
+
+	const std::size_t max_size;
+
+	/**
+	 * All items; the most recently used one is at the front.
+	 * This is declared before #map so it gets destroyed after
+	 * the items.
+	 */
+	IntrusiveList<Item> lru;
+
+	std::unordered_map<std::string, Item, Hash, std::equal_to<>> map;
+
+	/**
+	 * The sum of Item::GetSize() of all items.
+	 */
+	std::size_t size = 0;
+
+	Stats stats;
+
+public:
+	/**
+	 * @param _max_size the maximum total size of all items in
+	 * bytes (see Item::GetSize())
+	 */
+	explicit LruCache(std::size_t _max_size) noexcept
+		:max_size(_max_size) {}
+
+	LruCache(const LruCache &) = delete;
+	LruCache &operator=(const LruCache &) = delete;
+
+	std::size_t GetItemCount() const noexcept {
+		return map.size();
+	}
+
+	/**
+	 * @return the total size of all items in bytes
+	 */
+	std::size_t GetSize() const noexcept {
+		return size;
+	}
+
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Look up an item and mark it as recently used.
+	 *
+	 * @return a pointer to the value (valid until the cache is
+	 * modified) or nullptr if there is no such item or if it has
+	 * expired
+	 */
+	const std::string *Get(std::string_view key,
+			       Clock::time_point now) noexcept;
+
+	/**
+	 * Add or replace an item.  Items which are too large for the
+	 * cache are not stored (but an old item with the same key is
+	 * removed).
+	 */
+	void Set(std::string_view key, std::string_view value,
+		 Clock::time_point expires);
+
+	/**
+	 * @return true if the item existed
+	 */
+	bool Remove(std::string_view key) noexcept;
+
+	/**
+	 * Remove all items whose key starts with the given prefix.
+	 * This needs to iterate over all items.
+	 *
+	 * @return the number of removed items
+	 */
+	std::size_t RemovePrefix(std::string_view prefix) noexcept;
+
+	void Clear() noexcept;
+
+private:
+	void Erase(decltype(map)::iterator i) noexcept;
+
+	/**
+	 * Evict least recently used items until there is room for
+	 * the given number of bytes.
+	 */
+	void MakeRoom(std::size_t needed) noexcept;
+};
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Budget.hxx"
+#include "Handler.hxx"
+#include "LThreadPool.hxx"
+#include "Rule.hxx"
+#include "lua/ReloadRunner.hxx"
+#include "lua/State.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+struct PassageStats;
+
+/**
+ * Everything which was created by loading the configuration file
+ * into one Lua state: the state itself, the handlers registered by
+ * passage_listen() and the settings made by the configuration
+ * file.
+ *
+ * A configuration reload creates a new instance and replaces the
+ * old one in the #BaseInstance; connections keep a reference to the
+ * instance they were created with, so the old Lua state lives on
+ * until its last connection is closed.
+ */
+class LuaConfig {
+	Lua::State lua_state{luaL_newstate()};
+
+	Lua::ReloadRunner reload{lua_state.get()};
+
+	LuaThreadPool thread_pool;
+
+	HandlerBudget budget;
+
+	/**
+	 * Static rules registered by passage_rule(); they are
+	 * evaluated before the Lua handler.
+	 */
+	RuleSet rules;
+
+	/**
+	 * The handlers in the order of the passage_listen() calls in
+	 * the configuration file.  They are declared after
+	 * #lua_state because they must be destroyed before it.
+	 */
+	std::vector<PassageHandlerPtr> handlers;
+
+	/**
+	 * If true, then Lua handlers are invoked only after all
+	 * ready connections have been read; see
+	 * passage_defer_handlers().
+	 */
+	bool defer_handlers = false;
+
+public:
+	explicit LuaConfig(PassageStats &stats) noexcept
+		:thread_pool(lua_state.get(), stats),
+		 budget(lua_state.get(), stats) {}
+
+	LuaConfig(const LuaConfig &) = delete;
+	LuaConfig &operator=(const LuaConfig &) = delete;
+
+	lua_State *GetLuaState() const noexcept {
+		return lua_state.get();
+	}
+
+	/**
+	 * Call the Lua "reload" function.
+	 */
+	void StartReload() noexcept {
+		reload.Start();
+	}
+
+	LuaThreadPool &GetThreadPool() noexcept {
+		return thread_pool;
+	}
+
+	HandlerBudget &GetBudget() noexcept {
+		return budget;
+	}
+
+	RuleSet &GetRules() noexcept {
+		return rules;
+	}
+
+	const RuleSet &GetRules() const noexcept {
+		return rules;
+	}
+
+	/**
+	 * Register a handler (called by passage_listen() while the
+	 * configuration file is loaded).
+	 *
+	 * @return the handler index
+	 */
+	std::size_t AddHandler(PassageHandlerPtr &&handler) {
+		handlers.emplace_back(std::move(handler));
+		return handlers.size() - 1;
+	}
+
+	std::size_t GetHandlerCount() const noexcept {
+		return handlers.size();
+	}
+
+	const PassageHandlerPtr &GetHandler(std::size_t i) const noexcept {
+		assert(i < handlers.size());
+		return handlers[i];
+	}
+
+	bool IsDeferHandlers() const noexcept {
+		return defer_handlers;
+	}
+
+	void SetDeferHandlers(bool value) noexcept {
+		defer_handlers = value;
+	}
+};
+
+using LuaConfigPtr = std::shared_ptr<LuaConfig>;
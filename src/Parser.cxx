@@ -4,121 +4,194 @@
 
 #include "Parser.hxx"
 #include "Entity.hxx"
-#include "Verify.hxx"
+#include "EntityView.hxx"
+#include "Scan.hxx"
 #include "net/SocketProtocolError.hxx"
-#include "util/StringSplit.hxx"
-#include "util/StringStrip.hxx"
 
-#include <cassert>
-#include <stdexcept>
+#include <cstring> // for memchr()
 
-static std::string_view
-NextSplit(std::string_view &buffer, char separator) noexcept
+/*
+ * The parser walks over the payload exactly once: each character is
+ * classified with a table lookup (see Scan.hxx) which finds token
+ * boundaries and verifies the syntax in the same step.  The body is
+ * never looked at.
+ */
+
+[[gnu::pure]]
+static constexpr bool
+IsLineEnd(const char *p, const char *end) noexcept
 {
-	auto [line, rest] = Split(buffer, separator);
-	buffer = rest;
-	return line;
+	return p == end || HasCharClass(*p, CHAR_LINE_END);
 }
 
-static std::string_view
-NextLine(std::string_view &buffer) noexcept
+[[gnu::pure]]
+static constexpr bool
+IsTokenEnd(const char *p, const char *end) noexcept
 {
-	return NextSplit(buffer, '\n');
+	return IsLineEnd(p, end) || *p == ' ';
 }
 
-static std::string_view
-NextUnquoted(std::string_view &buffer)
+static const char *
+ParseCommand(const char *p, const char *end)
 {
-	std::string_view value = NextSplit(buffer, ' ');
+	const char *const begin = p;
+	p = SkipCharClass(p, end, CHAR_COMMAND);
+
+	if (!IsTokenEnd(p, end)) {
+		/* this is not a valid command, but distinguish
+		   between the two possible errors */
+		p = SkipCharClass(p, end, CHAR_UNQUOTED);
+		if (IsTokenEnd(p, end))
+			throw SocketProtocolError{"Malformed command"};
+		throw SocketProtocolError{"Bad unquoted parameter"};
+	}
 
-	if (!IsValidUnquotedParameter(value))
+	if (p == begin)
 		throw SocketProtocolError{"Bad unquoted parameter"};
 
-	return value;
+	return p;
 }
 
-static std::string
-NextQuoted(std::string_view &_src)
+/**
+ * Verify the quoted parameter (but do not decode it).
+ *
+ * @param p points to the opening quote
+ * @return a pointer to the character after the closing quote
+ */
+static const char *
+SkipQuoted(const char *p, const char *end)
 {
-	assert(!_src.empty());
-	assert(_src.front() == '"');
-
-	const auto src = _src;
-	std::string dest;
-
-	for (std::size_t i = 1; i < src.size(); ++i) {
-		char ch = src[i];
-
-		if (ch == '"') {
-			if (const auto rest = src.substr(i + 1);
-			    rest.empty())
-				_src = rest;
-			else if (rest.front() == ' ')
-				_src = rest.substr(1);
-			else
-				throw SocketProtocolError{"Garbage after closing quote"};
-			return dest;
-		}
+	++p;
 
-		if (ch == '\\') {
-			if (++i >= src.size())
-				break;
+	while (true) {
+		p = FindQuoteSpecial(p, end);
+		if (IsLineEnd(p, end))
+			throw SocketProtocolError{"Closing quote missing"};
+
+		if (*p == '"')
+			return p + 1;
+
+		/* skip the backslash and the escaped character */
+		++p;
+		if (IsLineEnd(p, end))
+			throw SocketProtocolError{"Closing quote missing"};
+		++p;
+	}
+}
 
-			ch = src[i];
+/**
+ * Verify the argument list (but do not decode it).
+ *
+ * @return a pointer to the end of the line
+ */
+static const char *
+ParseArguments(const char *p, const char *end)
+{
+	while (true) {
+		p = SkipCharClass(p, end, CHAR_WHITESPACE);
+		if (IsLineEnd(p, end))
+			return p;
+
+		if (*p == '"') {
+			p = SkipQuoted(p, end);
+			if (IsLineEnd(p, end))
+				return p;
+
+			if (*p != ' ')
+				throw SocketProtocolError{"Garbage after closing quote"};
+		} else {
+			p = SkipCharClass(p, end, CHAR_UNQUOTED);
+			if (IsLineEnd(p, end))
+				return p;
+
+			if (*p != ' ')
+				throw SocketProtocolError{"Bad unquoted parameter"};
 		}
 
-		dest.push_back(ch);
+		/* skip the space */
+		++p;
 	}
-
-	throw SocketProtocolError{"Closing quote missing"};
 }
 
-static std::string
-NextValue(std::string_view &src)
+/**
+ * Verify one header line.
+ *
+ * @return a pointer to the end of the line or nullptr if this is an
+ * empty line (i.e. the end of the header block)
+ */
+static const char *
+ParseHeader(const char *p, const char *end)
 {
-	assert(!src.empty());
+	const char *const name = p;
+	p = SkipCharClass(p, end, CHAR_UNQUOTED);
+	if (p == name && IsLineEnd(p, end))
+		return nullptr;
+
+	if (p == name || p == end || *p != ':')
+		throw SocketProtocolError("Bad header syntax");
 
-	if (src.front() == '"')
-		return NextQuoted(src);
-	else
-		return std::string{NextUnquoted(src)};
+	++p;
+	p = SkipCharClass(p, end, CHAR_WHITESPACE);
+	p = SkipPrintable(p, end);
+
+	if (!IsLineEnd(p, end))
+		throw SocketProtocolError("Bad header syntax");
+
+	return p;
 }
 
-Entity
-ParseEntity(std::string_view payload)
+EntityView
+ParseEntityView(std::string_view payload)
 {
-	Entity entity;
+	const char *p = payload.data();
+	const char *const end = p + payload.size();
 
-	const auto [_payload, body] = Split(payload, '\0');
-	if (!body.empty())
-		entity.body = std::string{body};
-	payload = _payload;
+	EntityView entity;
 
-	auto line = NextLine(payload);
+	const char *const command = p;
+	p = ParseCommand(p, end);
+	entity.command = {command, p};
 
-	const auto command = NextUnquoted(line);
-	CheckCommand(command);
-	entity.command = command;
+	if (p < end && *p == ' ') {
+		const char *const args = ++p;
+		p = ParseArguments(p, end);
+		entity.args = {args, p};
+	}
 
-	auto args_tail = entity.args.before_begin();
-	while (true) {
-		line = StripLeft(line);
-		if (line.empty())
-			break;
+	if (p < end && *p == '\n') {
+		const char *const headers = ++p;
+		const char *headers_end = headers;
 
-		args_tail = entity.args.emplace_after(args_tail, NextValue(line));
-	}
+		while (true) {
+			const char *const line_end = ParseHeader(p, end);
+			if (line_end == nullptr)
+				break;
 
-	while (!(line = NextLine(payload)).empty()) {
-		auto [name, value] = Split(line, ':');
-		value = StripLeft(value);
+			p = headers_end = line_end;
+			if (p == end || *p == '\0')
+				break;
 
-		if (value.data() == nullptr || !IsValidHeaderName(name) ||
-		    !IsValidHeaderValue(value))
-			throw SocketProtocolError("Bad header syntax");
+			/* skip the newline */
+			++p;
+		}
+
+		entity.headers = {headers, headers_end};
 
-		entity.headers.emplace(name, value);
+		if (p < end && *p == '\n')
+			/* everything after the empty line is ignored
+			   (until the null byte which separates the
+			   body) */
+			p = static_cast<const char *>(memchr(p, '\0', end - p));
 	}
 
+	if (p != nullptr && p < end && *p == '\0')
+		entity.body = {p + 1, end};
+
 	return entity;
 }
+
+Entity
+ParseEntity(std::string_view payload)
+{
+	return ParseEntityView(payload).ToEntity();
+}
@@ -7,8 +7,20 @@
 #include <string_view>
 
 struct Entity;
+struct EntityView;
 
 /**
+ * Parse and verify the payload without copying anything.  The
+ * returned object points into the given buffer.
+ *
+ * Throws on error.
+ */
+EntityView
+ParseEntityView(std::string_view s);
+
+/**
+ * Like ParseEntityView(), but decode and copy everything.
+ *
  * Throws on error.
  */
 Entity
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "PeerAuth.hxx"
+#include "PeerAuthCache.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#ifndef SO_PEERPIDFD
+#define SO_PEERPIDFD 77
+#endif
+
+static struct ucred
+GetPeerCred(SocketDescriptor s) noexcept
+{
+	struct ucred cred;
+	socklen_t length = sizeof(cred);
+	if (getsockopt(s.Get(), SOL_SOCKET, SO_PEERCRED, &cred, &length) < 0 ||
+	    length != sizeof(cred))
+		cred.pid = -1;
+
+	return cred;
+}
+
+/**
+ * @return the pidfd or an undefined object if the kernel does not
+ * support SO_PEERPIDFD
+ */
+static UniqueFileDescriptor
+GetPeerPidfd(SocketDescriptor s) noexcept
+{
+	int fd;
+	socklen_t length = sizeof(fd);
+	if (getsockopt(s.Get(), SOL_SOCKET, SO_PEERPIDFD, &fd, &length) < 0 ||
+	    length != sizeof(fd))
+		return {};
+
+	return UniqueFileDescriptor{AdoptTag{}, fd};
+}
+
+PeerAuth::PeerAuth(SocketDescriptor s,
+		   PeerAuthCache &_cache, PassageStats &_stats) noexcept
+	:cache(_cache), stats(_stats),
+	 cred(GetPeerCred(s))
+{
+	if (HaveCred())
+		pidfd = GetPeerPidfd(s);
+}
+
+std::string_view
+PeerAuth::GetCgroupPath() const
+{
+	if (!have_cgroup_path) {
+		if (HaveCred())
+			cgroup_path = cache.GetCgroupPath(pidfd, cred.pid, stats);
+
+		have_cgroup_path = true;
+	}
+
+	return cgroup_path;
+}
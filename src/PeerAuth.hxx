@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <string>
+#include <string_view>
+
+#include <sys/socket.h> // for struct ucred
+
+struct PassageStats;
+class SocketDescriptor;
+class PeerAuthCache;
+
+/**
+ * The identity of the process on the other end of a local socket.
+ * The credentials are obtained with SO_PEERCRED; the cgroup is
+ * looked up on demand (through the #PeerAuthCache).
+ *
+ * If the kernel supports SO_PEERPIDFD (Linux 6.5), the client is
+ * additionally referred to by a pidfd, which protects the cgroup
+ * lookup against pid reuse.
+ */
+class PeerAuth {
+	PeerAuthCache &cache;
+
+	PassageStats &stats;
+
+	struct ucred cred;
+
+	/**
+	 * A pidfd of the client process or undefined if the kernel
+	 * does not support SO_PEERPIDFD.
+	 */
+	UniqueFileDescriptor pidfd;
+
+	/**
+	 * Cached result of GetCgroupPath().
+	 */
+	mutable std::string cgroup_path;
+
+	mutable bool have_cgroup_path = false;
+
+public:
+	PeerAuth(SocketDescriptor s,
+		 PeerAuthCache &_cache, PassageStats &_stats) noexcept;
+
+	PeerAuth(const PeerAuth &) = delete;
+	PeerAuth &operator=(const PeerAuth &) = delete;
+
+	bool HaveCred() const noexcept {
+		return cred.pid >= 0;
+	}
+
+	pid_t GetPid() const noexcept {
+		return cred.pid;
+	}
+
+	uid_t GetUid() const noexcept {
+		return cred.uid;
+	}
+
+	gid_t GetGid() const noexcept {
+		return cred.gid;
+	}
+
+	FileDescriptor GetPidfd() const noexcept {
+		return pidfd;
+	}
+
+	/**
+	 * Determine the path of the client's cgroup (beginning with
+	 * a slash).
+	 *
+	 * Throws on error.
+	 *
+	 * @return the path or an empty string if it is unknown
+	 */
+	std::string_view GetCgroupPath() const;
+};
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "PeerAuthCache.hxx"
+#include "Stats.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm> // for std::min()
+#include <cerrno>
+#include <span>
+#include <string_view>
+
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+#ifndef PID_FS_MAGIC
+#define PID_FS_MAGIC 0x50494446
+#endif
+
+/**
+ * Read the cgroup2 path from /proc/PID/cgroup.
+ *
+ * @return the path or an empty string if the process does not
+ * exist (anymore)
+ */
+static std::string
+ReadProcessCgroup(pid_t pid)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(fmt::format("/proc/{}/cgroup"sv, pid).c_str())) {
+		if (errno == ENOENT)
+			return {};
+
+		throw MakeErrno("Failed to open /proc/PID/cgroup");
+	}
+
+	char buffer[4096];
+	const auto nbytes = fd.Read(std::as_writable_bytes(std::span{buffer}));
+	if (nbytes < 0) {
+		if (errno == ESRCH)
+			return {};
+
+		throw MakeErrno("Failed to read /proc/PID/cgroup");
+	}
+
+	/* the cgroup2 hierarchy has the id 0 and no controllers */
+	std::string_view contents{buffer, static_cast<std::size_t>(nbytes)};
+	while (!contents.empty()) {
+		auto line = contents.substr(0, contents.find('\n'));
+		contents.remove_prefix(std::min(line.size() + 1, contents.size()));
+
+		if (line.starts_with("0::"sv)) {
+			line.remove_prefix(3);
+			return std::string{line};
+		}
+	}
+
+	return {};
+}
+
+/**
+ * Is the process referred to by the given pidfd still alive?
+ */
+static bool
+IsAlive(FileDescriptor pidfd) noexcept
+{
+	return syscall(SYS_pidfd_send_signal, pidfd.Get(), 0, nullptr, 0) == 0;
+}
+
+/**
+ * Convert an inode number to a #LruCache key.
+ */
+static std::string_view
+ToStringView(const uint_least64_t &inode) noexcept
+{
+	return {reinterpret_cast<const char *>(&inode), sizeof(inode)};
+}
+
+inline std::optional<uint_least64_t>
+PeerAuthCache::GetKey(FileDescriptor pidfd) noexcept
+{
+	if (!pidfd.IsDefined())
+		return std::nullopt;
+
+	auto state = pidfs.load(std::memory_order_relaxed);
+	if (state == PidfsState::UNKNOWN) {
+		struct statfs sf;
+		state = fstatfs(pidfd.Get(), &sf) == 0 &&
+			static_cast<unsigned long>(sf.f_type) == PID_FS_MAGIC
+			? PidfsState::AVAILABLE
+			: PidfsState::UNAVAILABLE;
+		pidfs.store(state, std::memory_order_relaxed);
+	}
+
+	if (state != PidfsState::AVAILABLE)
+		return std::nullopt;
+
+	struct stat st;
+	if (fstat(pidfd.Get(), &st) < 0)
+		return std::nullopt;
+
+	return st.st_ino;
+}
+
+std::string
+PeerAuthCache::GetCgroupPath(FileDescriptor pidfd, pid_t pid,
+			     PassageStats &stats)
+{
+	const auto key = GetKey(pidfd);
+
+	if (key) {
+		const std::scoped_lock lock{mutex};
+		if (const auto *value = cache.Get(ToStringView(*key),
+						  LruCache::Clock::now())) {
+			++stats.peer_cache_hits;
+			return *value;
+		}
+	}
+
+	++stats.peer_cache_misses;
+
+	auto path = ReadProcessCgroup(pid);
+
+	/* if the process has exited in the meantime, its pid may
+	   have been reused by another process, and the path we just
+	   read may belong to that one */
+	if (pidfd.IsDefined() && !IsAlive(pidfd))
+		return {};
+
+	if (key && !path.empty()) {
+		const std::scoped_lock lock{mutex};
+		cache.Set(ToStringView(*key), path, LruCache::Clock::now() + TTL);
+	}
+
+	return path;
+}
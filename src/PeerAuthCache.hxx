@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "LruCache.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <sys/types.h> // for pid_t
+
+struct PassageStats;
+class FileDescriptor;
+
+/**
+ * Caches the cgroup paths of client processes, so a client which
+ * connects many times does not need a procfs lookup each time.  The
+ * key is the inode number of the client's pidfd, which (on pidfs)
+ * identifies the process uniquely; unlike the pid, it is never
+ * reused.
+ *
+ * This object is shared by all threads.
+ */
+class PeerAuthCache {
+	static constexpr std::size_t MAX_SIZE = 1024 * 1024;
+
+	/**
+	 * A process may be moved to a different cgroup, so cached
+	 * paths expire after a while.
+	 */
+	static constexpr LruCache::Clock::duration TTL = std::chrono::minutes{1};
+
+	std::mutex mutex;
+
+	LruCache cache{MAX_SIZE};
+
+	enum class PidfsState : uint_least8_t {
+		UNKNOWN,
+		AVAILABLE,
+		UNAVAILABLE,
+	};
+
+	/**
+	 * Are pidfds inodes on pidfs (Linux 6.9)?  Older kernels
+	 * share one anonymous inode among all pidfds, which makes
+	 * them useless as cache keys.
+	 */
+	std::atomic<PidfsState> pidfs{PidfsState::UNKNOWN};
+
+public:
+	PeerAuthCache() = default;
+
+	PeerAuthCache(const PeerAuthCache &) = delete;
+	PeerAuthCache &operator=(const PeerAuthCache &) = delete;
+
+	/**
+	 * Determine the cgroup path of a process, either from the
+	 * cache or by reading /proc/PID/cgroup.
+	 *
+	 * Throws on error.
+	 *
+	 * @param pidfd the process's pidfd (or undefined if the
+	 * kernel does not support SO_PEERPIDFD, which disables the
+	 * cache)
+	 * @param pid the process id (from SO_PEERCRED)
+	 * @param stats the lookup is counted here
+	 * @return the cgroup path or an empty string if the process
+	 * has exited
+	 */
+	std::string GetCgroupPath(FileDescriptor pidfd, pid_t pid,
+				  PassageStats &stats);
+
+private:
+	/**
+	 * @return the inode number of the given pidfd or nullopt if
+	 * it cannot be used as a cache key
+	 */
+	std::optional<uint_least64_t> GetKey(FileDescriptor pidfd) noexcept;
+};
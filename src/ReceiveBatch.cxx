@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ReceiveBatch.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "net/SocketError.hxx"
+
+#include <algorithm> // for std::min()
+#include <cassert>
+
+#include <unistd.h> // for close()
+
+/**
+ * Take the file descriptor passed in SCM_RIGHTS messages.  If there
+ * is more than one, all of them are closed.
+ *
+ * @return false if there was more than one
+ */
+static bool
+ReceiveScmRights(struct msghdr &msg, UniqueFileDescriptor &fd) noexcept
+{
+	std::size_t n_fds = 0;
+
+	for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		const int *fds = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+		const std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(*fds);
+		for (std::size_t i = 0; i < n; ++i) {
+			if (n_fds++ == 0)
+				fd = UniqueFileDescriptor{AdoptTag{}, fds[i]};
+			else
+				close(fds[i]);
+		}
+	}
+
+	if (n_fds > 1) {
+		fd.Close();
+		return false;
+	}
+
+	return true;
+}
+
+std::size_t
+ReceiveBatch::Receive(SocketDescriptor s)
+{
+	for (std::size_t i = 0; i < MAX_DATAGRAMS; ++i) {
+		auto &slot = slots[i];
+		slot.iov = {slot.payload, sizeof(slot.payload)};
+		slot.fd.Close();
+
+		headers[i].msg_hdr = {
+			.msg_iov = &slot.iov,
+			.msg_iovlen = 1,
+			.msg_control = slot.cmsg,
+			.msg_controllen = sizeof(slot.cmsg),
+		};
+		headers[i].msg_len = 0;
+	}
+
+	const int result = recvmmsg(s.Get(), headers.data(), headers.size(),
+				    MSG_DONTWAIT|MSG_CMSG_CLOEXEC, nullptr);
+	if (result < 0) {
+		n_received = 0;
+
+		const auto e = GetSocketError();
+		if (IsSocketErrorReceiveWouldBlock(e))
+			return 0;
+
+		throw MakeSocketError(e, "Failed to receive");
+	}
+
+	n_received = result;
+
+	/* adopt file descriptors right away so they cannot leak */
+	for (std::size_t i = 0; i < n_received; ++i) {
+		auto &msg = headers[i].msg_hdr;
+		auto &slot = slots[i];
+		slot.excess_fds = !ReceiveScmRights(msg, slot.fd) ||
+			(msg.msg_flags & MSG_CTRUNC) != 0;
+		if (slot.excess_fds)
+			slot.fd.Close();
+	}
+
+	return n_received;
+}
+
+ReceiveBatch::Datagram
+ReceiveBatch::operator[](std::size_t i) const noexcept
+{
+	assert(i < n_received);
+
+	const auto &msg = headers[i].msg_hdr;
+	const std::size_t length = std::min<std::size_t>(headers[i].msg_len,
+							 MAX_PAYLOAD);
+
+	return {
+		.payload = {slots[i].payload, length},
+		.truncated = (msg.msg_flags & MSG_TRUNC) != 0,
+		.excess_fds = slots[i].excess_fds,
+	};
+}
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <utility> // for std::move()
+
+#include <sys/socket.h>
+
+class SocketDescriptor;
+
+/**
+ * Buffers for receiving several datagrams with one recvmmsg() call.
+ * One instance is shared by all connections of an #EventLoop; the
+ * received data is only valid until the next Receive() call.
+ */
+class ReceiveBatch {
+public:
+	static constexpr std::size_t MAX_DATAGRAMS = 16;
+	static constexpr std::size_t MAX_PAYLOAD = 16384;
+
+	/**
+	 * Clients may pass one file descriptor with a request; this
+	 * is enough to detect that they passed more.
+	 */
+	static constexpr std::size_t MAX_FDS = 4;
+
+	struct Datagram {
+		std::span<const std::byte> payload;
+
+		/**
+		 * Was the payload larger than #MAX_PAYLOAD?
+		 */
+		bool truncated;
+
+		/**
+		 * Did the client pass more than one file descriptor?
+		 * (They have already been closed.)
+		 */
+		bool excess_fds;
+	};
+
+private:
+	static constexpr std::size_t CMSG_BUFFER_SIZE =
+		CMSG_SPACE(sizeof(struct ucred)) +
+		CMSG_SPACE(sizeof(int) * MAX_FDS);
+
+	struct Slot {
+		struct iovec iov;
+
+		/**
+		 * See Datagram::excess_fds.
+		 */
+		bool excess_fds;
+
+		/**
+		 * The file descriptor passed by the client (see
+		 * StealFd()).
+		 */
+		UniqueFileDescriptor fd;
+
+		alignas(struct cmsghdr) std::byte cmsg[CMSG_BUFFER_SIZE];
+
+		std::byte payload[MAX_PAYLOAD];
+	};
+
+	std::array<struct mmsghdr, MAX_DATAGRAMS> headers;
+
+	const std::unique_ptr<Slot[]> slots{new Slot[MAX_DATAGRAMS]};
+
+	std::size_t n_received = 0;
+
+public:
+	ReceiveBatch() = default;
+
+	ReceiveBatch(const ReceiveBatch &) = delete;
+	ReceiveBatch &operator=(const ReceiveBatch &) = delete;
+
+	/**
+	 * Receive as many datagrams as are available (up to
+	 * #MAX_DATAGRAMS) without blocking.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the number of datagrams (0 if none was available)
+	 */
+	std::size_t Receive(SocketDescriptor s);
+
+	std::size_t size() const noexcept {
+		return n_received;
+	}
+
+	Datagram operator[](std::size_t i) const noexcept;
+
+	/**
+	 * Take ownership of the file descriptor passed with the
+	 * given datagram (if any).  File descriptors which are not
+	 * taken are closed by the next Receive() call.
+	 */
+	UniqueFileDescriptor StealFd(std::size_t i) noexcept {
+		return std::move(slots[i].fd);
+	}
+};
@@ -0,0 +1,590 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Request.hxx"
+#include "Connection.hxx"
+#include "BaseInstance.hxx"
+#include "Entity.hxx"
+#include "EntitySerializer.hxx"
+#include "EntityView.hxx"
+#include "HeaderMap.hxx"
+#include "LRequest.hxx"
+#include "LAction.hxx"
+#include "Action.hxx"
+#include "SendControl.hxx"
+#include "ExecPipe.hxx"
+#include "ExecTemplate.hxx"
+#include "CoChildSlot.hxx"
+#include "lua/Error.hxx"
+#include "lua/Value.hxx"
+#include "co/Task.hxx"
+#include "io/Iovec.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/SpanCast.hxx"
+
+#ifdef HAVE_CURL
+#include "lib/curl/CoRequest.hxx"
+#include "lib/curl/Easy.hxx"
+#include "lib/curl/Setup.hxx"
+#include "lib/curl/Slist.hxx"
+#include "http/Method.hxx"
+
+#include <iterator> // for std::back_inserter()
+#endif
+
+#include <fmt/format.h>
+
+#include <algorithm> // for std::copy()
+#include <stdexcept>
+#include <utility> // for std::unreachable()
+
+#include <assert.h>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr std::string_view request_id_header = "request_id"sv;
+
+static const HeaderMap no_headers;
+
+PassageRequest::PassageRequest(PassageConnection &_connection,
+			       LuaThreadPool &_thread_pool,
+			       std::string_view _id,
+			       UniqueFileDescriptor &&_client_fd)
+	:connection(_connection), id(_id), thread_pool(_thread_pool),
+	 client_fd(std::move(_client_fd)),
+	 arena(connection.GetInstance().GetArenaPool()),
+	 budget_timer(connection.GetInstance().GetEventLoop(),
+		      BIND_THIS_METHOD(OnBudgetTimeout))
+{
+}
+
+PassageRequest::~PassageRequest() noexcept
+{
+	if (thread) {
+		connection.GetConfig().GetBudget().End(thread.L);
+		Lua::UnsetResumeListener(thread.L);
+		thread_pool.Release(thread);
+	}
+}
+
+bool
+PassageRequest::Prepare(const Lua::Value &handler, std::string_view payload,
+			const EntityView &request) noexcept
+try {
+	/* obtain a thread for the handler coroutine */
+	thread = thread_pool.Acquire();
+	const auto L = thread.L;
+	Lua::SetResumeListener(L, *this);
+
+	connection.GetConfig().GetBudget().Begin(L, request.command,
+						 budget_timer);
+
+	handler.Push(L);
+
+	lua_request = NewLuaRequest(L, connection.GetAutoClose(),
+				    payload, request, connection.GetPeerAuth());
+
+	return true;
+} catch (...) {
+	OnLuaError(nullptr, std::current_exception());
+	return false;
+}
+
+void
+PassageRequest::Run(const Action &action, std::string_view body) noexcept
+{
+	try {
+		invoke_task = Do(action, body);
+	} catch (...) {
+		OnCoComplete(std::current_exception());
+		return;
+	}
+
+	invoke_task.Start(BIND_THIS_METHOD(OnCoComplete));
+}
+
+void
+PassageRequest::Reject(std::string_view message) noexcept
+try {
+	SendError(message, no_headers);
+	Destroy();
+} catch (...) {
+	Abort(std::current_exception());
+}
+
+void
+PassageRequest::Resume() noexcept
+{
+	assert(thread);
+
+	if (connection.GetConfig().GetBudget().IsExceeded(thread.L)) {
+		/* the time budget has expired while this deferred
+		   handler was waiting to be started */
+		OnLuaError(thread.L, MakeBudgetError());
+		return;
+	}
+
+	Lua::Resume(thread.L, 1);
+}
+
+void
+PassageRequest::Abort(std::exception_ptr &&error) noexcept
+{
+	connection.Abort(std::move(error));
+}
+
+std::exception_ptr
+PassageRequest::MakeBudgetError() noexcept
+try {
+	auto message = connection.GetConfig().GetBudget().Expire(thread.L);
+	return std::make_exception_ptr(std::runtime_error{std::move(message)});
+} catch (...) {
+	return std::current_exception();
+}
+
+void
+PassageRequest::OnBudgetTimeout() noexcept
+{
+	assert(thread);
+
+	auto error = MakeBudgetError();
+
+	if (lua_status(thread.L) != LUA_YIELD)
+		/* the handler has not been started yet (see
+		   passage_defer_handlers()); Resume() will fail */
+		return;
+
+	/* the handler is suspended, waiting for an asynchronous
+	   operation; abandon its coroutine (just like when the
+	   connection gets closed) and send the error response */
+	OnLuaError(thread.L, std::move(error));
+}
+
+void
+PassageRequest::SendResponse(std::span<const struct iovec> vec,
+			     FileDescriptor fd, FileDescriptor fd2)
+{
+	assert(pending_response);
+
+	pending_response = false;
+	AtScopeExit(this) { OnResponseSent(); };
+
+	connection.SendResponse(vec, fd, fd2);
+}
+
+void
+PassageRequest::SendResponse(std::string_view status,
+			     FileDescriptor fd, FileDescriptor fd2)
+{
+	if (cache_hint.IsDefined() && !fd.IsDefined()) {
+		/* file descriptors cannot be cached */
+		const struct iovec vec[] = {
+			MakeIovec(AsBytes(status)),
+		};
+
+		CacheResponse(vec);
+	}
+
+	if (!HasId()) {
+		const struct iovec vec[] = {
+			MakeIovec(AsBytes(status)),
+		};
+
+		SendResponse(vec, fd, fd2);
+		return;
+	}
+
+	const EntitySerializer::HeaderView extra_headers[] = {
+		{request_id_header, id},
+	};
+
+	const EntitySerializer s{status, {}, no_headers, {}, &*arena, extra_headers};
+	SendResponse(s.GetVector(), fd, fd2);
+}
+
+void
+PassageRequest::SendResponse(const Entity &response)
+{
+	if (cache_hint.IsDefined())
+		CacheResponse(EntitySerializer{response, &*arena}.GetVector());
+
+	const EntitySerializer::HeaderView extra_headers[] = {
+		{request_id_header, id},
+	};
+
+	const EntitySerializer s{
+		response, &*arena,
+		std::span{extra_headers}.first(HasId() ? 1 : 0),
+	};
+
+	SendResponse(s.GetVector(),
+		     FileDescriptor::Undefined(), FileDescriptor::Undefined());
+}
+
+void
+PassageRequest::SendError(std::string_view message, const HeaderMap &headers)
+{
+	/* serialize directly instead of copying everything into an
+	   Entity */
+	const std::span<const std::string_view> args{&message, message.empty() ? 0U : 1U};
+
+	if (cache_hint.IsDefined())
+		CacheResponse(EntitySerializer{"ERROR"sv, args, headers, {}, &*arena}.GetVector());
+
+	const EntitySerializer::HeaderView extra_headers[] = {
+		{request_id_header, id},
+	};
+
+	const EntitySerializer s{
+		"ERROR"sv, args, headers, {}, &*arena,
+		std::span{extra_headers}.first(HasId() ? 1 : 0),
+	};
+
+	SendResponse(s.GetVector(),
+		     FileDescriptor::Undefined(), FileDescriptor::Undefined());
+}
+
+inline void
+PassageRequest::SendError(const ErrorAction &action)
+{
+	SendError(action.message, action.response_headers);
+}
+
+void
+PassageRequest::CacheResponse(std::span<const struct iovec> vec) noexcept
+try {
+	assert(cache_hint.IsDefined());
+
+	std::string response;
+	for (const auto &i : vec)
+		response.append(static_cast<const char *>(i.iov_base), i.iov_len);
+
+	auto &instance = connection.GetInstance();
+	if (instance.GetResponseCache().Put(cache_key, cache_hint,
+					    connection.GetPeerAuth(),
+					    response))
+		++instance.GetStats().response_cache_stores;
+} catch (...) {
+	connection.GetLogger()(2, "Failed to cache response: ",
+			       std::current_exception());
+}
+
+inline void
+PassageRequest::OnResponseSent() noexcept
+{
+	connection.GetInstance().GetStats().AddRequest(arena->Reset());
+}
+
+#ifdef HAVE_CURL
+
+struct HttpRequest {
+	CurlEasy curl;
+	CurlSlist headers;
+};
+
+static HttpRequest
+ActionToHttpRequest(const HttpRequestAction &action, std::pmr::memory_resource &r)
+{
+	HttpRequest request{
+		.curl = CurlEasy{action.url.c_str()},
+	};
+
+	Curl::Setup(request.curl);
+	request.curl.SetFailOnError();
+
+	if (action.http_method != HttpMethod::UNDEFINED)
+		request.curl.SetOption(CURLOPT_CUSTOMREQUEST,
+				       http_method_to_string(action.http_method));
+
+	std::pmr::string line{&r};
+	for (const auto &[name, value] : action.request_headers) {
+		line.clear();
+		fmt::format_to(std::back_inserter(line), "{}: {}"sv, name, value);
+		request.headers.Append(line.c_str());
+	}
+
+	request.curl.SetRequestHeaders(request.headers.Get());
+
+	if (action.body)
+		request.curl.SetRequestBody(*action.body);
+
+	return request;
+}
+
+static Co::Task<Entity>
+DoHttpRequest(CurlGlobal &curl, const HttpRequestAction &action,
+	      std::pmr::memory_resource &r)
+{
+	auto response = co_await Curl::CoRequest(curl, ActionToHttpRequest(action, r).curl,
+						 {.max_size = action.max_size});
+
+	Entity entity{
+		.command = std::string{"OK"sv},
+		.body = std::move(response.body),
+	};
+
+	co_return entity;
+}
+
+#endif // HAVE_CURL
+
+Co::Task<void>
+PassageRequest::DoExec(const char *const*argv, const char *const*env,
+		       StdinOption stdin_option,
+		       StderrOption stderr_option, bool cgroup_client,
+		       std::string_view body)
+{
+	/* this must be done before the first suspension, while
+	   the body is still valid */
+	UniqueFileDescriptor stdin_pipe;
+	FileDescriptor stdin_fd = FileDescriptor::Undefined();
+	switch (stdin_option) {
+	case StdinOption::NONE:
+		break;
+
+	case StdinOption::BODY:
+		stdin_pipe = CreateStdinPipe(AsBytes(body));
+		stdin_fd = stdin_pipe;
+		break;
+
+	case StdinOption::FD:
+		if (!client_fd.IsDefined())
+			throw std::runtime_error("Client did not pass a file descriptor");
+
+		stdin_fd = client_fd;
+		break;
+	}
+
+	auto &instance = connection.GetInstance();
+	auto &limiter = instance.GetChildLimiter();
+
+	ChildSlot slot;
+	if (const auto limits = limiter.GetLimits(); limits.IsLimited()) {
+		auto &peer_auth = connection.GetPeerAuth();
+
+		ChildOwner owner{
+			.cgroup = {},
+			.uid = peer_auth.GetUid(),
+		};
+
+		try {
+			owner.cgroup = peer_auth.GetCgroupPath();
+		} catch (...) {
+			/* without a per-cgroup limit, an unknown
+			   cgroup doesn't matter */
+			if (limits.max_per_cgroup > 0)
+				throw;
+		}
+
+		slot = co_await CoChildSlot{
+			instance.GetEventLoop(), limiter, std::move(owner),
+			limits.queue_timeout, instance.GetStats(),
+		};
+
+		if (!slot.IsDefined()) {
+			/* this error is transient; don't cache it */
+			cache_hint = {};
+
+			const HeaderMap headers{
+				{"retry_after", fmt::format("{}"sv, limits.retry_after.count())},
+			};
+
+			SendError("Too many child processes"sv, headers);
+			co_return;
+		}
+	}
+
+	CgroupDirectoryPtr cgroup;
+	if (cgroup_client) {
+		const auto path = connection.GetPeerAuth().GetCgroupPath();
+		if (path.empty())
+			throw std::runtime_error("Client has no cgroup");
+
+		cgroup = instance.GetCgroupCache().Get(path);
+	}
+
+	const FileDescriptor cgroup_fd = cgroup
+		? FileDescriptor{*cgroup}
+		: FileDescriptor::Undefined();
+
+	auto result = co_await CoExecPipe(instance.GetSpawnClient(),
+					  argv[0], argv, env,
+					  stdin_fd, cgroup_fd, stderr_option);
+
+	/* the child has its own copies now */
+	stdin_pipe.Close();
+	client_fd.Close();
+
+	/* the slot remains occupied until the process exits */
+	if (slot.IsDefined())
+		instance.GetChildWatches().Add(std::move(result.pidfd),
+					       std::move(slot));
+
+	SendResponse("OK", result.stdout_pipe, result.stderr_pipe);
+}
+
+inline Co::Task<void>
+PassageRequest::DoExecPipe(const ExecPipeAction &action,
+			   std::string_view body)
+{
+	assert(action.exec.size() <= ExecPipeAction::MAX_EXEC);
+	assert(action.env.size() <= ExecPipeAction::MAX_ENV);
+
+	const char *argv[ExecPipeAction::MAX_EXEC + 1];
+	unsigned n = 0;
+	for (const auto &i : action.exec)
+		argv[n++] = i.c_str();
+	argv[n] = nullptr;
+
+	const char *env[ExecPipeAction::MAX_ENV + 1];
+	n = 0;
+	for (const auto &i : action.env)
+		env[n++] = i.c_str();
+
+	env[n] = nullptr;
+
+	co_await DoExec(argv, env, action.stdin, action.stderr,
+			action.cgroup_client, body);
+}
+
+inline Co::Task<void>
+PassageRequest::DoExecTemplate(const ExecTemplateAction &action,
+			       std::string_view body)
+{
+	const auto &t = *action.exec_template;
+
+	if (action.args.empty()) {
+		/* use the template's argument array as-is */
+		co_await DoExec(t.GetArgv(), t.GetEnv(),
+				t.GetStdinOption(), t.GetStderrOption(),
+				t.IsCgroupClient(), body);
+		co_return;
+	}
+
+	const auto template_args = t.GetArgs();
+	assert(template_args.size() + action.args.size() <= ExecPipeAction::MAX_EXEC);
+
+	const char *argv[ExecPipeAction::MAX_EXEC + 1];
+	auto *p = std::copy(template_args.begin(), template_args.end(), argv);
+	for (const auto &i : action.args)
+		*p++ = i.c_str();
+	*p = nullptr;
+
+	co_await DoExec(argv, t.GetEnv(),
+			t.GetStdinOption(), t.GetStderrOption(),
+			t.IsCgroupClient(), body);
+}
+
+Co::InvokeTask
+PassageRequest::Do(const Action &action, std::string_view body)
+{
+	assert(pending_response);
+
+	if (const auto *error = std::get_if<ErrorAction>(&action)) {
+		SendError(*error);
+	} else if (const auto *fade = std::get_if<FadeChildrenAction>(&action)) {
+		FadeChildren(fade->address,
+			     fade->tag.empty() ? nullptr : fade->tag.c_str());
+	} else if (const auto *flush = std::get_if<FlushHttpCacheAction>(&action)) {
+		FlushHttpCache(flush->address, flush->tag.c_str());
+	} else if (const auto *exec = std::get_if<ExecPipeAction>(&action)) {
+		co_await DoExecPipe(*exec, body);
+	} else if (const auto *tmpl = std::get_if<ExecTemplateAction>(&action)) {
+		co_await DoExecTemplate(*tmpl, body);
+#ifdef HAVE_CURL
+	} else if (const auto *http = std::get_if<HttpRequestAction>(&action)) {
+		SendResponse(co_await DoHttpRequest(connection.GetInstance().GetCurl(),
+						    *http, *arena));
+#endif // HAVE_CURL
+	} else
+		std::unreachable();
+
+	co_return;
+}
+
+void
+PassageRequest::OnLuaFinished(lua_State *L) noexcept
+try {
+	assert(!invoke_task);
+
+	budget_timer.Cancel();
+
+	assert(lua_request != nullptr);
+
+	if (const auto &hint = GetLuaRequestCacheHint(*lua_request);
+	    hint.IsDefined()) {
+		cache_key = ResponseCache::MakeRequestKey(connection.GetHandlerIndex(),
+							  *lua_request);
+		cache_hint = hint;
+	}
+
+	/* the action remains on the thread's stack until the
+	   thread is released by our destructor */
+	const Action *action = nullptr;
+
+	{
+		/* this scope must end before Destroy() is called
+		   (maybe indirectly by a synchronous Do()), because
+		   releasing the thread clears its stack */
+		const Lua::ScopeCheckStack check_thread_stack(L);
+
+		if (!lua_isnil(L, -1)) {
+			action = CheckLuaAction(L, -1);
+			if (action == nullptr)
+				throw std::runtime_error("Wrong return type from Lua handler");
+		}
+	}
+
+	if (action != nullptr) {
+		invoke_task = Do(*action, lua_request->body);
+		invoke_task.Start(BIND_THIS_METHOD(OnCoComplete));
+	} else {
+		SendResponse("OK");
+		Destroy();
+	}
+} catch (...) {
+	OnLuaError(L, std::current_exception());
+}
+
+void
+PassageRequest::OnLuaError(lua_State *, std::exception_ptr &&error) noexcept
+try {
+	assert(!invoke_task);
+
+	budget_timer.Cancel();
+
+	/* never cache error responses caused by a failure */
+	cache_hint = {};
+
+	connection.GetLogger()(1, std::move(error));
+
+	if (pending_response)
+		SendResponse("ERROR");
+
+	Destroy();
+} catch (...) {
+	Abort(std::current_exception());
+}
+
+void
+PassageRequest::OnCoComplete(std::exception_ptr &&error) noexcept
+try {
+	if (error) {
+		cache_hint = {};
+
+		connection.GetLogger()(1, std::move(error));
+
+		if (pending_response)
+			SendResponse("ERROR");
+	} else {
+		if (pending_response)
+			SendResponse("OK");
+	}
+
+	Destroy();
+} catch (...) {
+	Abort(std::current_exception());
+}
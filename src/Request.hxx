@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Arena.hxx"
+#include "LThreadPool.hxx"
+#include "ResponseCache.hxx"
+#include "lua/Resume.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "co/InvokeTask.hxx"
+#include "co/Task.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+struct iovec;
+
+struct Action;
+struct ErrorAction;
+struct ExecPipeAction;
+struct ExecTemplateAction;
+enum class StdinOption : uint_least8_t;
+enum class StderrOption : uint_least8_t;
+struct Entity;
+struct EntityView;
+class HeaderMap;
+class PassageConnection;
+namespace Lua { class Value; }
+
+/**
+ * One request received on a #PassageConnection.  It runs the Lua
+ * handler in its own coroutine and then performs the returned action;
+ * after the response has been sent, it destroys itself.
+ *
+ * Several requests may be in flight at the same time on one
+ * connection if the client tags them with a "request_id" header;
+ * each response then carries the "request_id" of its request.
+ */
+class PassageRequest final
+	: public AutoUnlinkIntrusiveListHook,
+	  Lua::ResumeListener
+{
+	PassageConnection &connection;
+
+	/**
+	 * The value of the "request_id" header (empty if the client
+	 * did not send one).
+	 */
+	const std::string id;
+
+	LuaThreadPool &thread_pool;
+
+	/**
+	 * The file descriptor passed by the client with this request
+	 * (or undefined); it may become a child's stdin (see
+	 * #StdinOption::FD).
+	 */
+	UniqueFileDescriptor client_fd;
+
+	/**
+	 * Allocator for C++ objects needed while handling this
+	 * request.  It is borrowed from the thread's
+	 * #RequestArenaPool, so its buffer is not allocated for
+	 * each request.  This is declared before #invoke_task so it
+	 * outlives the coroutine frame.
+	 */
+	RequestArenaPool::Lease arena;
+
+	/**
+	 * The Lua thread which runs the handler coroutine (borrowed
+	 * from #thread_pool).
+	 */
+	LuaThreadPool::Thread thread;
+
+	Co::InvokeTask invoke_task;
+
+	/**
+	 * Aborts the handler when its time budget expires while it
+	 * waits for an asynchronous operation (see
+	 * HandlerBudget::Begin()).
+	 */
+	CoarseTimerEvent budget_timer;
+
+	/**
+	 * The request object passed to the Lua handler (owned by the
+	 * Lua state); nullptr if Prepare() was not called.
+	 */
+	const EntityView *lua_request = nullptr;
+
+	/**
+	 * The #ResponseCache key of this request; only set if
+	 * #cache_hint is defined.
+	 */
+	std::string cache_key;
+
+	/**
+	 * If defined, then the response will be stored in the
+	 * #ResponseCache; see request:cache_response().
+	 */
+	ResponseCacheHint cache_hint;
+
+	bool pending_response = true;
+
+public:
+	PassageRequest(PassageConnection &_connection,
+		       LuaThreadPool &_thread_pool,
+		       std::string_view _id,
+		       UniqueFileDescriptor &&_client_fd);
+	~PassageRequest() noexcept;
+
+	PassageRequest(const PassageRequest &) = delete;
+	PassageRequest &operator=(const PassageRequest &) = delete;
+
+	bool HasId() const noexcept {
+		return !id.empty();
+	}
+
+	std::string_view GetId() const noexcept {
+		return id;
+	}
+
+	/**
+	 * Prepare the invocation of the Lua handler: push the handler
+	 * function and a new request object (with a copy of the
+	 * payload) on a Lua thread.  Errors are reported to the
+	 * client.
+	 *
+	 * @param payload the raw request payload
+	 * @param request the parsed request (pointing into @p payload)
+	 * @return false on error, in which case this object has been
+	 * destroyed (and maybe the connection, too)
+	 */
+	bool Prepare(const Lua::Value &handler, std::string_view payload,
+		     const EntityView &request) noexcept;
+
+	/**
+	 * Perform the given action without invoking a Lua handler.
+	 * The action must remain valid until this object is
+	 * destroyed.  This object (and maybe the connection) may be
+	 * destroyed before this method returns.
+	 *
+	 * @param body the request body; it needs to be valid only
+	 * during this call
+	 */
+	void Run(const Action &action, std::string_view body) noexcept;
+
+	/**
+	 * Respond with an error without invoking a Lua handler, and
+	 * destroy this object.
+	 */
+	void Reject(std::string_view message) noexcept;
+
+	/**
+	 * Invoke the Lua handler prepared by Prepare().  Errors are
+	 * reported to the client.  This object (and maybe the
+	 * connection) may be destroyed before this method returns.
+	 */
+	void Resume() noexcept;
+
+private:
+	void Destroy() noexcept {
+		delete this;
+	}
+
+	/**
+	 * Something has gone wrong on the connection; close it (and
+	 * destroy this object).
+	 */
+	void Abort(std::exception_ptr &&error) noexcept;
+
+	/**
+	 * Create the error for a handler which has exceeded its time
+	 * budget (and count it).
+	 */
+	std::exception_ptr MakeBudgetError() noexcept;
+
+	void OnBudgetTimeout() noexcept;
+
+	/**
+	 * Launch a process (see ExecPipe()) and send the pipe to
+	 * the client.
+	 *
+	 * @param argv the nullptr-terminated program path and
+	 * arguments
+	 * @param env the nullptr-terminated environment
+	 * @param body the request body; it is only accessed before
+	 * the coroutine suspends for the first time
+	 */
+	Co::Task<void> DoExec(const char *const*argv, const char *const*env,
+			      StdinOption stdin_option,
+			      StderrOption stderr_option, bool cgroup_client,
+			      std::string_view body);
+
+	Co::Task<void> DoExecPipe(const ExecPipeAction &action,
+				  std::string_view body);
+	Co::Task<void> DoExecTemplate(const ExecTemplateAction &action,
+				      std::string_view body);
+	Co::InvokeTask Do(const Action &action, std::string_view body);
+
+	/**
+	 * Send a response datagram consisting of the given buffers,
+	 * optionally with file descriptors (SCM_RIGHTS), with one
+	 * sendmsg() call.
+	 */
+	void SendResponse(std::span<const struct iovec> vec,
+			  FileDescriptor fd, FileDescriptor fd2);
+
+	void SendResponse(std::string_view status,
+			  FileDescriptor fd=FileDescriptor::Undefined(),
+			  FileDescriptor fd2=FileDescriptor::Undefined());
+
+	/**
+	 * Send the serialized #Entity directly from its storage
+	 * without copying it into a contiguous buffer first.
+	 */
+	void SendResponse(const Entity &response);
+	void SendError(std::string_view message, const HeaderMap &headers);
+	void SendError(const ErrorAction &action);
+
+	/**
+	 * Store a response (serialized without "request_id") in the
+	 * #ResponseCache.  Errors are logged.
+	 */
+	void CacheResponse(std::span<const struct iovec> vec) noexcept;
+
+	/**
+	 * The response to this request has been sent; update the
+	 * statistics.
+	 */
+	void OnResponseSent() noexcept;
+
+	void OnCoComplete(std::exception_ptr &&error) noexcept;
+
+	/* virtual methods from class Lua::ResumeListener */
+	void OnLuaFinished(lua_State *L) noexcept override;
+	void OnLuaError(lua_State *L, std::exception_ptr &&error) noexcept override;
+};
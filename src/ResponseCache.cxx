@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ResponseCache.hxx"
+#include "EntityView.hxx"
+#include "PeerAuth.hxx"
+
+#include <fmt/format.h>
+
+#include <iterator> // for std::back_inserter()
+
+/**
+ * Append the client's scope value to the key.
+ *
+ * @return false if the client does not have this property
+ */
+static bool
+AppendScope(std::string &key, ResponseCacheScope scope,
+	    const PeerAuth &peer_auth)
+{
+	key.push_back('\0');
+	key.push_back(static_cast<char>(scope));
+
+	switch (scope) {
+	case ResponseCacheScope::UID:
+		if (!peer_auth.HaveCred())
+			return false;
+
+		fmt::format_to(std::back_inserter(key), "{}", peer_auth.GetUid());
+		return true;
+
+	case ResponseCacheScope::CGROUP:
+		{
+			const auto path = peer_auth.GetCgroupPath();
+			if (path.empty())
+				return false;
+
+			key.append(path);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+std::string
+ResponseCache::MakeRequestKey(std::size_t handler_index,
+			      const EntityView &request)
+{
+	std::string key;
+	key.reserve(request.command.size() + request.args.size() +
+		    request.body.size() + 16);
+
+	key.append(request.command);
+
+	if (!request.args.empty()) {
+		key.push_back(' ');
+		key.append(request.args);
+	}
+
+	key.push_back('\0');
+	key.append(request.body);
+	key.push_back('\0');
+	fmt::format_to(std::back_inserter(key), "{}", handler_index);
+
+	return key;
+}
+
+std::string
+ResponseCache::Get(std::string_view request_key,
+		   const PeerAuth &peer_auth)
+{
+	const auto now = LruCache::Clock::now();
+
+	ResponseCacheScope scope;
+
+	{
+		const std::scoped_lock lock{mutex};
+		const auto *value = cache.Get(request_key, now);
+		if (value == nullptr || value->size() != 1)
+			return {};
+
+		scope = static_cast<ResponseCacheScope>(value->front());
+	}
+
+	/* determine the scope value without holding the lock
+	   because this may need to read from /proc */
+	std::string key{request_key};
+	if (!AppendScope(key, scope, peer_auth))
+		return {};
+
+	const std::scoped_lock lock{mutex};
+	const auto *value = cache.Get(key, now);
+	return value != nullptr ? *value : std::string{};
+}
+
+bool
+ResponseCache::Put(std::string_view request_key,
+		   const ResponseCacheHint &hint,
+		   const PeerAuth &peer_auth,
+		   std::string_view response)
+{
+	std::string key{request_key};
+	if (!AppendScope(key, hint.scope, peer_auth))
+		return false;
+
+	const auto expires = LruCache::Clock::now() + hint.ttl;
+	const char scope = static_cast<char>(hint.scope);
+
+	const std::scoped_lock lock{mutex};
+	cache.Set(request_key, {&scope, 1}, expires);
+	cache.Set(key, response, expires);
+
+	used.store(true, std::memory_order_relaxed);
+	return true;
+}
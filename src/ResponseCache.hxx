@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "LruCache.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+struct EntityView;
+class PeerAuth;
+
+/**
+ * Which property of the client is part of the key of a cached
+ * response (in addition to the request itself).
+ */
+enum class ResponseCacheScope : char {
+	UID = 'u',
+	CGROUP = 'c',
+};
+
+/**
+ * Set by the Lua handler (request:cache_response()) to declare that
+ * the response may be cached.
+ */
+struct ResponseCacheHint {
+	/**
+	 * Zero means the response is not cacheable.
+	 */
+	std::chrono::steady_clock::duration ttl{};
+
+	ResponseCacheScope scope = ResponseCacheScope::UID;
+
+	constexpr bool IsDefined() const noexcept {
+		return ttl.count() > 0;
+	}
+};
+
+/**
+ * Serialized responses of cacheable requests, shared by all threads.
+ * A cached response is sent without invoking the Lua handler.
+ *
+ * The key of a response consists of the command, the raw argument
+ * list, the body, the handler (i.e. the passage_listen() call) and
+ * the client's uid or cgroup.  Since the scope is only known after
+ * the handler has run, each request key has an additional item
+ * which stores the scope of its responses.
+ */
+class ResponseCache {
+	static constexpr std::size_t MAX_SIZE = 16 * 1024 * 1024;
+
+	std::mutex mutex;
+
+	LruCache cache{MAX_SIZE};
+
+	/**
+	 * Has anything ever been stored?  This allows skipping the
+	 * key calculation for all requests as long as no handler uses
+	 * this cache.
+	 */
+	std::atomic_bool used{false};
+
+public:
+	ResponseCache() = default;
+
+	ResponseCache(const ResponseCache &) = delete;
+	ResponseCache &operator=(const ResponseCache &) = delete;
+
+	bool IsUsed() const noexcept {
+		return used.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Build the part of the key which is derived from the request
+	 * (but not from the client).  Its beginning is the command
+	 * and the raw argument list, which is what Invalidate()
+	 * matches.
+	 */
+	static std::string MakeRequestKey(std::size_t handler_index,
+					  const EntityView &request);
+
+	/**
+	 * Look up a cached response.
+	 *
+	 * Throws if the client's cgroup cannot be determined.
+	 *
+	 * @return the serialized response (without "request_id") or
+	 * an empty string if there is none
+	 */
+	std::string Get(std::string_view request_key,
+			const PeerAuth &peer_auth);
+
+	/**
+	 * Store a serialized response (without "request_id").
+	 *
+	 * Throws if the client's cgroup cannot be determined.
+	 *
+	 * @return false if the response was not stored because the
+	 * client does not have the property selected by the scope
+	 */
+	bool Put(std::string_view request_key,
+		 const ResponseCacheHint &hint,
+		 const PeerAuth &peer_auth,
+		 std::string_view response);
+
+	/**
+	 * Remove all responses to requests whose command and
+	 * arguments start with the given prefix.
+	 */
+	void Invalidate(std::string_view prefix) noexcept {
+		const std::scoped_lock lock{mutex};
+		cache.RemovePrefix(prefix);
+	}
+
+	void Clear() noexcept {
+		const std::scoped_lock lock{mutex};
+		cache.Clear();
+	}
+};
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Rule.hxx"
+#include "PeerAuth.hxx"
+
+/**
+ * Is the cgroup @p path equal to @p prefix or below it?
+ */
+[[gnu::pure]]
+static bool
+IsCgroupBelow(std::string_view path, std::string_view prefix) noexcept
+{
+	if (!prefix.empty() && prefix.back() == '/')
+		prefix.remove_suffix(1);
+
+	if (!path.starts_with(prefix))
+		return false;
+
+	/* don't let "/foo" match "/foobar" */
+	path.remove_prefix(prefix.size());
+	return path.empty() || path.front() == '/';
+}
+
+bool
+Rule::Match(std::string_view _command,
+	    const PeerAuth &auth) const
+{
+	if (!command.empty() && command != _command)
+		return false;
+
+	if (uid || gid) {
+		if (!auth.HaveCred())
+			return false;
+
+		if (uid && auth.GetUid() != *uid)
+			return false;
+
+		if (gid && auth.GetGid() != *gid)
+			return false;
+	}
+
+	if (!cgroup.empty()) {
+		const auto path = auth.GetCgroupPath();
+		if (path.empty() || !IsCgroupBelow(path, cgroup))
+			return false;
+	}
+
+	return true;
+}
+
+const Rule *
+RuleSet::Find(std::string_view command,
+	      const PeerAuth &auth) const noexcept
+{
+	for (const auto &i : rules) {
+		try {
+			if (i.Match(command, auth))
+				return &i;
+		} catch (...) {
+			/* the client's cgroup cannot be determined
+			   (e.g. because the client has exited
+			   already); this rule does not match, and
+			   the Lua handler may still decide */
+		}
+	}
+
+	return nullptr;
+}
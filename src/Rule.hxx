@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Action.hxx"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h> // for uid_t, gid_t
+
+class PeerAuth;
+
+/**
+ * A static rule registered with passage_rule().  If a request
+ * matches, its (prebuilt) action is performed without invoking Lua.
+ */
+struct Rule {
+	/**
+	 * The command which must match exactly (empty matches all
+	 * commands).
+	 */
+	std::string command;
+
+	std::optional<uid_t> uid;
+	std::optional<gid_t> gid;
+
+	/**
+	 * The client's cgroup must be this one or below it (empty
+	 * matches all clients).
+	 */
+	std::string cgroup;
+
+	Action action;
+
+	/**
+	 * Throws if the client's cgroup cannot be determined.
+	 */
+	bool Match(std::string_view _command,
+		   const PeerAuth &auth) const;
+};
+
+/**
+ * An ordered list of #Rule objects; the first matching rule wins.
+ */
+class RuleSet {
+	std::vector<Rule> rules;
+
+public:
+	bool empty() const noexcept {
+		return rules.empty();
+	}
+
+	void Add(Rule &&rule) {
+		rules.emplace_back(std::move(rule));
+	}
+
+	/**
+	 * A rule which needs the client's cgroup does not match if
+	 * it cannot be determined.
+	 *
+	 * @return the first rule matching the request or nullptr if
+	 * the request shall be passed to the Lua handler
+	 */
+	const Rule *Find(std::string_view command,
+			 const PeerAuth &auth) const noexcept;
+};
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Verify.hxx"
+
+#include <array>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Character class bits for #char_classes.
+ */
+enum CharClass : uint_least8_t {
+	CHAR_COMMAND = 0x1,
+	CHAR_UNQUOTED = 0x2,
+	CHAR_PRINTABLE = 0x4,
+
+	/**
+	 * Whitespace (or another control character) which is skipped
+	 * before parameters and header values.  This does not include
+	 * #CHAR_LINE_END.
+	 */
+	CHAR_WHITESPACE = 0x8,
+
+	/**
+	 * A character which terminates a line: newline or the null
+	 * byte (which separates the body).
+	 */
+	CHAR_LINE_END = 0x10,
+
+	/**
+	 * A character which needs special treatment inside a quoted
+	 * parameter: the double quote, the backslash and #CHAR_LINE_END.
+	 */
+	CHAR_QUOTE_SPECIAL = 0x20,
+};
+
+/**
+ * A lookup table which classifies all characters in one step.  It is
+ * generated from the predicates in Verify.hxx, so the scanner cannot
+ * disagree with them.
+ */
+inline constexpr auto char_classes = []{
+	std::array<uint_least8_t, 256> t{};
+
+	for (unsigned i = 0; i < t.size(); ++i) {
+		const char ch = static_cast<char>(i);
+
+		if (IsValidCommandChar(ch))
+			t[i] |= CHAR_COMMAND;
+		if (IsValidUnquotedParameterChar(ch))
+			t[i] |= CHAR_UNQUOTED;
+		if (IsPrintableASCII(ch))
+			t[i] |= CHAR_PRINTABLE;
+		if (ch == '\n' || ch == '\0')
+			t[i] |= CHAR_LINE_END|CHAR_QUOTE_SPECIAL;
+		else if (IsWhitespaceOrNull(ch))
+			t[i] |= CHAR_WHITESPACE;
+		if (ch == '"' || ch == '\\')
+			t[i] |= CHAR_QUOTE_SPECIAL;
+	}
+
+	return t;
+}();
+
+[[gnu::const]]
+constexpr bool
+HasCharClass(char ch, uint_least8_t mask) noexcept
+{
+	return char_classes[static_cast<unsigned char>(ch)] & mask;
+}
+
+/**
+ * Skip all characters of the given class.
+ *
+ * @return a pointer to the first character not in this class or @p
+ * end
+ */
+[[gnu::pure]]
+constexpr const char *
+SkipCharClass(const char *p, const char *end, uint_least8_t mask) noexcept
+{
+	while (p < end && HasCharClass(*p, mask))
+		++p;
+	return p;
+}
+
+/**
+ * Skip all printable characters.  This is the scanner's inner loop
+ * for header values and quoted parameters, which are the longest
+ * runs in a request.
+ *
+ * On SSE2, 16 bytes are checked at a time; bytes outside the range
+ * 0x20..0x7e stop the vector loop and are then classified by the
+ * lookup table, so the result is always identical to the scalar
+ * version.
+ */
+[[gnu::pure]]
+inline const char *
+SkipPrintable(const char *p, const char *end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i low = _mm_set1_epi8(0x20);
+	const __m128i del = _mm_set1_epi8(0x7f);
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+
+		/* signed comparison: this catches 0x00..0x1f and
+		   0x80..0xff */
+		const __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, low),
+						     _mm_cmpeq_epi8(v, del));
+		const unsigned mask = _mm_movemask_epi8(special);
+		if (mask == 0) {
+			p += 16;
+			continue;
+		}
+
+		p += __builtin_ctz(mask);
+		if (!HasCharClass(*p, CHAR_PRINTABLE))
+			return p;
+
+		++p;
+	}
+#endif
+
+	return SkipCharClass(p, end, CHAR_PRINTABLE);
+}
+
+/**
+ * Find the next character inside a quoted parameter which needs
+ * special treatment (see #CHAR_QUOTE_SPECIAL).
+ */
+[[gnu::pure]]
+inline const char *
+FindQuoteSpecial(const char *p, const char *end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		const __m128i special =
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+						  _mm_cmpeq_epi8(v, backslash)),
+				     _mm_or_si128(_mm_cmpeq_epi8(v, newline),
+						  _mm_cmpeq_epi8(v, zero)));
+		const unsigned mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && !HasCharClass(*p, CHAR_QUOTE_SPECIAL))
+		++p;
+	return p;
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "ChildLimiter.hxx"
+#include "CgroupCache.hxx"
+#include "PeerAuthCache.hxx"
+#include "ResponseCache.hxx"
+
+/**
+ * Caches (and other state) which are shared by all threads.  They
+ * are owned by #Instance.
+ */
+struct SharedCaches {
+	ResponseCache response;
+
+	/**
+	 * Its inotify events are handled by the main thread.
+	 */
+	CgroupCache cgroup;
+
+	PeerAuthCache peer_auth;
+
+	ChildLimiter child_limiter;
+
+	SharedCaches(EventLoop &event_loop, const RootLogger &logger)
+		:cgroup(event_loop, logger) {}
+};
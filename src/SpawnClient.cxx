@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "SpawnClient.hxx"
+#include "SpawnProtocol.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "io/Iovec.hxx"
+#include "net/ScmRightsBuilder.hxx"
+#include "net/SendMessage.hxx"
+#include "net/SocketError.hxx"
+#include "system/Error.hxx"
+#include "util/SpanCast.hxx"
+
+#include <cerrno>
+#include <cstring> // for std::memcpy(), std::strerror()
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <sys/socket.h>
+
+static void
+AppendStrings(std::string &dest, const char *const*src, uint32_t &n)
+{
+	for (; *src != nullptr; ++src, ++n) {
+		dest.append(*src);
+		dest.push_back('\0');
+	}
+}
+
+SpawnRequest::SpawnRequest(const char *path, const char *const*args,
+			   const char *const*env,
+			   FileDescriptor _stdin_fd,
+			   FileDescriptor _stdout_fd, FileDescriptor _stderr_fd,
+			   FileDescriptor _cgroup)
+	:stdin_fd(_stdin_fd), stdout_fd(_stdout_fd), stderr_fd(_stderr_fd),
+	 cgroup(_cgroup)
+{
+	SpawnRequestHeader header{};
+
+	payload.append(sizeof(header), '\0');
+	payload.append(path);
+	payload.push_back('\0');
+	AppendStrings(payload, args, header.n_args);
+	AppendStrings(payload, env, header.n_env);
+
+	if (payload.size() > SPAWN_MAX_REQUEST)
+		throw std::runtime_error{"Spawn request too large"};
+
+	if (stdin_fd.IsDefined())
+		header.flags |= SPAWN_STDIN;
+	if (stderr_fd.IsDefined())
+		header.flags |= SPAWN_STDERR;
+	if (cgroup.IsDefined())
+		header.flags |= SPAWN_CGROUP;
+
+	std::memcpy(payload.data(), &header, sizeof(header));
+
+	int sv[2];
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0)
+		throw MakeSocketError("Failed to create socket pair");
+
+	response_socket = UniqueSocketDescriptor{AdoptTag{}, sv[0]};
+	remote_socket = UniqueSocketDescriptor{AdoptTag{}, sv[1]};
+}
+
+void
+SpawnRequest::Send(SocketDescriptor spawner, int flags)
+{
+	const struct iovec vec[] = {
+		MakeIovec(AsBytes(payload)),
+	};
+
+	MessageHeader m{vec};
+
+	ScmRightsBuilder<5> rb(m);
+	rb.push_back(remote_socket.Get());
+	rb.push_back(stdout_fd.Get());
+	if (stdin_fd.IsDefined())
+		rb.push_back(stdin_fd.Get());
+	if (stderr_fd.IsDefined())
+		rb.push_back(stderr_fd.Get());
+	if (cgroup.IsDefined())
+		rb.push_back(cgroup.Get());
+	rb.Finish(m);
+
+	SendMessage(spawner, m, flags|MSG_NOSIGNAL);
+
+	/* the spawner owns the only other reference now; if it
+	   dies, the response socket reports end-of-file */
+	remote_socket.Close();
+}
+
+int
+SpawnRequest::TrySend(SocketDescriptor spawner) noexcept
+try {
+	Send(spawner, MSG_DONTWAIT);
+	return 0;
+} catch (const std::system_error &e) {
+	return e.code().value();
+}
+
+UniqueSocketDescriptor
+SendSpawnRequest(SocketDescriptor spawner,
+		 const char *path, const char *const*args,
+		 const char *const*env,
+		 FileDescriptor stdin_fd,
+		 FileDescriptor stdout_fd, FileDescriptor stderr_fd,
+		 FileDescriptor cgroup)
+{
+	SpawnRequest request{path, args, env, stdin_fd, stdout_fd, stderr_fd, cgroup};
+	request.Send(spawner, 0);
+	return std::move(request.response_socket);
+}
+
+std::optional<SpawnResponse>
+ReceiveSpawnResponse(SocketDescriptor s)
+{
+	int error;
+	struct iovec iov{&error, sizeof(error)};
+	struct msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	alignas(struct cmsghdr) std::byte control[CMSG_SPACE(2 * sizeof(int))];
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	const auto nbytes = recvmsg(s.Get(), &msg, MSG_CMSG_CLOEXEC);
+	if (nbytes < 0) {
+		if (errno == ECONNRESET)
+			return std::nullopt;
+
+		throw MakeSocketError("Failed to receive from the spawner");
+	}
+
+	if (nbytes == 0)
+		/* the spawner has closed the socket without
+		   responding */
+		return std::nullopt;
+
+	SpawnResponse response{.error = error, .pidfd = {}, .exec_pipe = {}};
+
+	if (const auto *cmsg = CMSG_FIRSTHDR(&msg);
+	    cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS &&
+	    cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+		int fds[2];
+		std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+		response.pidfd = UniqueFileDescriptor{AdoptTag{}, fds[0]};
+		response.exec_pipe = UniqueFileDescriptor{AdoptTag{}, fds[1]};
+	}
+
+	if (nbytes != sizeof(error) ||
+	    (error == 0 && !response.exec_pipe.IsDefined()))
+		throw std::runtime_error{"Malformed response from the spawner"};
+
+	return response;
+}
+
+void
+CheckSpawnExec(FileDescriptor exec_pipe, const char *path)
+{
+	int error;
+	ssize_t nbytes;
+	do {
+		nbytes = exec_pipe.Read(std::as_writable_bytes(std::span{&error, 1}));
+	} while (nbytes < 0 && errno == EINTR);
+
+	if (nbytes < 0)
+		throw MakeErrno("Failed to read from the spawner's pipe");
+
+	if (nbytes == sizeof(error))
+		/* execve() has failed; the child has exited already
+		   and is reaped by the spawner */
+		throw FmtErrno(error, "Failed to execute {:?}", path);
+
+	/* end-of-file: execve() has succeeded */
+}
+
+void
+SpawnClient::Disable(const char *reason) noexcept
+{
+	if (!enabled)
+		return;
+
+	logger(1, "Disabling the spawner, using posix_spawn(): ", reason);
+
+	enabled = false;
+	event.Cancel();
+
+	/* wake up all waiters; they will see that we're disabled
+	   now */
+	while (!waiters.empty()) {
+		auto &w = waiters.front();
+		waiters.pop_front();
+		w.Resume();
+	}
+}
+
+Co::Task<bool>
+SpawnClient::Send(SpawnRequest &request)
+{
+	while (enabled) {
+		switch (const int e = request.TrySend(socket)) {
+		case 0:
+			co_return true;
+
+		case EAGAIN:
+			/* the spawner is busy; wait until its socket
+			   has room for this request */
+			co_await WriteAwaitable{*this};
+			break;
+
+		case EMSGSIZE:
+		case ENOMEM:
+		case ENOBUFS:
+			/* this request doesn't fit, but the spawner
+			   is fine */
+			co_return false;
+
+		default:
+			Disable(std::strerror(e));
+			co_return false;
+		}
+	}
+
+	co_return false;
+}
+
+void
+SpawnClient::OnSocketReady(unsigned events) noexcept
+{
+	if (events & (SocketEvent::ERROR|SocketEvent::HANGUP)) {
+		Disable("Spawner socket has failed");
+		return;
+	}
+
+	if (waiters.empty()) {
+		event.CancelWrite();
+		return;
+	}
+
+	/* resume one waiter at a time; if there are more, the
+	   (level-triggered) event fires again as long as the socket
+	   is writable */
+	auto &w = waiters.front();
+	waiters.pop_front();
+	if (waiters.empty())
+		event.CancelWrite();
+	w.Resume();
+}
@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "event/PipeEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "io/Logger.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "co/Task.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <coroutine>
+#include <optional>
+#include <string>
+
+/**
+ * A serialized request to the spawner process (see StartSpawner()).
+ * The file descriptors passed to the constructor must remain valid
+ * until the request has been sent.
+ */
+class SpawnRequest {
+	std::string payload;
+
+	/**
+	 * The peer of #response_socket, which is passed to the
+	 * spawner.
+	 */
+	UniqueSocketDescriptor remote_socket;
+
+	FileDescriptor stdin_fd, stdout_fd, stderr_fd, cgroup;
+
+public:
+	/**
+	 * The socket on which the response will be received.
+	 */
+	UniqueSocketDescriptor response_socket;
+
+	/**
+	 * Throws on error.
+	 *
+	 * @param args a nullptr-terminated list of command-line
+	 * arguments
+	 * @param env a nullptr-terminated list of environment
+	 * variables
+	 * @param stdin_fd the child's stdin (or undefined to inherit
+	 * the spawner's stdin)
+	 * @param stdout_fd the child's stdout
+	 * @param stderr_fd the child's stderr (or undefined to
+	 * inherit the spawner's stderr)
+	 * @param cgroup a cgroup directory to create the child in (or
+	 * undefined)
+	 */
+	SpawnRequest(const char *path, const char *const*args,
+		     const char *const*env,
+		     FileDescriptor stdin_fd,
+		     FileDescriptor stdout_fd, FileDescriptor stderr_fd,
+		     FileDescriptor cgroup);
+
+	/**
+	 * Send the request without blocking.
+	 *
+	 * @return 0 on success or an errno value
+	 */
+	int TrySend(SocketDescriptor spawner) noexcept;
+
+	/**
+	 * Send the request.  Throws on error.
+	 */
+	void Send(SocketDescriptor spawner, int flags);
+};
+
+/**
+ * Send a request to the spawner process, blocking if its socket is
+ * full.
+ *
+ * Throws on error.
+ *
+ * @return the socket on which the response will be received
+ */
+UniqueSocketDescriptor
+SendSpawnRequest(SocketDescriptor spawner,
+		 const char *path, const char *const*args,
+		 const char *const*env,
+		 FileDescriptor stdin_fd,
+		 FileDescriptor stdout_fd, FileDescriptor stderr_fd,
+		 FileDescriptor cgroup);
+
+struct SpawnResponse {
+	/**
+	 * 0 on success or the errno value of a failed clone3() call.
+	 */
+	int error;
+
+	/**
+	 * The pidfd of the new process.
+	 */
+	UniqueFileDescriptor pidfd;
+
+	/**
+	 * Reports the result of execve(); see CheckSpawnExec().
+	 */
+	UniqueFileDescriptor exec_pipe;
+};
+
+/**
+ * Receive the response to a request.  This blocks until the response
+ * is available.
+ *
+ * Throws on error.
+ *
+ * @return the response or nullopt if the spawner has closed the
+ * socket without responding (i.e. it has died)
+ */
+std::optional<SpawnResponse>
+ReceiveSpawnResponse(SocketDescriptor s);
+
+/**
+ * Read the result of execve() from SpawnResponse::exec_pipe.  This
+ * blocks until the new process has executed the program or has
+ * failed to do so.
+ *
+ * Throws if execve() has failed.
+ */
+void
+CheckSpawnExec(FileDescriptor exec_pipe, const char *path);
+
+/**
+ * Wait for the response to a request without blocking the
+ * #EventLoop.  The result of co_await is the result of
+ * ReceiveSpawnResponse().
+ */
+class CoSpawnResponse final {
+	UniqueSocketDescriptor socket;
+
+	SocketEvent event;
+
+	std::coroutine_handle<> continuation;
+
+public:
+	CoSpawnResponse(EventLoop &event_loop,
+			UniqueSocketDescriptor &&_socket) noexcept
+		:socket(std::move(_socket)),
+		 event(event_loop, BIND_THIS_METHOD(OnSocketReady), socket) {}
+
+	CoSpawnResponse(const CoSpawnResponse &) = delete;
+	CoSpawnResponse &operator=(const CoSpawnResponse &) = delete;
+
+	bool await_ready() const noexcept {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> _continuation) noexcept {
+		continuation = _continuation;
+		event.ScheduleRead();
+	}
+
+	std::optional<SpawnResponse> await_resume() {
+		return ReceiveSpawnResponse(socket);
+	}
+
+private:
+	void OnSocketReady(unsigned) noexcept {
+		event.Cancel();
+		continuation.resume();
+	}
+};
+
+/**
+ * Wait for the result of execve() (see CheckSpawnExec()) without
+ * blocking the #EventLoop.
+ */
+class CoSpawnExec final {
+	UniqueFileDescriptor pipe;
+
+	PipeEvent event;
+
+	const char *const path;
+
+	std::coroutine_handle<> continuation;
+
+public:
+	CoSpawnExec(EventLoop &event_loop,
+		    UniqueFileDescriptor &&_pipe,
+		    const char *_path) noexcept
+		:pipe(std::move(_pipe)),
+		 event(event_loop, BIND_THIS_METHOD(OnPipeReady), pipe),
+		 path(_path) {}
+
+	CoSpawnExec(const CoSpawnExec &) = delete;
+	CoSpawnExec &operator=(const CoSpawnExec &) = delete;
+
+	bool await_ready() const noexcept {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> _continuation) noexcept {
+		continuation = _continuation;
+		event.ScheduleRead();
+	}
+
+	void await_resume() {
+		CheckSpawnExec(pipe, path);
+	}
+
+private:
+	void OnPipeReady(unsigned) noexcept {
+		event.Cancel();
+		continuation.resume();
+	}
+};
+
+/**
+ * The connection of one #EventLoop to the spawner process.  Requests
+ * are sent without blocking; if the socket is full, senders wait
+ * (in FIFO order) until it becomes writable.
+ *
+ * If the spawner fails (it has died or the kernel does not support
+ * clone3()), this object is disabled and callers shall fall back to
+ * ExecPipe().
+ */
+class SpawnClient final {
+	RootLogger logger;
+
+	const SocketDescriptor socket;
+
+	/**
+	 * Waits for #socket to become writable while there are
+	 * #waiters.
+	 */
+	SocketEvent event;
+
+	class WriteAwaitable final : public AutoUnlinkIntrusiveListHook {
+		SpawnClient &client;
+
+		std::coroutine_handle<> continuation;
+
+	public:
+		explicit WriteAwaitable(SpawnClient &_client) noexcept
+			:client(_client) {}
+
+		WriteAwaitable(const WriteAwaitable &) = delete;
+		WriteAwaitable &operator=(const WriteAwaitable &) = delete;
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> _continuation) noexcept {
+			continuation = _continuation;
+			client.AddWaiter(*this);
+		}
+
+		void await_resume() const noexcept {}
+
+		void Resume() noexcept {
+			continuation.resume();
+		}
+	};
+
+	IntrusiveList<WriteAwaitable> waiters;
+
+	bool enabled;
+
+public:
+	/**
+	 * @param _socket the socket returned by StartSpawner() (owned
+	 * by the caller; may be shared by several event loops) or
+	 * undefined if there is no spawner
+	 */
+	SpawnClient(EventLoop &event_loop, SocketDescriptor _socket) noexcept
+		:socket(_socket),
+		 event(event_loop, BIND_THIS_METHOD(OnSocketReady), socket),
+		 enabled(socket.IsDefined()) {}
+
+	SpawnClient(const SpawnClient &) = delete;
+	SpawnClient &operator=(const SpawnClient &) = delete;
+
+	auto &GetEventLoop() const noexcept {
+		return event.GetEventLoop();
+	}
+
+	bool IsEnabled() const noexcept {
+		return enabled;
+	}
+
+	/**
+	 * Stop using the spawner.
+	 */
+	void Disable(const char *reason) noexcept;
+
+	/**
+	 * Send the request, waiting for the socket to become
+	 * writable if necessary.
+	 *
+	 * Throws on error.
+	 *
+	 * @return false if the request could not be sent to the
+	 * spawner, and the caller shall fall back to ExecPipe()
+	 */
+	Co::Task<bool> Send(SpawnRequest &request);
+
+private:
+	void AddWaiter(WriteAwaitable &w) noexcept {
+		waiters.push_back(w);
+		event.ScheduleWrite();
+	}
+
+	void OnSocketReady(unsigned events) noexcept;
+};
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * The protocol between the daemon and its spawner process (see
+ * StartSpawner()).
+ *
+ * A request is one datagram consisting of a #SpawnRequestHeader
+ * followed by the null-terminated executable path, the arguments and
+ * the environment variables.  It carries these file descriptors
+ * (SCM_RIGHTS): the socket for the response, the pipe which becomes
+ * the child's stdout and optionally its stdin, its stderr and the
+ * cgroup directory (in this order; see #SpawnRequestFlags).
+ *
+ * The response is sent on the response socket; it is an int with
+ * the errno value (0 on success) and, on success, the pidfd of the
+ * new process and the read end of a pipe which reports the result of
+ * execve(): end-of-file means success, an int is an errno value.
+ * The spawner does not wait for execve(), so it can handle the next
+ * request while the new process is still starting.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum SpawnRequestFlags : uint_least32_t {
+	SPAWN_STDERR = 0x1,
+	SPAWN_CGROUP = 0x2,
+	SPAWN_STDIN = 0x4,
+};
+
+struct SpawnRequestHeader {
+	uint32_t n_args;
+	uint32_t n_env;
+
+	/**
+	 * A combination of #SpawnRequestFlags.
+	 */
+	uint32_t flags;
+};
+
+/**
+ * The maximum size of a request datagram.
+ */
+static constexpr std::size_t SPAWN_MAX_REQUEST = 256 * 1024;
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Spawner.hxx"
+#include "SpawnProtocol.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <array>
+#include <cerrno>
+#include <cstdlib> // for EXIT_SUCCESS
+#include <cstring> // for std::memcpy(), std::memchr()
+#include <span>
+#include <vector>
+
+#include <fcntl.h> // for O_CLOEXEC
+#include <linux/sched.h> // for struct clone_args
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * The socket connected to the daemon.
+ */
+static constexpr int SPAWNER_SOCKET = 3;
+
+/**
+ * The file descriptors received with one request.
+ */
+struct SpawnRequestFds {
+	std::array<int, 5> fds;
+	std::size_t n = 0;
+
+	~SpawnRequestFds() noexcept {
+		for (std::size_t i = 0; i < n; ++i)
+			close(fds[i]);
+	}
+
+	int operator[](std::size_t i) const noexcept {
+		return i < n ? fds[i] : -1;
+	}
+};
+
+/**
+ * Split the null-terminated strings following the header into a
+ * nullptr-terminated array.
+ *
+ * @return false if the payload is malformed
+ */
+static bool
+SplitStrings(std::vector<char *> &dest, std::span<char> &src,
+	     std::size_t n) noexcept
+{
+	dest.reserve(n + 1);
+
+	for (std::size_t i = 0; i < n; ++i) {
+		auto *end = static_cast<char *>(std::memchr(src.data(), 0, src.size()));
+		if (end == nullptr)
+			return false;
+
+		dest.push_back(src.data());
+		src = src.subspan(end + 1 - src.data());
+	}
+
+	dest.push_back(nullptr);
+	return true;
+}
+
+/**
+ * Create a new process with clone3() and execute the program in it.
+ * This is only called in the spawner process.
+ *
+ * This does not wait for execve(): the read end of a pipe which
+ * reports its errno value is returned to the client, which waits for
+ * it, so the spawner can handle the next request right away.
+ *
+ * @return 0 on success (and the pidfd in @p pidfd_r and the error
+ * pipe in @p exec_pipe_r) or an errno value
+ */
+static int
+Spawn(const char *path, char *const*argv, char *const*envp,
+      int stdin_fd, int stdout_fd, int stderr_fd, int cgroup_fd,
+      int &pidfd_r, int &exec_pipe_r) noexcept
+{
+	/* this pipe reports execve() errors; it gets closed (and
+	   the client reads end-of-file) when execve() succeeds */
+	int error_pipe[2];
+	if (pipe2(error_pipe, O_CLOEXEC) < 0)
+		return errno;
+
+	int pidfd = -1;
+	struct clone_args ca{};
+	ca.flags = CLONE_PIDFD;
+	ca.pidfd = reinterpret_cast<uintptr_t>(&pidfd);
+	ca.exit_signal = SIGCHLD;
+
+	if (cgroup_fd >= 0) {
+		ca.flags |= CLONE_INTO_CGROUP;
+		ca.cgroup = cgroup_fd;
+	}
+
+	const long pid = syscall(SYS_clone3, &ca, sizeof(ca));
+	if (pid < 0) {
+		const int e = errno;
+		close(error_pipe[0]);
+		close(error_pipe[1]);
+		return e;
+	}
+
+	if (pid == 0) {
+		/* the child process: undo the spawner's signal
+		   setup (ignored signals would be inherited by the
+		   new program) */
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigprocmask(SIG_SETMASK, &signals, nullptr);
+
+		if (stdin_fd >= 0)
+			dup2(stdin_fd, STDIN_FILENO);
+		dup2(stdout_fd, STDOUT_FILENO);
+		if (stderr_fd >= 0)
+			dup2(stderr_fd, STDERR_FILENO);
+
+		execve(path, argv, envp);
+
+		const int e = errno;
+		[[maybe_unused]] auto nbytes = write(error_pipe[1], &e, sizeof(e));
+		_exit(127);
+	}
+
+	/* close the write end before the next clone3() call, or
+	   the next child would inherit it */
+	close(error_pipe[1]);
+
+	pidfd_r = pidfd;
+	exec_pipe_r = error_pipe[0];
+	return 0;
+}
+
+static void
+SendResponse(int socket, int error, int pidfd, int exec_pipe) noexcept
+{
+	struct iovec iov{&error, sizeof(error)};
+	struct msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	const int fds[] = {pidfd, exec_pipe};
+
+	alignas(struct cmsghdr) std::byte control[CMSG_SPACE(sizeof(fds))];
+	if (error == 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		auto *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	}
+
+	sendmsg(socket, &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+}
+
+static void
+HandleRequest(std::span<char> payload, const SpawnRequestFds &fds) noexcept
+{
+	const int response_socket = fds[0];
+	if (response_socket < 0)
+		return;
+
+	SpawnRequestHeader header;
+	if (payload.size() < sizeof(header)) {
+		SendResponse(response_socket, EINVAL, -1, -1);
+		return;
+	}
+
+	std::memcpy(&header, payload.data(), sizeof(header));
+	payload = payload.subspan(sizeof(header));
+
+	const std::size_t n_fds = 2 +
+		((header.flags & SPAWN_STDIN) != 0) +
+		((header.flags & SPAWN_STDERR) != 0) +
+		((header.flags & SPAWN_CGROUP) != 0);
+
+	std::vector<char *> path, argv, envp;
+	if (fds.n != n_fds ||
+	    !SplitStrings(path, payload, 1) ||
+	    !SplitStrings(argv, payload, header.n_args) ||
+	    !SplitStrings(envp, payload, header.n_env)) {
+		SendResponse(response_socket, EINVAL, -1, -1);
+		return;
+	}
+
+	std::size_t i = 1;
+	const int stdout_fd = fds[i++];
+	const int stdin_fd = (header.flags & SPAWN_STDIN) != 0 ? fds[i++] : -1;
+	const int stderr_fd = (header.flags & SPAWN_STDERR) != 0 ? fds[i++] : -1;
+	const int cgroup_fd = (header.flags & SPAWN_CGROUP) != 0 ? fds[i++] : -1;
+
+	int pidfd = -1, exec_pipe = -1;
+	const int error = Spawn(path.front(), argv.data(), envp.data(),
+				stdin_fd, stdout_fd, stderr_fd, cgroup_fd,
+				pidfd, exec_pipe);
+	SendResponse(response_socket, error, pidfd, exec_pipe);
+
+	if (error == 0) {
+		close(pidfd);
+		close(exec_pipe);
+	}
+}
+
+[[noreturn]]
+static void
+RunSpawner(pid_t parent_pid) noexcept
+{
+	prctl(PR_SET_NAME, "spawner", 0, 0, 0);
+
+	/* exit when the daemon exits */
+	prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0);
+	if (getppid() != parent_pid)
+		_exit(EXIT_SUCCESS);
+
+	/* let the kernel reap our children */
+	signal(SIGCHLD, SIG_IGN);
+
+	static char buffer[SPAWN_MAX_REQUEST];
+
+	while (true) {
+		struct iovec iov{buffer, sizeof(buffer)};
+		struct msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		alignas(struct cmsghdr) std::byte control[CMSG_SPACE(sizeof(SpawnRequestFds::fds))];
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		const auto nbytes = recvmsg(SPAWNER_SOCKET, &msg, MSG_CMSG_CLOEXEC);
+		if (nbytes < 0 && errno == EINTR)
+			continue;
+
+		if (nbytes <= 0)
+			/* the daemon has closed the socket */
+			_exit(EXIT_SUCCESS);
+
+		SpawnRequestFds fds;
+		for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+			    cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			fds.n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			std::memcpy(fds.fds.data(), CMSG_DATA(cmsg),
+				    fds.n * sizeof(int));
+		}
+
+		if ((msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) != 0)
+			/* discard the request; this closes the
+			   response socket, which tells the client */
+			continue;
+
+		HandleRequest({buffer, static_cast<std::size_t>(nbytes)}, fds);
+	}
+}
+
+UniqueSocketDescriptor
+StartSpawner()
+{
+	int sv[2];
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0)
+		throw MakeErrno("Failed to create socket pair");
+
+	UniqueSocketDescriptor daemon_socket{AdoptTag{}, sv[0]};
+	UniqueSocketDescriptor spawner_socket{AdoptTag{}, sv[1]};
+
+	const pid_t parent_pid = getpid();
+
+	const pid_t pid = fork();
+	if (pid < 0)
+		throw MakeErrno("Failed to fork the spawner process");
+
+	if (pid == 0) {
+		/* move our socket to a well-known file descriptor
+		   and close everything else (except stdio) */
+		if (spawner_socket.Get() != SPAWNER_SOCKET)
+			dup3(spawner_socket.Get(), SPAWNER_SOCKET, O_CLOEXEC);
+		close_range(SPAWNER_SOCKET + 1, ~0U, 0);
+		RunSpawner(parent_pid);
+	}
+
+	return daemon_socket;
+}
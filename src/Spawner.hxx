@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+class UniqueSocketDescriptor;
+
+/**
+ * Fork the spawner process which launches child processes on
+ * behalf of this process (see SpawnProtocol.hxx).  Since the cost of
+ * creating a process grows with the size of the parent's address
+ * space, this should be called as early as possible, before
+ * loading Lua code and before creating threads.
+ *
+ * Throws on error.
+ *
+ * @return a socket connected to the spawner process; it exits when
+ * this socket is closed
+ */
+UniqueSocketDescriptor
+StartSpawner();
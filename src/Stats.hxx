@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <algorithm> // for std::max()
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Counters which can be queried by the Lua function
+ * passage_stats().
+ */
+struct PassageStats {
+	/**
+	 * The number of requests which have been answered.
+	 */
+	uint_least64_t requests = 0;
+
+	/**
+	 * The total number of bytes allocated from #RequestArena
+	 * instances.
+	 */
+	uint_least64_t arena_bytes = 0;
+
+	/**
+	 * The largest number of bytes one request has allocated from
+	 * its #RequestArena.
+	 */
+	std::size_t arena_peak = 0;
+
+	/**
+	 * The number of requests which were handled by a static rule
+	 * (see passage_rule()) without invoking Lua.
+	 */
+	uint_least64_t rule_hits = 0;
+
+	/**
+	 * The number of requests which were answered from the
+	 * #ResponseCache without invoking Lua.
+	 */
+	uint_least64_t response_cache_hits = 0;
+
+	/**
+	 * The number of requests which were looked up in the
+	 * #ResponseCache without success.
+	 */
+	uint_least64_t response_cache_misses = 0;
+
+	/**
+	 * The number of responses which were stored in the
+	 * #ResponseCache.
+	 */
+	uint_least64_t response_cache_stores = 0;
+
+	/**
+	 * The number of client cgroup lookups which were answered
+	 * by the #PeerAuthCache.
+	 */
+	uint_least64_t peer_cache_hits = 0;
+
+	/**
+	 * The number of client cgroup lookups which needed to read
+	 * from procfs.
+	 */
+	uint_least64_t peer_cache_misses = 0;
+
+	/**
+	 * The number of handler invocations which were aborted
+	 * because they exceeded their budget (see
+	 * passage_handler_budget()).
+	 */
+	uint_least64_t budget_exceeded = 0;
+
+	/**
+	 * The number of handler invocations which have reused an
+	 * idle Lua thread from the #LuaThreadPool.
+	 */
+	uint_least64_t thread_pool_hits = 0;
+
+	/**
+	 * The number of handler invocations for which a new Lua
+	 * thread had to be created.
+	 */
+	uint_least64_t thread_pool_misses = 0;
+
+	/**
+	 * The number of idle Lua threads in the #LuaThreadPool.
+	 */
+	std::size_t thread_pool_idle = 0;
+
+	/**
+	 * The number of running child processes which were spawned
+	 * by this thread and which are counted by the
+	 * #ChildLimiter.
+	 */
+	std::size_t children = 0;
+
+	/**
+	 * The number of requests of this thread which currently wait
+	 * for a #ChildLimiter slot.
+	 */
+	std::size_t child_queue_length = 0;
+
+	/**
+	 * The number of requests which had to wait for a
+	 * #ChildLimiter slot.
+	 */
+	uint_least64_t child_queue_waits = 0;
+
+	/**
+	 * The total time (in microseconds) requests have waited for
+	 * a #ChildLimiter slot.
+	 */
+	uint_least64_t child_queue_wait_us = 0;
+
+	/**
+	 * The number of requests which were rejected because the
+	 * #ChildLimiter queue was full.
+	 */
+	uint_least64_t child_queue_rejected = 0;
+
+	/**
+	 * The number of requests which were rejected because they
+	 * have waited too long for a #ChildLimiter slot.
+	 */
+	uint_least64_t child_queue_timeouts = 0;
+
+	void AddRequest(std::size_t arena_allocated) noexcept {
+		++requests;
+		arena_bytes += arena_allocated;
+		arena_peak = std::max(arena_peak, arena_allocated);
+	}
+};
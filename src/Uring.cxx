@@ -0,0 +1,436 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Uring.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring> // for std::memcpy()
+#include <stdexcept>
+
+#include <unistd.h> // for close()
+
+/**
+ * Enough control message space for the client's credentials and a
+ * few file descriptors (see #ReceiveBatch).
+ */
+static constexpr std::size_t RECEIVE_CMSG_SIZE =
+	CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * 4);
+
+UringBackend::UringBackend(EventLoop &event_loop)
+	:event(event_loop, BIND_THIS_METHOD(OnRingReady)),
+	 submit_event(event_loop, BIND_THIS_METHOD(Submit))
+{
+	/* multishot operations post many completions per
+	   submission, so the completion queue needs to be much
+	   larger than the submission queue */
+	struct io_uring_params params{};
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = 4096;
+
+	if (int result = io_uring_queue_init_params(256, &ring, &params);
+	    result < 0)
+		throw MakeErrno(-result, "io_uring_queue_init() failed");
+
+	int error;
+	buf_ring = io_uring_setup_buf_ring(&ring, N_BUFFERS, BUFFER_GROUP,
+					   0, &error);
+	if (buf_ring == nullptr) {
+		io_uring_queue_exit(&ring);
+		throw MakeErrno(-error, "io_uring_setup_buf_ring() failed");
+	}
+
+	const int mask = io_uring_buf_ring_mask(N_BUFFERS);
+	for (unsigned i = 0; i < N_BUFFERS; ++i)
+		io_uring_buf_ring_add(buf_ring, buffers.get() + i * BUFFER_SIZE,
+				      BUFFER_SIZE, i, mask, i);
+	io_uring_buf_ring_advance(buf_ring, N_BUFFERS);
+
+	event.Open(SocketDescriptor{ring.ring_fd});
+	event.ScheduleRead();
+}
+
+UringBackend::~UringBackend() noexcept
+{
+	event.Cancel();
+	io_uring_free_buf_ring(&ring, buf_ring, N_BUFFERS, BUFFER_GROUP);
+	io_uring_queue_exit(&ring);
+}
+
+struct io_uring_sqe &
+UringBackend::GetSubmitEntry()
+{
+	auto *sqe = io_uring_get_sqe(&ring);
+	if (sqe == nullptr) {
+		io_uring_submit(&ring);
+
+		sqe = io_uring_get_sqe(&ring);
+		if (sqe == nullptr)
+			throw std::runtime_error{"io_uring submission queue is full"};
+	}
+
+	return *sqe;
+}
+
+void
+UringBackend::Submit() noexcept
+{
+	submit_event.Cancel();
+
+	/* errors (e.g. EBUSY) are not fatal; the entries remain in
+	   the queue and OnRingReady() will try again */
+	io_uring_submit(&ring);
+}
+
+void
+UringBackend::Cancel(UringOperation &operation) noexcept
+try {
+	auto &sqe = GetSubmitEntry();
+	io_uring_prep_cancel(&sqe, &operation, 0);
+	Push(sqe, nullptr);
+} catch (...) {
+	/* cannot cancel; the operation will linger until the
+	   kernel finishes it, which is harmless because it has
+	   already been detached from its handler */
+}
+
+void
+UringBackend::RecycleBuffer(unsigned id) noexcept
+{
+	assert(id < N_BUFFERS);
+
+	io_uring_buf_ring_add(buf_ring, buffers.get() + id * BUFFER_SIZE,
+			      BUFFER_SIZE, id,
+			      io_uring_buf_ring_mask(N_BUFFERS), 0);
+	io_uring_buf_ring_advance(buf_ring, 1);
+}
+
+void
+UringBackend::OnRingReady(unsigned) noexcept
+{
+	struct io_uring_cqe *cqe;
+	while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+		/* copy and consume the entry before invoking the
+		   handler, because it may submit new entries */
+		const auto copy = *cqe;
+		io_uring_cqe_seen(&ring, cqe);
+
+		if (auto *operation = static_cast<UringOperation *>(io_uring_cqe_get_data(&copy)))
+			operation->OnUringCompletion(copy);
+	}
+
+	if (io_uring_sq_ready(&ring) > 0)
+		submit_event.Schedule();
+}
+
+UringReceive::UringReceive(UringBackend &_backend, SocketDescriptor _socket,
+			   UringReceiveHandler &_handler) noexcept
+	:backend(_backend), handler(&_handler), socket(_socket)
+{
+	msg = {};
+	msg.msg_controllen = RECEIVE_CMSG_SIZE;
+}
+
+void
+UringReceive::Start()
+{
+	assert(handler != nullptr);
+	assert(!armed);
+
+	auto &sqe = backend.GetSubmitEntry();
+	io_uring_prep_recvmsg_multishot(&sqe, socket.Get(), &msg,
+					MSG_CMSG_CLOEXEC);
+	sqe.flags |= IOSQE_BUFFER_SELECT;
+	sqe.buf_group = UringBackend::BUFFER_GROUP;
+	backend.Push(sqe, this);
+
+	armed = true;
+}
+
+void
+UringReceive::Cancel() noexcept
+{
+	assert(handler != nullptr);
+
+	handler = nullptr;
+
+	if (armed)
+		/* the final completion will delete this object */
+		backend.Cancel(*this);
+	else
+		delete this;
+}
+
+inline void
+UringReceive::OnBuffer(std::span<const std::byte> buffer) noexcept
+{
+	assert(handler != nullptr);
+
+	auto *out = io_uring_recvmsg_validate(const_cast<std::byte *>(buffer.data()),
+					      buffer.size(), &msg);
+	if (out == nullptr) {
+		/* recvmsg() has returned 0: the peer has closed the
+		   connection */
+		handler->OnUringDatagram({}, false, false, {});
+		return;
+	}
+
+	/* adopt file descriptors right away so they cannot leak */
+	UniqueFileDescriptor fd;
+	std::size_t n_fds = 0;
+	for (auto *cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &msg);
+	     cmsg != nullptr;
+	     cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		const int *p = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+		const std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(*p);
+		for (std::size_t i = 0; i < n; ++i) {
+			if (n_fds++ == 0)
+				fd = UniqueFileDescriptor{AdoptTag{}, p[i]};
+			else
+				close(p[i]);
+		}
+	}
+
+	const bool excess_fds = n_fds > 1 || (out->flags & MSG_CTRUNC) != 0;
+	if (excess_fds)
+		fd.Close();
+
+	const auto *payload = static_cast<const std::byte *>(io_uring_recvmsg_payload(out, &msg));
+	const std::size_t length = io_uring_recvmsg_payload_length(out, buffer.size(), &msg);
+
+	handler->OnUringDatagram({payload, length},
+				 out->payloadlen > length, excess_fds,
+				 std::move(fd));
+}
+
+void
+UringReceive::OnUringCompletion(const struct io_uring_cqe &cqe) noexcept
+{
+	const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+	if (cqe.flags & IORING_CQE_F_BUFFER) {
+		const unsigned id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+		if (handler != nullptr && cqe.res >= 0)
+			/* this may cancel the operation (but it is
+			   still alive until the final completion) */
+			OnBuffer(backend.GetBuffer(id).first(cqe.res));
+
+		backend.RecycleBuffer(id);
+	}
+
+	if (more)
+		return;
+
+	armed = false;
+
+	if (handler == nullptr) {
+		delete this;
+		return;
+	}
+
+	if (cqe.res == 0 && !(cqe.flags & IORING_CQE_F_BUFFER)) {
+		/* end of stream */
+		handler->OnUringDatagram({}, false, false, {});
+		return;
+	}
+
+	int error = cqe.res < 0 ? -cqe.res : 0;
+
+	if (error == 0 || error == ENOBUFS) {
+		/* the kernel has terminated the multishot operation,
+		   e.g. because all provided buffers were in use:
+		   re-arm it */
+		try {
+			Start();
+			return;
+		} catch (...) {
+			error = EAGAIN;
+		}
+	}
+
+	auto &h = *handler;
+	delete this;
+	h.OnUringReceiveError(error);
+}
+
+void
+UringAccept::Start()
+{
+	assert(handler != nullptr);
+	assert(!armed);
+
+	auto &sqe = backend.GetSubmitEntry();
+	io_uring_prep_multishot_accept(&sqe, socket.Get(), nullptr, nullptr,
+				       SOCK_CLOEXEC|SOCK_NONBLOCK);
+	backend.Push(sqe, this);
+
+	armed = true;
+}
+
+void
+UringAccept::Cancel() noexcept
+{
+	assert(handler != nullptr);
+
+	handler = nullptr;
+
+	if (armed)
+		backend.Cancel(*this);
+	else
+		delete this;
+}
+
+void
+UringAccept::OnUringCompletion(const struct io_uring_cqe &cqe) noexcept
+{
+	const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+	if (cqe.res >= 0) {
+		UniqueSocketDescriptor fd{AdoptTag{}, cqe.res};
+		if (handler != nullptr)
+			handler->OnUringAccept(std::move(fd));
+	}
+
+	if (more)
+		return;
+
+	armed = false;
+
+	if (handler == nullptr) {
+		delete this;
+		return;
+	}
+
+	int error = cqe.res < 0 ? -cqe.res : 0;
+
+	if (error == 0 || error == EMFILE || error == ENFILE) {
+		/* the kernel has terminated the multishot
+		   operation; re-arm it */
+		try {
+			Start();
+			return;
+		} catch (...) {
+			error = EAGAIN;
+		}
+	}
+
+	auto &h = *handler;
+	delete this;
+	h.OnUringAcceptError(error);
+}
+
+namespace {
+
+/**
+ * A sendmsg() operation which owns copies of its buffers.
+ */
+class UringSend final : UringOperation {
+	const std::unique_ptr<std::byte[]> data;
+
+	UniqueFileDescriptor fds[2];
+
+	struct iovec iov;
+
+	struct msghdr msg{};
+
+	alignas(struct cmsghdr) std::byte cmsg[CMSG_SPACE(sizeof(int) * 2)];
+
+public:
+	UringSend(std::span<const struct iovec> vec,
+		  FileDescriptor fd, FileDescriptor fd2);
+
+	void Start(UringBackend &backend, SocketDescriptor s);
+
+private:
+	/* virtual methods from class UringOperation */
+	void OnUringCompletion(const struct io_uring_cqe &) noexcept override {
+		delete this;
+	}
+};
+
+static std::size_t
+TotalSize(std::span<const struct iovec> vec) noexcept
+{
+	std::size_t size = 0;
+	for (const auto &i : vec)
+		size += i.iov_len;
+	return size;
+}
+
+UringSend::UringSend(std::span<const struct iovec> vec,
+		     FileDescriptor fd, FileDescriptor fd2)
+	:data(new std::byte[TotalSize(vec)])
+{
+	/* gather all buffers into one, because the caller's
+	   buffers are only valid until we return */
+	std::byte *p = data.get();
+	for (const auto &i : vec) {
+		std::memcpy(p, i.iov_base, i.iov_len);
+		p += i.iov_len;
+	}
+
+	iov = {data.get(), static_cast<std::size_t>(p - data.get())};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (!fd.IsDefined())
+		return;
+
+	std::size_t n = 0;
+	fds[n++] = fd.Duplicate();
+	if (fd2.IsDefined())
+		fds[n++] = fd2.Duplicate();
+
+	for (std::size_t i = 0; i < n; ++i)
+		if (!fds[i].IsDefined())
+			throw MakeErrno("Failed to duplicate file descriptor");
+
+	msg.msg_control = cmsg;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+
+	auto *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(int) * n);
+
+	int *dest = reinterpret_cast<int *>(CMSG_DATA(c));
+	for (std::size_t i = 0; i < n; ++i)
+		dest[i] = fds[i].Get();
+}
+
+inline void
+UringSend::Start(UringBackend &backend, SocketDescriptor s)
+{
+	auto &sqe = backend.GetSubmitEntry();
+
+	/* no MSG_DONTWAIT: if the socket buffer is full, the kernel
+	   waits for it to drain instead of failing */
+	io_uring_prep_sendmsg(&sqe, s.Get(), &msg, MSG_NOSIGNAL);
+	backend.Push(sqe, this);
+}
+
+} // anonymous namespace
+
+void
+UringSendMessage(UringBackend &backend, SocketDescriptor s,
+		 std::span<const struct iovec> vec,
+		 FileDescriptor fd, FileDescriptor fd2)
+{
+	auto *send = new UringSend(vec, fd, fd2);
+
+	try {
+		send->Start(backend, s);
+	} catch (...) {
+		delete send;
+		throw;
+	}
+}
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <liburing.h>
+
+#include <cstddef>
+#include <memory>
+#include <span>
+
+struct iovec;
+class FileDescriptor;
+class UniqueFileDescriptor;
+class UniqueSocketDescriptor;
+
+/**
+ * An operation submitted to the #UringBackend.  Its address is the
+ * "user_data" of the submission queue entry.
+ */
+class UringOperation {
+public:
+	/**
+	 * A completion queue entry for this operation has been
+	 * received.  Multishot operations receive several of them;
+	 * the last one does not have #IORING_CQE_F_MORE.
+	 */
+	virtual void OnUringCompletion(const struct io_uring_cqe &cqe) noexcept = 0;
+};
+
+/**
+ * An io_uring instance integrated into an #EventLoop.  Submission
+ * queue entries are collected and submitted with one system call
+ * after the current event loop iteration; completions are
+ * dispatched when the ring's file descriptor becomes readable.
+ *
+ * It also manages a ring of provided buffers for multishot receive
+ * operations.
+ */
+class UringBackend {
+public:
+	/**
+	 * The buffer group id of #buf_ring.
+	 */
+	static constexpr unsigned BUFFER_GROUP = 0;
+
+	/**
+	 * The number of provided buffers (must be a power of two).
+	 */
+	static constexpr unsigned N_BUFFERS = 64;
+
+	/**
+	 * The size of each provided buffer.  This is large enough
+	 * for a #ReceiveBatch::MAX_PAYLOAD payload plus the
+	 * io_uring_recvmsg_out header and control messages.
+	 */
+	static constexpr std::size_t BUFFER_SIZE = 16384 + 512;
+
+private:
+	struct io_uring ring;
+
+	SocketEvent event;
+
+	DeferEvent submit_event;
+
+	struct io_uring_buf_ring *buf_ring = nullptr;
+
+	const std::unique_ptr<std::byte[]> buffers{new std::byte[N_BUFFERS * BUFFER_SIZE]};
+
+public:
+	/**
+	 * Throws if io_uring is not available.
+	 */
+	explicit UringBackend(EventLoop &event_loop);
+	~UringBackend() noexcept;
+
+	UringBackend(const UringBackend &) = delete;
+	UringBackend &operator=(const UringBackend &) = delete;
+
+	/**
+	 * Obtain a new submission queue entry.  If the queue is
+	 * full, pending entries are submitted first.
+	 *
+	 * Throws on error.
+	 */
+	struct io_uring_sqe &GetSubmitEntry();
+
+	/**
+	 * Schedule the submission of an entry obtained by
+	 * GetSubmitEntry().
+	 *
+	 * @param operation the operation to be notified on
+	 * completion or nullptr to ignore completions
+	 */
+	void Push(struct io_uring_sqe &sqe,
+		  UringOperation *operation) noexcept {
+		io_uring_sqe_set_data(&sqe, operation);
+		submit_event.Schedule();
+	}
+
+	/**
+	 * Submit all pending entries now.  This must be called
+	 * before closing a file descriptor which is referenced by a
+	 * pending entry.
+	 */
+	void Submit() noexcept;
+
+	/**
+	 * Ask the kernel to cancel the given operation.  Its
+	 * remaining completions will still be delivered.
+	 */
+	void Cancel(UringOperation &operation) noexcept;
+
+	std::span<const std::byte> GetBuffer(unsigned id) const noexcept {
+		return {buffers.get() + id * BUFFER_SIZE, BUFFER_SIZE};
+	}
+
+	/**
+	 * Give a provided buffer back to the kernel.
+	 */
+	void RecycleBuffer(unsigned id) noexcept;
+
+private:
+	void OnRingReady(unsigned events) noexcept;
+};
+
+class UringReceiveHandler {
+public:
+	/**
+	 * A datagram has been received.  An empty payload means the
+	 * peer has closed the connection.  The handler may cancel the
+	 * #UringReceive from here.
+	 *
+	 * @param excess_fds did the client pass more than one file
+	 * descriptor?  (They have already been closed.)
+	 * @param fd the file descriptor passed by the client (if
+	 * exactly one)
+	 */
+	virtual void OnUringDatagram(std::span<const std::byte> payload,
+				     bool truncated, bool excess_fds,
+				     UniqueFileDescriptor &&fd) noexcept = 0;
+
+	/**
+	 * The receive operation has failed.  It has already been
+	 * destroyed.
+	 *
+	 * @param error a positive errno value
+	 */
+	virtual void OnUringReceiveError(int error) noexcept = 0;
+};
+
+/**
+ * A multishot recvmsg() operation using the provided buffers of the
+ * #UringBackend.  It re-arms itself when the kernel terminates it
+ * (e.g. because it ran out of buffers).
+ *
+ * Instances are allocated on the heap; call Cancel() instead of
+ * deleting them.
+ */
+class UringReceive final : UringOperation {
+	UringBackend &backend;
+
+	UringReceiveHandler *handler;
+
+	const SocketDescriptor socket;
+
+	/**
+	 * Describes the layout of the provided buffers; the kernel
+	 * reads it when the operation starts.
+	 */
+	struct msghdr msg;
+
+	/**
+	 * Is an operation pending in the kernel?
+	 */
+	bool armed = false;
+
+public:
+	UringReceive(UringBackend &_backend, SocketDescriptor _socket,
+		     UringReceiveHandler &_handler) noexcept;
+
+	/**
+	 * Throws on error.
+	 */
+	void Start();
+
+	/**
+	 * Stop receiving and free this object (as soon as the
+	 * kernel has released it).
+	 */
+	void Cancel() noexcept;
+
+private:
+	~UringReceive() noexcept = default;
+
+	void OnBuffer(std::span<const std::byte> buffer) noexcept;
+
+	/* virtual methods from class UringOperation */
+	void OnUringCompletion(const struct io_uring_cqe &cqe) noexcept override;
+};
+
+class UringAcceptHandler {
+public:
+	virtual void OnUringAccept(UniqueSocketDescriptor &&fd) noexcept = 0;
+
+	/**
+	 * The accept operation has failed.  It has already been
+	 * destroyed.
+	 *
+	 * @param error a positive errno value
+	 */
+	virtual void OnUringAcceptError(int error) noexcept = 0;
+};
+
+/**
+ * A multishot accept() operation.
+ *
+ * Instances are allocated on the heap; call Cancel() instead of
+ * deleting them.
+ */
+class UringAccept final : UringOperation {
+	UringBackend &backend;
+
+	UringAcceptHandler *handler;
+
+	const SocketDescriptor socket;
+
+	bool armed = false;
+
+public:
+	UringAccept(UringBackend &_backend, SocketDescriptor _socket,
+		    UringAcceptHandler &_handler) noexcept
+		:backend(_backend), handler(&_handler), socket(_socket) {}
+
+	/**
+	 * Throws on error.
+	 */
+	void Start();
+
+	/**
+	 * Stop accepting and free this object (as soon as the
+	 * kernel has released it).
+	 */
+	void Cancel() noexcept;
+
+private:
+	~UringAccept() noexcept = default;
+
+	/* virtual methods from class UringOperation */
+	void OnUringCompletion(const struct io_uring_cqe &cqe) noexcept override;
+};
+
+/**
+ * Queue a sendmsg() call with an optional SCM_RIGHTS payload.  The
+ * buffers are copied and the file descriptors are duplicated, so
+ * the caller may free them immediately.
+ *
+ * Errors are ignored: they mean that the peer has gone, and the
+ * connection will notice that on its own.
+ *
+ * Throws on error.
+ */
+void
+UringSendMessage(UringBackend &backend, SocketDescriptor s,
+		 std::span<const struct iovec> vec,
+		 FileDescriptor fd, FileDescriptor fd2);
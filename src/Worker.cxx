@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Worker.hxx"
+#include "Connection.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <cassert>
+
+Worker::Worker(SharedCaches &_shared_caches, SocketDescriptor _spawner) noexcept
+	:BaseInstance(_shared_caches, _spawner) {}
+
+Worker::~Worker() noexcept
+{
+	if (thread.joinable()) {
+		Stop();
+		thread.join();
+	}
+
+	connections.clear_and_dispose(DeleteDisposer{});
+}
+
+void
+Worker::Start()
+{
+	assert(!thread.joinable());
+
+	thread = std::thread{[this]{ Run(); }};
+}
+
+inline void
+Worker::Run() noexcept
+{
+	event_loop.Run();
+}
+
+void
+Worker::AddConnection(std::size_t handler_index,
+		      UniqueSocketDescriptor &&fd,
+		      SocketAddress address)
+{
+	{
+		const std::scoped_lock lock{mutex};
+		pending.emplace_back(handler_index, std::move(fd),
+				     AllocatedSocketAddress{address});
+	}
+
+	add_event.Schedule();
+}
+
+void
+Worker::OnAddConnections() noexcept
+{
+	decltype(pending) new_connections;
+
+	{
+		const std::scoped_lock lock{mutex};
+		new_connections.swap(pending);
+	}
+
+	for (auto &i : new_connections) {
+		try {
+			auto *c = new PassageConnection(*this, config,
+							i.handler_index,
+							logger,
+							std::move(i.fd),
+							i.address);
+			connections.push_back(*c);
+		} catch (...) {
+			logger(1, std::current_exception());
+		}
+	}
+}
+
+void
+Worker::SetConfig(LuaConfigPtr &&new_config) noexcept
+{
+	{
+		const std::scoped_lock lock{mutex};
+		pending_config = std::move(new_config);
+	}
+
+	config_event.Schedule();
+}
+
+void
+Worker::Call(std::function<void()> f)
+{
+	assert(thread.joinable());
+
+	std::future<void> future;
+
+	{
+		const std::scoped_lock lock{mutex};
+		assert(!pending_call);
+		pending_call = std::move(f);
+		call_promise = {};
+		future = call_promise.get_future();
+	}
+
+	call_event.Schedule();
+	future.get();
+}
+
+void
+Worker::OnStop() noexcept
+{
+	event_loop.Break();
+}
+
+void
+Worker::OnReload() noexcept
+{
+	config->StartReload();
+}
+
+void
+Worker::OnNewConfig() noexcept
+{
+	LuaConfigPtr new_config;
+
+	{
+		const std::scoped_lock lock{mutex};
+		new_config = std::move(pending_config);
+	}
+
+	if (new_config)
+		/* the old configuration is freed by the last
+		   connection which still uses it */
+		config = std::move(new_config);
+}
+
+void
+Worker::OnCall() noexcept
+{
+	std::function<void()> f;
+	std::promise<void> promise;
+
+	{
+		const std::scoped_lock lock{mutex};
+		f = std::move(pending_call);
+		pending_call = {};
+		promise = std::move(call_promise);
+	}
+
+	if (!f)
+		return;
+
+	try {
+		f();
+		promise.set_value();
+	} catch (...) {
+		promise.set_exception(std::current_exception());
+	}
+}
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "BaseInstance.hxx"
+#include "event/InjectEvent.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class PassageConnection;
+
+/**
+ * A thread with its own #EventLoop and its own Lua state (loaded
+ * from the same configuration file as the main thread).  The main
+ * thread accepts connections and passes them to a worker with
+ * AddConnection(); after that, the worker handles all requests on
+ * this connection.
+ */
+class Worker final : public BaseInstance {
+	InjectEvent add_event{event_loop, BIND_THIS_METHOD(OnAddConnections)};
+	InjectEvent stop_event{event_loop, BIND_THIS_METHOD(OnStop)};
+	InjectEvent reload_event{event_loop, BIND_THIS_METHOD(OnReload)};
+	InjectEvent config_event{event_loop, BIND_THIS_METHOD(OnNewConfig)};
+	InjectEvent call_event{event_loop, BIND_THIS_METHOD(OnCall)};
+
+	IntrusiveList<PassageConnection> connections;
+
+	struct PendingConnection {
+		std::size_t handler_index;
+		UniqueSocketDescriptor fd;
+		AllocatedSocketAddress address;
+	};
+
+	/**
+	 * Connections accepted by the main thread which have not yet
+	 * been picked up by this thread.  Protected by #mutex.
+	 */
+	std::vector<PendingConnection> pending;
+
+	/**
+	 * A new configuration loaded by the main thread which has not
+	 * yet been picked up by this thread.  Protected by #mutex.
+	 */
+	LuaConfigPtr pending_config;
+
+	/**
+	 * A function submitted by Call() which has not yet been
+	 * invoked by this thread.  Protected by #mutex.
+	 */
+	std::function<void()> pending_call;
+
+	std::promise<void> call_promise;
+
+	std::mutex mutex;
+
+	std::thread thread;
+
+public:
+	Worker(SharedCaches &_shared_caches, SocketDescriptor _spawner) noexcept;
+	~Worker() noexcept;
+
+	std::size_t GetHandlerCount() const noexcept {
+		return config->GetHandlerCount();
+	}
+
+	void Start();
+
+	/**
+	 * Stop the thread; it may take a while until it really
+	 * exits.  This method is thread-safe.
+	 */
+	void Stop() noexcept {
+		stop_event.Schedule();
+	}
+
+	/**
+	 * Call the Lua "reload" function in this thread.  This method
+	 * is thread-safe.
+	 */
+	void Reload() noexcept {
+		reload_event.Schedule();
+	}
+
+	/**
+	 * Replace the configuration of this worker; existing
+	 * connections keep using the old one.  This method is
+	 * thread-safe.
+	 *
+	 * The new configuration must have been loaded for this
+	 * worker (i.e. with its #EventLoop and #PassageStats), and
+	 * the caller must not use it after this call.
+	 */
+	void SetConfig(LuaConfigPtr &&new_config) noexcept;
+
+	/**
+	 * Invoke the given function in this thread and wait for it
+	 * to return.  Exceptions are rethrown in the calling thread.
+	 * This method is thread-safe, but the thread must be running.
+	 */
+	void Call(std::function<void()> f);
+
+	/**
+	 * Pass a new connection to this worker.  This method is
+	 * thread-safe.
+	 *
+	 * @param handler_index the index of the passage_listen() call
+	 * which created the listener
+	 */
+	void AddConnection(std::size_t handler_index,
+			   UniqueSocketDescriptor &&fd,
+			   SocketAddress address);
+
+private:
+	void Run() noexcept;
+
+	void OnAddConnections() noexcept;
+	void OnStop() noexcept;
+	void OnReload() noexcept;
+	void OnNewConfig() noexcept;
+	void OnCall() noexcept;
+};
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A load generator for measuring the throughput of a running
+ * passage daemon.  Each connection runs in its own thread and sends
+ * requests one after another, waiting for each response.
+ *
+ * To compare the io_uring backend with the epoll backend, run this
+ * against daemons built with -Dio_uring=enabled and
+ * -Dio_uring=disabled using the same configuration file.
+ */
+
+#include "net/ConnectSocket.hxx"
+#include "net/LocalSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+#include "util/SpanCast.hxx"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sysexits.h> // for EX_*
+
+using std::string_view_literals::operator""sv;
+
+struct Usage {};
+
+static void
+RunConnection(const char *path, std::string_view request, unsigned n_requests)
+{
+	auto s = CreateConnectSocket(LocalSocketAddress{path}, SOCK_SEQPACKET);
+
+	for (unsigned i = 0; i < n_requests; ++i) {
+		if (s.Send(AsBytes(request)) < 0)
+			throw MakeErrno("Failed to send");
+
+		std::byte buffer[4096];
+		const auto nbytes = s.Receive(buffer);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to receive");
+		if (nbytes == 0)
+			throw std::runtime_error("Server closed the connection prematurely");
+	}
+}
+
+int
+main(int argc, char **argv)
+try {
+	if (argc < 4 || argc > 5)
+		throw Usage{};
+
+	const char *const path = argv[1];
+	const unsigned n_connections = std::strtoul(argv[2], nullptr, 10);
+	const unsigned n_requests = std::strtoul(argv[3], nullptr, 10);
+	const std::string_view request = argc > 4 ? std::string_view{argv[4]} : "PING"sv;
+
+	if (n_connections == 0 || n_requests == 0)
+		throw Usage{};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::jthread> threads;
+	threads.reserve(n_connections);
+	for (unsigned i = 0; i < n_connections; ++i)
+		threads.emplace_back([=](){
+			try {
+				RunConnection(path, request, n_requests);
+			} catch (...) {
+				PrintException(std::current_exception());
+				std::_Exit(EXIT_FAILURE);
+			}
+		});
+
+	threads.clear();
+
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+	const uint_least64_t total = uint_least64_t(n_connections) * n_requests;
+
+	fmt::print("{} requests in {:.3f}s: {:.0f} requests/s\n",
+		   total, duration.count(), double(total) / duration.count());
+
+	return EXIT_SUCCESS;
+} catch (Usage) {
+	fmt::print(stderr, "Usage: {} PATH CONNECTIONS REQUESTS [COMMAND]\n",
+		   argv[0]);
+	return EX_USAGE;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
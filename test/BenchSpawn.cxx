@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Measures the latency of launching a process with ExecPipe()
+ * (posix_spawn() from this process) and with the spawner process.
+ * The optional BALLAST argument allocates (and touches) this many
+ * megabytes after the spawner has been started, to simulate a
+ * daemon with a large address space.
+ */
+
+#include "Spawner.hxx"
+#include "SpawnClient.hxx"
+#include "ExecPipe.hxx"
+#include "Action.hxx" // for StderrOption
+#include "lib/fmt/SystemError.hxx"
+#include "io/Pipe.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm> // for std::sort()
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <signal.h>
+#include <sysexits.h> // for EX_*
+
+struct Usage {};
+
+using Clock = std::chrono::steady_clock;
+using Duration = std::chrono::duration<double, std::micro>;
+
+static constexpr const char *args[] = {"/bin/true", nullptr};
+static constexpr const char *env[] = {nullptr};
+
+static void
+PrintResult(const char *name, std::vector<Duration> &samples) noexcept
+{
+	std::sort(samples.begin(), samples.end());
+
+	const auto percentile = [&samples](unsigned p){
+		return samples[(samples.size() - 1) * p / 100].count();
+	};
+
+	fmt::print("{}: p50={:.1f}us p99={:.1f}us max={:.1f}us\n",
+		   name, percentile(50), percentile(99),
+		   samples.back().count());
+}
+
+int
+main(int argc, char **argv)
+try {
+	if (argc < 2 || argc > 3)
+		throw Usage{};
+
+	const unsigned n = std::strtoul(argv[1], nullptr, 10);
+	const std::size_t ballast_mb = argc > 2
+		? std::strtoul(argv[2], nullptr, 10)
+		: 0;
+
+	if (n == 0)
+		throw Usage{};
+
+	/* let the kernel reap the posix_spawn() children */
+	signal(SIGCHLD, SIG_IGN);
+
+	const auto spawner = StartSpawner();
+
+	const std::size_t ballast_size = ballast_mb * 1024 * 1024;
+	const auto ballast = std::make_unique_for_overwrite<std::byte[]>(ballast_size);
+	std::fill_n(ballast.get(), ballast_size, std::byte{0xff});
+
+	std::vector<Duration> samples;
+	samples.reserve(n);
+
+	for (unsigned i = 0; i < n; ++i) {
+		const auto start = Clock::now();
+		ExecPipe(args[0], args, env, FileDescriptor::Undefined(),
+			 FileDescriptor::Undefined(),
+			 StderrOption::JOURNAL);
+		samples.emplace_back(Clock::now() - start);
+	}
+
+	PrintResult("posix_spawn", samples);
+	samples.clear();
+
+	/* with the spawner, the daemon's event loop is blocked only
+	   while sending the request */
+	std::vector<Duration> send_samples;
+	send_samples.reserve(n);
+
+	for (unsigned i = 0; i < n; ++i) {
+		const auto start = Clock::now();
+		auto [r, w] = CreatePipe();
+		auto response = SendSpawnRequest(spawner, args[0], args, env,
+						 FileDescriptor::Undefined(),
+						 w, FileDescriptor::Undefined(),
+						 FileDescriptor::Undefined());
+		send_samples.emplace_back(Clock::now() - start);
+		auto result = ReceiveSpawnResponse(response);
+		if (!result)
+			throw std::runtime_error{"Spawner has died"};
+		if (result->error != 0)
+			throw FmtErrno(result->error, "Failed to execute {:?}", args[0]);
+		CheckSpawnExec(result->exec_pipe, args[0]);
+		samples.emplace_back(Clock::now() - start);
+	}
+
+	PrintResult("spawner (send)", send_samples);
+	PrintResult("spawner (total)", samples);
+
+	return EXIT_SUCCESS;
+} catch (Usage) {
+	fmt::print(stderr, "Usage: {} COUNT [BALLAST_MB]\n", argv[0]);
+	return EX_USAGE;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Action.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max()
+
+/**
+ * The #Action is stored in a Lua userdata, so it should be only as
+ * large as its largest alternative; none of them should contain large
+ * inline arrays.
+ */
+TEST(Action, Size)
+{
+	constexpr std::size_t limit = 256;
+
+	EXPECT_LE(sizeof(ErrorAction), limit);
+	EXPECT_LE(sizeof(FadeChildrenAction), limit);
+	EXPECT_LE(sizeof(FlushHttpCacheAction), limit);
+	EXPECT_LE(sizeof(ExecPipeAction), limit);
+	EXPECT_LE(sizeof(ExecTemplateAction), limit);
+#ifdef HAVE_CURL
+	EXPECT_LE(sizeof(HttpRequestAction), limit);
+#endif
+
+	EXPECT_LE(sizeof(Action), limit);
+	EXPECT_LE(sizeof(Action), std::max({
+		sizeof(ErrorAction),
+		sizeof(FadeChildrenAction),
+		sizeof(FlushHttpCacheAction),
+		sizeof(ExecPipeAction),
+		sizeof(ExecTemplateAction),
+#ifdef HAVE_CURL
+		sizeof(HttpRequestAction),
+#endif
+	}) + alignof(Action));
+}
+
+TEST(Action, Alternatives)
+{
+	Action action{ExecPipeAction{.exec = {"/bin/true"}}};
+	ASSERT_TRUE(std::holds_alternative<ExecPipeAction>(action));
+
+	const auto *exec = std::get_if<ExecPipeAction>(&action);
+	ASSERT_NE(exec, nullptr);
+	EXPECT_EQ(exec->exec.size(), 1U);
+	EXPECT_EQ(exec->stderr, StderrOption::JOURNAL);
+	EXPECT_EQ(std::get_if<ErrorAction>(&action), nullptr);
+
+	action = ErrorAction{.message = "foo"};
+	ASSERT_TRUE(std::holds_alternative<ErrorAction>(action));
+	EXPECT_EQ(std::get<ErrorAction>(action).message, "foo");
+}
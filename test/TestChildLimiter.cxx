@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ChildLimiter.hxx"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct TestWaiter final : ChildSlotWaiter {
+	bool granted = false;
+
+	explicit TestWaiter(std::string cgroup, uid_t uid=0) noexcept
+		:ChildSlotWaiter(ChildOwner{std::move(cgroup), uid}) {}
+
+	ChildSlot TakeSlot(ChildLimiter &limiter) noexcept {
+		return {limiter, StealOwner()};
+	}
+
+	void OnChildSlotGranted() noexcept override {
+		granted = true;
+	}
+};
+
+} // anonymous namespace
+
+using Result = ChildLimiter::AcquireResult;
+
+TEST(ChildLimiter, Global)
+{
+	ChildLimiter limiter;
+	limiter.SetLimits({.max_children = 2, .max_queue = 1});
+
+	TestWaiter a{"/a"}, b{"/b"}, c{"/c"}, d{"/d"};
+	EXPECT_EQ(limiter.Acquire(a), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(b), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(c), Result::QUEUED);
+	EXPECT_EQ(limiter.Acquire(d), Result::REJECTED);
+
+	auto slot_a = a.TakeSlot(limiter);
+	auto slot_b = b.TakeSlot(limiter);
+	EXPECT_FALSE(c.granted);
+
+	/* releasing a slot assigns it to the first waiter */
+	slot_a.Release();
+	EXPECT_TRUE(c.granted);
+	EXPECT_FALSE(limiter.Cancel(c));
+
+	auto slot_c = c.TakeSlot(limiter);
+
+	/* the queue is empty again */
+	EXPECT_EQ(limiter.Acquire(d), Result::QUEUED);
+	EXPECT_TRUE(limiter.Cancel(d));
+	EXPECT_FALSE(limiter.Cancel(d));
+
+	slot_b.Release();
+	EXPECT_FALSE(d.granted);
+}
+
+TEST(ChildLimiter, PerCgroup)
+{
+	ChildLimiter limiter;
+	limiter.SetLimits({.max_children = 3, .max_per_cgroup = 1, .max_queue = 4});
+
+	TestWaiter a1{"/a"}, a2{"/a"}, b1{"/b"}, b2{"/b"};
+	EXPECT_EQ(limiter.Acquire(a1), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(a2), Result::QUEUED);
+	EXPECT_EQ(limiter.Acquire(b1), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(b2), Result::QUEUED);
+
+	auto slot_a1 = a1.TakeSlot(limiter);
+	auto slot_b1 = b1.TakeSlot(limiter);
+
+	/* "/a2" is still held up by its per-cgroup limit, but that
+	   does not block "/b2" */
+	slot_b1.Release();
+	EXPECT_FALSE(a2.granted);
+	EXPECT_TRUE(b2.granted);
+
+	slot_a1.Release();
+	EXPECT_TRUE(a2.granted);
+
+	auto slot_a2 = a2.TakeSlot(limiter);
+	auto slot_b2 = b2.TakeSlot(limiter);
+}
+
+TEST(ChildLimiter, NoCgroup)
+{
+	ChildLimiter limiter;
+	limiter.SetLimits({.max_per_cgroup = 1, .max_queue = 4});
+
+	/* clients without a cgroup are not subject to the
+	   per-cgroup limit */
+	TestWaiter a{""}, b{""};
+	EXPECT_EQ(limiter.Acquire(a), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(b), Result::GRANTED);
+
+	auto slot_a = a.TakeSlot(limiter);
+	auto slot_b = b.TakeSlot(limiter);
+}
+
+TEST(ChildLimiter, AddCgroupLimit)
+{
+	ChildLimiter limiter;
+	limiter.SetLimits({.max_children = 8, .max_queue = 4});
+
+	/* the cgroup is counted even without a per-cgroup limit */
+	TestWaiter a1{"/a"}, a2{"/a"};
+	EXPECT_EQ(limiter.Acquire(a1), Result::GRANTED);
+	auto slot_a1 = a1.TakeSlot(limiter);
+
+	limiter.SetLimits({.max_children = 8, .max_per_cgroup = 1, .max_queue = 4});
+	EXPECT_EQ(limiter.Acquire(a2), Result::QUEUED);
+
+	slot_a1.Release();
+	EXPECT_TRUE(a2.granted);
+
+	auto slot_a2 = a2.TakeSlot(limiter);
+}
+
+TEST(ChildLimiter, PerUid)
+{
+	ChildLimiter limiter;
+	limiter.SetLimits({.max_per_uid = 1, .max_queue = 4});
+
+	TestWaiter a{"", 1}, b{"", 1}, c{"", 2};
+	EXPECT_EQ(limiter.Acquire(a), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(b), Result::QUEUED);
+	EXPECT_EQ(limiter.Acquire(c), Result::GRANTED);
+
+	auto slot_a = a.TakeSlot(limiter);
+	auto slot_c = c.TakeSlot(limiter);
+
+	slot_c.Release();
+	EXPECT_FALSE(b.granted);
+
+	slot_a.Release();
+	EXPECT_TRUE(b.granted);
+
+	auto slot_b = b.TakeSlot(limiter);
+}
+
+TEST(ChildLimiter, SetLimits)
+{
+	ChildLimiter limiter;
+	limiter.SetLimits({.max_children = 1, .max_queue = 4});
+
+	TestWaiter a{"/a"}, b{"/b"};
+	EXPECT_EQ(limiter.Acquire(a), Result::GRANTED);
+	EXPECT_EQ(limiter.Acquire(b), Result::QUEUED);
+
+	auto slot_a = a.TakeSlot(limiter);
+
+	/* raising the limit assigns a slot to the waiter */
+	limiter.SetLimits({.max_children = 2, .max_queue = 4});
+	EXPECT_TRUE(b.granted);
+
+	auto slot_b = b.TakeSlot(limiter);
+}
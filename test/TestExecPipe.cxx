@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ExecPipe.hxx"
+#include "util/SpanCast.hxx"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using std::string_view_literals::operator""sv;
+
+static std::string
+ReadAll(FileDescriptor fd)
+{
+	std::string result;
+
+	while (true) {
+		std::array<std::byte, 4096> buffer;
+		const auto nbytes = fd.Read(buffer);
+		if (nbytes < 0)
+			throw std::runtime_error{"Failed to read"};
+
+		if (nbytes == 0)
+			return result;
+
+		result.append(ToStringView(std::span{buffer}.first(nbytes)));
+	}
+}
+
+TEST(CreateStdinPipe, Empty)
+{
+	const auto r = CreateStdinPipe({});
+	ASSERT_TRUE(r.IsDefined());
+
+	/* the write end has been closed */
+	EXPECT_EQ(ReadAll(r), ""sv);
+}
+
+TEST(CreateStdinPipe, Data)
+{
+	const auto data = "hello world\n"sv;
+
+	const auto r = CreateStdinPipe(AsBytes(data));
+	EXPECT_EQ(ReadAll(r), data);
+}
+
+TEST(CreateStdinPipe, Large)
+{
+	/* the largest possible request body fits */
+	const std::string data(16384, 'x');
+
+	const auto r = CreateStdinPipe(AsBytes(data));
+	EXPECT_EQ(ReadAll(r), data);
+}
+
+TEST(CreateStdinPipe, TooLarge)
+{
+	/* this does not fit into the pipe buffer; it is rejected
+	   instead of blocking */
+	const std::string data(1024 * 1024, 'x');
+
+	EXPECT_THROW(CreateStdinPipe(AsBytes(data)), std::runtime_error);
+}
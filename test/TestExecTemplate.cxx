@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ExecTemplate.hxx"
+#include "Action.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string_view>
+
+using std::string_view_literals::operator""sv;
+
+TEST(ExecTemplate, Basic)
+{
+	const ExecTemplate t{ExecPipeAction{
+		.exec = {"/usr/bin/foo", "--bar", ""},
+		.env = {"A=1", "B=2"},
+		.stdin = StdinOption::BODY,
+		.stderr = StderrOption::PIPE,
+		.cgroup_client = true,
+	}};
+
+	const auto args = t.GetArgs();
+	ASSERT_EQ(args.size(), 3U);
+	EXPECT_EQ(args[0], "/usr/bin/foo"sv);
+	EXPECT_EQ(args[1], "--bar"sv);
+	EXPECT_EQ(args[2], ""sv);
+
+	const auto *const*argv = t.GetArgv();
+	EXPECT_EQ(argv[0], args[0]);
+	EXPECT_EQ(argv[3], nullptr);
+
+	const auto *const*env = t.GetEnv();
+	ASSERT_NE(env[0], nullptr);
+	EXPECT_EQ(env[0], "A=1"sv);
+	ASSERT_NE(env[1], nullptr);
+	EXPECT_EQ(env[1], "B=2"sv);
+	EXPECT_EQ(env[2], nullptr);
+
+	EXPECT_EQ(t.GetStdinOption(), StdinOption::BODY);
+	EXPECT_EQ(t.GetStderrOption(), StderrOption::PIPE);
+	EXPECT_TRUE(t.IsCgroupClient());
+}
+
+TEST(ExecTemplate, NoEnv)
+{
+	const ExecTemplate t{ExecPipeAction{.exec = {"/bin/true"}}};
+
+	ASSERT_EQ(t.GetArgs().size(), 1U);
+	EXPECT_EQ(t.GetArgv()[0], "/bin/true"sv);
+	EXPECT_EQ(t.GetArgv()[1], nullptr);
+	EXPECT_EQ(t.GetEnv()[0], nullptr);
+	EXPECT_EQ(t.GetStdinOption(), StdinOption::NONE);
+	EXPECT_EQ(t.GetStderrOption(), StderrOption::JOURNAL);
+	EXPECT_FALSE(t.IsCgroupClient());
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "LruCache.hxx"
+
+#include <gtest/gtest.h>
+
+using std::string_view_literals::operator""sv;
+using namespace std::chrono_literals;
+
+static constexpr LruCache::Clock::time_point t0{};
+static constexpr auto forever = t0 + 1h;
+
+TEST(LruCache, Basic)
+{
+	LruCache cache{4096};
+
+	EXPECT_EQ(cache.Get("foo"sv, t0), nullptr);
+
+	cache.Set("foo"sv, "bar"sv, forever);
+	cache.Set("abc"sv, "def"sv, forever);
+	EXPECT_EQ(cache.GetItemCount(), 2U);
+	EXPECT_EQ(cache.GetSize(), 2 * (6 + LruCache::ITEM_OVERHEAD));
+
+	const auto *value = cache.Get("foo"sv, t0);
+	ASSERT_NE(value, nullptr);
+	EXPECT_EQ(*value, "bar"sv);
+
+	/* replace */
+	cache.Set("foo"sv, "barbaz"sv, forever);
+	value = cache.Get("foo"sv, t0);
+	ASSERT_NE(value, nullptr);
+	EXPECT_EQ(*value, "barbaz"sv);
+	EXPECT_EQ(cache.GetItemCount(), 2U);
+	EXPECT_EQ(cache.GetSize(), 15 + 2 * LruCache::ITEM_OVERHEAD);
+
+	EXPECT_TRUE(cache.Remove("foo"sv));
+	EXPECT_FALSE(cache.Remove("foo"sv));
+	EXPECT_EQ(cache.Get("foo"sv, t0), nullptr);
+	EXPECT_EQ(cache.GetItemCount(), 1U);
+
+	cache.Clear();
+	EXPECT_EQ(cache.GetItemCount(), 0U);
+	EXPECT_EQ(cache.GetSize(), 0U);
+
+	EXPECT_EQ(cache.GetStats().hits, 2U);
+	EXPECT_EQ(cache.GetStats().misses, 2U);
+}
+
+TEST(LruCache, Expire)
+{
+	LruCache cache{4096};
+
+	cache.Set("foo"sv, "bar"sv, t0 + 10s);
+	EXPECT_NE(cache.Get("foo"sv, t0 + 9s), nullptr);
+	EXPECT_EQ(cache.Get("foo"sv, t0 + 10s), nullptr);
+	EXPECT_EQ(cache.GetItemCount(), 0U);
+	EXPECT_EQ(cache.GetSize(), 0U);
+	EXPECT_EQ(cache.GetStats().expirations, 1U);
+}
+
+TEST(LruCache, Evict)
+{
+	/* room for exactly three items with one-byte keys and
+	   values */
+	LruCache cache{3 * (2 + LruCache::ITEM_OVERHEAD)};
+
+	cache.Set("a"sv, "1"sv, forever);
+	cache.Set("b"sv, "2"sv, forever);
+	cache.Set("c"sv, "3"sv, forever);
+	EXPECT_EQ(cache.GetItemCount(), 3U);
+
+	/* "a" becomes the most recently used item, so "b" gets
+	   evicted */
+	EXPECT_NE(cache.Get("a"sv, t0), nullptr);
+	cache.Set("d"sv, "4"sv, forever);
+
+	EXPECT_EQ(cache.GetItemCount(), 3U);
+	EXPECT_EQ(cache.GetStats().evictions, 1U);
+	EXPECT_NE(cache.Get("a"sv, t0), nullptr);
+	EXPECT_EQ(cache.Get("b"sv, t0), nullptr);
+	EXPECT_NE(cache.Get("c"sv, t0), nullptr);
+	EXPECT_NE(cache.Get("d"sv, t0), nullptr);
+
+	/* an item which needs two slots evicts the two least
+	   recently used ones ("a" and "c") */
+	cache.Set("e"sv, std::string(LruCache::ITEM_OVERHEAD + 3, 'x'), forever);
+	EXPECT_EQ(cache.GetItemCount(), 2U);
+	EXPECT_EQ(cache.GetStats().evictions, 3U);
+	EXPECT_NE(cache.Get("d"sv, t0), nullptr);
+	EXPECT_NE(cache.Get("e"sv, t0), nullptr);
+}
+
+TEST(LruCache, TooLarge)
+{
+	LruCache cache{256};
+
+	cache.Set("foo"sv, "bar"sv, forever);
+	cache.Set("foo"sv, std::string(256, 'x'), forever);
+
+	/* the large item was not stored, and the old item with the
+	   same key is gone */
+	EXPECT_EQ(cache.GetItemCount(), 0U);
+	EXPECT_EQ(cache.Get("foo"sv, t0), nullptr);
+	EXPECT_EQ(cache.GetStats().evictions, 0U);
+}
+
+TEST(LruCache, RemovePrefix)
+{
+	LruCache cache{4096};
+
+	cache.Set("foo"sv, "1"sv, forever);
+	cache.Set("foobar"sv, "2"sv, forever);
+	cache.Set("fo"sv, "3"sv, forever);
+	cache.Set("bar"sv, "4"sv, forever);
+
+	EXPECT_EQ(cache.RemovePrefix("foo"sv), 2U);
+	EXPECT_EQ(cache.GetItemCount(), 2U);
+	EXPECT_EQ(cache.GetSize(), 7 + 2 * LruCache::ITEM_OVERHEAD);
+	EXPECT_EQ(cache.Get("foo"sv, t0), nullptr);
+	EXPECT_NE(cache.Get("fo"sv, t0), nullptr);
+	EXPECT_NE(cache.Get("bar"sv, t0), nullptr);
+
+	EXPECT_EQ(cache.RemovePrefix("x"sv), 0U);
+	EXPECT_EQ(cache.RemovePrefix({}), 2U);
+	EXPECT_EQ(cache.GetItemCount(), 0U);
+}
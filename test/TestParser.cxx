@@ -3,10 +3,14 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "Entity.hxx"
+#include "EntityView.hxx"
 #include "Parser.hxx"
 
 #include <gtest/gtest.h>
 
+#include <vector>
+
+using std::string_literals::operator""s;
 using std::string_view_literals::operator""sv;
 
 TEST(Parser, Simple)
@@ -51,6 +55,18 @@ TEST(Parser, Headers)
 	EXPECT_EQ(e.headers.find("def")->second, "2");
 }
 
+TEST(Parser, DuplicateHeaders)
+{
+	const auto e = ParseEntity("FOO\n"
+				   "def: 2\n"
+				   "abc: 1\n"
+				   "def: 3");
+	EXPECT_EQ(e.headers.size(), 2u);
+	EXPECT_EQ(e.headers.begin()->first, "abc");
+	EXPECT_EQ(e.headers.find("abc")->second, "1");
+	EXPECT_EQ(e.headers.find("def")->second, "2");
+}
+
 TEST(Parser, Full)
 {
 	static constexpr std::string_view payload =
@@ -148,3 +164,98 @@ TEST(Parser, QuotedMixedArgs)
 	EXPECT_EQ(*std::next(e.args.begin(), 2), "another");
 	EXPECT_EQ(std::next(e.args.begin(), 3), e.args.end());
 }
+
+static std::vector<std::string>
+CollectArguments(const EntityView &e)
+{
+	std::vector<std::string> result;
+	e.ForEachArgument([&result](std::string_view value){
+		result.emplace_back(value);
+	});
+	return result;
+}
+
+TEST(ParserView, Simple)
+{
+	const auto e = ParseEntityView("OK\n\n");
+	EXPECT_EQ(e.command, "OK");
+	EXPECT_TRUE(CollectArguments(e).empty());
+	EXPECT_TRUE(e.headers.empty());
+	EXPECT_TRUE(e.body.empty());
+}
+
+TEST(ParserView, Borrowed)
+{
+	static constexpr std::string_view payload =
+		"FOO one \"two\"\n"
+		"abc: 1\n"
+		"\0"
+		"body"sv;
+	const auto e = ParseEntityView(payload);
+
+	/* everything points into the payload */
+	EXPECT_EQ(e.command.data(), payload.data());
+	EXPECT_EQ(e.args, "one \"two\"");
+	EXPECT_EQ(e.headers, "abc: 1");
+	EXPECT_EQ(e.body, "body");
+	EXPECT_EQ(e.body.data(), payload.data() + payload.size() - 4);
+}
+
+TEST(ParserView, Arguments)
+{
+	const auto e = ParseEntityView(R"(FOO unquoted "quoted" "esc\"aped" "" another)");
+	EXPECT_EQ(e.command, "FOO");
+
+	const auto args = CollectArguments(e);
+	ASSERT_EQ(args.size(), 5u);
+	EXPECT_EQ(args[0], "unquoted");
+	EXPECT_EQ(args[1], "quoted");
+	EXPECT_EQ(args[2], "esc\"aped");
+	EXPECT_EQ(args[3], "");
+	EXPECT_EQ(args[4], "another");
+}
+
+TEST(ParserView, Headers)
+{
+	const auto e = ParseEntityView("FOO\n"
+				       "abc: 1\n"
+				       "def:2\n"
+				       "abc: 3\n"
+				       "\n"
+				       "ignored: 4");
+	EXPECT_EQ(e.FindHeader("abc"), "1");
+	EXPECT_EQ(e.FindHeader("def"), "2");
+	EXPECT_EQ(e.FindHeader("ignored").data(), nullptr);
+	EXPECT_EQ(e.FindHeader("xyz").data(), nullptr);
+
+	unsigned n = 0;
+	e.ForEachHeader([&n](std::string_view, std::string_view){ ++n; });
+	EXPECT_EQ(n, 3u);
+
+	const auto entity = e.ToEntity();
+	EXPECT_EQ(entity.headers.size(), 2u);
+	EXPECT_EQ(entity.headers.find("abc")->second, "1");
+}
+
+TEST(ParserView, Relocate)
+{
+	const std::string a = "FOO \"one\"\nabc: 1\n"s + '\0' + "body"s;
+	const std::string b = a;
+
+	const auto e = ParseEntityView(a).Relocate(a.data(), b.data());
+	EXPECT_EQ(e.command.data(), b.data());
+	EXPECT_EQ(e.args.data(), b.data() + 4);
+	EXPECT_EQ(CollectArguments(e).front(), "one");
+	EXPECT_EQ(e.FindHeader("abc"), "1");
+	EXPECT_EQ(e.body, "body");
+}
+
+TEST(ParserView, Malformed)
+{
+	EXPECT_THROW(ParseEntityView(""), std::runtime_error);
+	EXPECT_THROW(ParseEntityView("FOO-BAR"), std::runtime_error);
+	EXPECT_THROW(ParseEntityView("FOO \"unterminated"), std::runtime_error);
+	EXPECT_THROW(ParseEntityView("FOO \"garbage\"x"), std::runtime_error);
+	EXPECT_THROW(ParseEntityView("FOO a+b"), std::runtime_error);
+	EXPECT_THROW(ParseEntityView("FOO\nno_colon"), std::runtime_error);
+}
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Differential tests comparing the single-pass parser with the
+ * original (simple but slow) implementation.
+ */
+
+#include "Entity.hxx"
+#include "Parser.hxx"
+#include "Verify.hxx"
+#include "net/SocketProtocolError.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cassert>
+#include <random>
+
+using std::string_view_literals::operator""sv;
+
+namespace Reference {
+
+static std::string_view
+NextSplit(std::string_view &buffer, char separator) noexcept
+{
+	auto [line, rest] = Split(buffer, separator);
+	buffer = rest;
+	return line;
+}
+
+static std::string_view
+NextLine(std::string_view &buffer) noexcept
+{
+	return NextSplit(buffer, '\n');
+}
+
+static std::string_view
+NextUnquoted(std::string_view &buffer)
+{
+	std::string_view value = NextSplit(buffer, ' ');
+
+	if (!IsValidUnquotedParameter(value))
+		throw SocketProtocolError{"Bad unquoted parameter"};
+
+	return value;
+}
+
+static std::string
+NextQuoted(std::string_view &_src)
+{
+	assert(!_src.empty());
+	assert(_src.front() == '"');
+
+	const auto src = _src;
+	std::string dest;
+
+	for (std::size_t i = 1; i < src.size(); ++i) {
+		char ch = src[i];
+
+		if (ch == '"') {
+			if (const auto rest = src.substr(i + 1);
+			    rest.empty())
+				_src = rest;
+			else if (rest.front() == ' ')
+				_src = rest.substr(1);
+			else
+				throw SocketProtocolError{"Garbage after closing quote"};
+			return dest;
+		}
+
+		if (ch == '\\') {
+			if (++i >= src.size())
+				break;
+
+			ch = src[i];
+		}
+
+		dest.push_back(ch);
+	}
+
+	throw SocketProtocolError{"Closing quote missing"};
+}
+
+static std::string
+NextValue(std::string_view &src)
+{
+	assert(!src.empty());
+
+	if (src.front() == '"')
+		return NextQuoted(src);
+	else
+		return std::string{NextUnquoted(src)};
+}
+
+static Entity
+ParseEntity(std::string_view payload)
+{
+	Entity entity;
+
+	const auto [_payload, body] = Split(payload, '\0');
+	if (!body.empty())
+		entity.body = std::string{body};
+	payload = _payload;
+
+	auto line = NextLine(payload);
+
+	const auto command = NextUnquoted(line);
+	CheckCommand(command);
+	entity.command = command;
+
+	auto args_tail = entity.args.before_begin();
+	while (true) {
+		line = StripLeft(line);
+		if (line.empty())
+			break;
+
+		args_tail = entity.args.emplace_after(args_tail, NextValue(line));
+	}
+
+	while (!(line = NextLine(payload)).empty()) {
+		auto [name, value] = Split(line, ':');
+		value = StripLeft(value);
+
+		if (value.data() == nullptr || !IsValidHeaderName(name) ||
+		    !IsValidHeaderValue(value))
+			throw SocketProtocolError("Bad header syntax");
+
+		entity.headers.emplace(name, value);
+	}
+
+	return entity;
+}
+
+} // namespace Reference
+
+/**
+ * Parse with both implementations and compare the results (or the
+ * error messages).
+ */
+static void
+Compare(std::string_view payload)
+{
+	SCOPED_TRACE(testing::PrintToString(std::string{payload}));
+
+	std::string expected_error;
+	Entity expected;
+	try {
+		expected = Reference::ParseEntity(payload);
+	} catch (const std::exception &e) {
+		expected_error = e.what();
+	}
+
+	std::string actual_error;
+	Entity actual;
+	try {
+		actual = ParseEntity(payload);
+	} catch (const std::exception &e) {
+		actual_error = e.what();
+	}
+
+	EXPECT_EQ(actual_error, expected_error);
+	if (!expected_error.empty() || !actual_error.empty())
+		return;
+
+	EXPECT_EQ(actual.command, expected.command);
+	EXPECT_EQ(actual.args, expected.args);
+	EXPECT_EQ(actual.headers, expected.headers);
+	EXPECT_EQ(actual.body, expected.body);
+}
+
+TEST(ParserReference, Corpus)
+{
+	static constexpr std::string_view corpus[] = {
+		""sv,
+		" "sv,
+		"\n"sv,
+		"\0"sv,
+		"OK"sv,
+		"OK\n"sv,
+		"OK\n\n"sv,
+		"OK \n"sv,
+		"OK  one   two  "sv,
+		"OK\tone"sv,
+		"OK-X"sv,
+		"OK-X y"sv,
+		"OK-\tX"sv,
+		"O+K"sv,
+		" OK"sv,
+		"OK\0body"sv,
+		"OK\0"sv,
+		"OK one\0body\n\0more"sv,
+		"OK \"one\0\""sv,
+		"OK \"\""sv,
+		"OK \"\"\""sv,
+		"OK \"\" \"\""sv,
+		"OK \"a\"b"sv,
+		"OK \"a\\\""sv,
+		"OK \"a\\"sv,
+		"OK \"a\\\n\""sv,
+		"OK \"a\\\0\""sv,
+		"OK \"a\\\\\" b"sv,
+		"OK \"\x7f\x80\t\r\""sv,
+		"OK a\"b"sv,
+		"OK a b-c d_e"sv,
+		"OK \x7f"sv,
+		"OK\nabc: 1"sv,
+		"OK\nabc:1\n"sv,
+		"OK\nabc:\n"sv,
+		"OK\nabc:   \n"sv,
+		"OK\nabc:\t 1 2 3\n"sv,
+		"OK\nabc: 1\r\n"sv,
+		"OK\nabc: \x7f\n"sv,
+		"OK\nabc: \x80\n"sv,
+		"OK\nabc\n"sv,
+		"OK\n:1\n"sv,
+		"OK\na b: 1\n"sv,
+		"OK\n\r\n"sv,
+		"OK\nabc: 1\n\ngarbage\x01\nxyz"sv,
+		"OK\nabc: 1\n\ngarbage\0body"sv,
+		"OK\nabc: 1\0body"sv,
+		"OK\nabc: 1\n\0body"sv,
+		"OK\nabc: 1\ndef: 2\nabc: 3\n"sv,
+		"OK\nabc: 0123456789abcdef0123456789abcdef\x7f" "0123456789abcdef\n"sv,
+		"OK\nabc: 0123456789abcdef0123456789abcdef\x01" "0123456789abcdef\n"sv,
+		"OK \"0123456789abcdef0123456789abcdef\\\"0123456789abcdef\""sv,
+		"OK \"0123456789abcdef0123456789abcdef\n0123456789abcdef\""sv,
+	};
+
+	for (const auto i : corpus)
+		Compare(i);
+}
+
+TEST(ParserReference, Random)
+{
+	/* an alphabet which is rich in special characters */
+	static constexpr std::string_view alphabet =
+		"OKab1_-\"\\ :\n\0\t\r\x01\x7f\x80\xff"sv;
+
+	std::mt19937 rng{42};
+	std::uniform_int_distribution<std::size_t> length_dist{0, 48};
+	std::uniform_int_distribution<std::size_t> char_dist{0, alphabet.size() - 1};
+
+	for (unsigned n = 0; n < 100000; ++n) {
+		/* most random payloads would be rejected early, so
+		   start with a valid prefix most of the time */
+		std::string payload = n % 4 == 0 ? "" : n % 4 == 1 ? "OK " : "OK\nabc: ";
+
+		const std::size_t length = length_dist(rng);
+		for (std::size_t i = 0; i < length; ++i)
+			payload.push_back(alphabet[char_dist(rng)]);
+
+		Compare(payload);
+
+		if (HasFailure())
+			break;
+	}
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ReceiveBatch.hxx"
+#include "io/Iovec.hxx"
+#include "io/Pipe.hxx"
+#include "net/ScmRightsBuilder.hxx"
+#include "net/SendMessage.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/SpanCast.hxx"
+
+#include <gtest/gtest.h>
+
+#include <initializer_list>
+#include <stdexcept>
+#include <string_view>
+#include <utility> // for std::pair
+
+#include <sys/socket.h>
+
+using std::string_view_literals::operator""sv;
+
+static std::pair<UniqueSocketDescriptor, UniqueSocketDescriptor>
+CreateSocketPair()
+{
+	int sv[2];
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0)
+		throw std::runtime_error{"socketpair() failed"};
+
+	return {
+		UniqueSocketDescriptor{AdoptTag{}, sv[0]},
+		UniqueSocketDescriptor{AdoptTag{}, sv[1]},
+	};
+}
+
+static void
+Send(SocketDescriptor s, std::string_view payload,
+     std::initializer_list<FileDescriptor> fds)
+{
+	const struct iovec vec[] = {
+		MakeIovec(AsBytes(payload)),
+	};
+
+	MessageHeader m{vec};
+
+	ScmRightsBuilder<ReceiveBatch::MAX_FDS> rb(m);
+	for (const auto fd : fds)
+		rb.push_back(fd.Get());
+	rb.Finish(m);
+
+	SendMessage(s, m, 0);
+}
+
+/**
+ * Have all references to the write end of this pipe been closed?
+ */
+static bool
+IsWriteEndClosed(FileDescriptor r)
+{
+	r.SetNonBlocking();
+
+	std::byte buffer[16];
+	return r.Read(buffer) == 0;
+}
+
+TEST(ReceiveBatch, Fds)
+{
+	auto [a, b] = CreateSocketPair();
+
+	auto [r1, w1] = CreatePipe();
+	auto [r2, w2] = CreatePipe();
+
+	Send(a, "none"sv, {});
+	Send(a, "one"sv, {w1});
+	Send(a, "two"sv, {w2, w2});
+
+	/* only the copies in the datagrams remain */
+	w1.Close();
+	w2.Close();
+
+	ReceiveBatch batch;
+	ASSERT_EQ(batch.Receive(b), 3U);
+
+	EXPECT_EQ(ToStringView(batch[0].payload), "none"sv);
+	EXPECT_FALSE(batch[0].excess_fds);
+	EXPECT_FALSE(batch.StealFd(0).IsDefined());
+
+	EXPECT_EQ(ToStringView(batch[1].payload), "one"sv);
+	EXPECT_FALSE(batch[1].excess_fds);
+
+	/* more than one file descriptor: all of them have been
+	   closed */
+	EXPECT_EQ(ToStringView(batch[2].payload), "two"sv);
+	EXPECT_TRUE(batch[2].excess_fds);
+	EXPECT_FALSE(batch.StealFd(2).IsDefined());
+	EXPECT_TRUE(IsWriteEndClosed(r2));
+
+	/* the one file descriptor is passed to the caller */
+	auto fd = batch.StealFd(1);
+	ASSERT_TRUE(fd.IsDefined());
+	EXPECT_FALSE(IsWriteEndClosed(r1));
+	fd.Close();
+	EXPECT_TRUE(IsWriteEndClosed(r1));
+}
+
+TEST(ReceiveBatch, CloseUnstolen)
+{
+	auto [a, b] = CreateSocketPair();
+	auto [r, w] = CreatePipe();
+
+	Send(a, "one"sv, {w});
+	w.Close();
+
+	ReceiveBatch batch;
+	ASSERT_EQ(batch.Receive(b), 1U);
+	EXPECT_FALSE(IsWriteEndClosed(r));
+
+	/* the next Receive() call closes file descriptors which
+	   were not taken */
+	EXPECT_EQ(batch.Receive(b), 0U);
+	EXPECT_TRUE(IsWriteEndClosed(r));
+}
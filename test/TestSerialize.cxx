@@ -2,7 +2,10 @@
 // Copyright CM4all GmbH
 // author: Max Kellermann <max.kellermann@ionos.com>
 
+#include "Arena.hxx"
 #include "Entity.hxx"
+#include "EntitySerializer.hxx"
+#include "Parser.hxx"
 
 #include <gtest/gtest.h>
 
@@ -76,3 +79,175 @@ TEST(Serialize, QuotedParameters)
 	const auto result = e.Serialize();
 	EXPECT_EQ(result, R"(FOO "" "\"" "\\" " ")");
 }
+
+TEST(Serialize, UnsortedHeaders)
+{
+	Entity e{
+		.command = "FOO",
+		.headers = {{"def", "2"}, {"abc", "1"}},
+	};
+
+	e.headers.emplace("xyz", "3");
+	e.headers.emplace("bcd", "4");
+	e.headers.emplace("abc", "ignored");
+
+	const auto result = e.Serialize();
+	EXPECT_EQ(result, "FOO\nabc:1\nbcd:4\ndef:2\nxyz:3\n");
+}
+
+TEST(HeaderMap, Basic)
+{
+	HeaderMap m;
+	EXPECT_TRUE(m.empty());
+	EXPECT_EQ(m.find("abc"), m.end());
+
+	EXPECT_TRUE(m.emplace("def", "2").second);
+	EXPECT_TRUE(m.emplace("abc", "1").second);
+	EXPECT_FALSE(m.emplace("abc", "3").second);
+	EXPECT_EQ(m.size(), 2u);
+	EXPECT_EQ(m.find("abc")->second, "1");
+	EXPECT_EQ(m.find("def")->second, "2");
+	EXPECT_EQ(m.find("ab"), m.end());
+	EXPECT_EQ(m.find("abcd"), m.end());
+	EXPECT_TRUE(m.contains("def"));
+	EXPECT_FALSE(m.contains("xyz"));
+
+	m.insert_or_assign("abc", "3");
+	m.insert_or_assign("xyz", "4");
+	EXPECT_EQ(m.size(), 3u);
+	EXPECT_EQ(m.find("abc")->second, "3");
+	EXPECT_EQ(m.begin()->first, "abc");
+	EXPECT_EQ(std::prev(m.end())->first, "xyz");
+
+	const HeaderMap copy = m;
+	EXPECT_EQ(copy, m);
+
+	m.clear();
+	EXPECT_TRUE(m.empty());
+	EXPECT_NE(copy, m);
+}
+
+static std::string
+Flatten(const EntitySerializer &s)
+{
+	std::string result;
+	for (const auto &i : s.GetVector())
+		result.append(static_cast<const char *>(i.iov_base), i.iov_len);
+	return result;
+}
+
+static bool
+PointsInto(const struct iovec &v, std::string_view s) noexcept
+{
+	return v.iov_base == s.data() && v.iov_len == s.size();
+}
+
+TEST(EntitySerializer, Everything)
+{
+	const Entity e{
+		.command = "FOO",
+		.args = {"one", "two words", "esc\"aped", "tab\there"},
+		.headers = {{"abc", "1"}, {"def", "2"}},
+		.body = std::string{"\x00\x01\x02\x03"sv},
+	};
+
+	const EntitySerializer s{e};
+	const auto expected = "FOO one \"two words\" \"esc\\\"aped\" \"tab here\"\nabc:1\ndef:2\n\0\x00\x01\x02\x03"sv;
+	EXPECT_EQ(Flatten(s), expected);
+	EXPECT_EQ(s.ToString(), expected);
+	EXPECT_EQ(s.GetSize(), expected.size());
+	EXPECT_EQ(e.Serialize(), expected);
+}
+
+TEST(EntitySerializer, ZeroCopy)
+{
+	const Entity e{
+		.command = "OK",
+		.args = {"unquoted", "with space"},
+		.headers = {{"abc", "1"}},
+		.body = std::string(65536, 'x'),
+	};
+
+	const EntitySerializer s{e};
+	const auto v = s.GetVector();
+	ASSERT_EQ(v.size(), 1u + 2 + 4 + 1 + 4 + 2);
+
+	EXPECT_TRUE(PointsInto(v.front(), e.command));
+	EXPECT_TRUE(PointsInto(v[2], e.args.front()));
+	EXPECT_TRUE(PointsInto(v[5], *std::next(e.args.begin())));
+	EXPECT_TRUE(PointsInto(v[8], e.headers.begin()->first));
+	EXPECT_TRUE(PointsInto(v[10], e.headers.begin()->second));
+	EXPECT_TRUE(PointsInto(v.back(), e.body));
+	EXPECT_EQ(s.GetSize(), 2 + 9 + 13 + 7 + 1 + 65536);
+}
+
+TEST(EntitySerializer, Arena)
+{
+	RequestArena arena;
+
+	const HeaderMap headers{{"exit_status", "75"}};
+	const std::string_view args[] = {"with \"quotes\""};
+
+	{
+		const EntitySerializer s{"ERROR"sv, args, headers, {}, &arena};
+		EXPECT_EQ(s.ToString(), "ERROR \"with \\\"quotes\\\"\"\nexit_status:75\n");
+		EXPECT_GT(arena.GetAllocated(), 0u);
+	}
+
+	const auto allocated = arena.Reset();
+	EXPECT_GE(allocated, 8 * sizeof(struct iovec));
+	EXPECT_EQ(arena.GetAllocated(), 0u);
+
+	/* the arena can be reused after Reset() */
+	{
+		const EntitySerializer s{"OK"sv, {}, {}, {}, &arena};
+		EXPECT_EQ(s.ToString(), "OK");
+	}
+
+	EXPECT_EQ(arena.Reset(), sizeof(struct iovec));
+}
+
+TEST(EntitySerializer, ArenaPool)
+{
+	RequestArenaPool pool;
+
+	const RequestArena *first;
+
+	{
+		const RequestArenaPool::Lease arena{pool};
+		first = &*arena;
+
+		const EntitySerializer s{"OK"sv, {}, {}, {}, &*arena};
+		EXPECT_GT(arena->GetAllocated(), 0u);
+	}
+
+	/* the arena is recycled (and has been reset) */
+	const RequestArenaPool::Lease a{pool};
+	EXPECT_EQ(&*a, first);
+	EXPECT_EQ(a->GetAllocated(), 0u);
+
+	/* a second one while the first is in use */
+	const RequestArenaPool::Lease b{pool};
+	EXPECT_NE(&*b, first);
+}
+
+TEST(EntitySerializer, ExtraHeaders)
+{
+	const Entity e{
+		.command = "OK",
+		.headers = {{"abc", "1"}},
+	};
+
+	const EntitySerializer::HeaderView extra[] = {{"request_id"sv, "42"sv}};
+
+	const EntitySerializer s{e, std::pmr::get_default_resource(), extra};
+	EXPECT_EQ(s.ToString(), "OK\nrequest_id:42\nabc:1\n");
+
+	/* extra headers without a HeaderMap */
+	const EntitySerializer s2{"ERROR"sv, {}, {}, {}, std::pmr::get_default_resource(), extra};
+	EXPECT_EQ(s2.ToString(), "ERROR\nrequest_id:42\n");
+
+	const auto parsed = ParseEntity(s2.ToString());
+	EXPECT_EQ(parsed.command, "ERROR");
+	EXPECT_EQ(parsed.headers, (HeaderMap{{"request_id", "42"}}));
+}
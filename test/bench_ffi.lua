@@ -0,0 +1,42 @@
+-- Benchmark configuration comparing request attribute access via
+-- the userdata (__index, interpreted) with the FFI view (traced by
+-- the LuaJIT compiler).
+--
+-- Run "cm4all-passage --config test/bench_ffi.lua", then compare:
+--
+--   BenchPassage /tmp/passage-bench-index.sock 16 100000 PING
+--   BenchPassage /tmp/passage-bench-ffi.sock 16 100000 PING
+
+local ffi = require('ffi')
+ffi.cdef(passage_ffi_cdef)
+
+-- how many times each handler checks the request fields, to make
+-- the cost of the field accesses stand out from the socket I/O
+local ROUNDS = 100
+
+passage_listen('/tmp/passage-bench-index.sock', function(request)
+  local n = 0
+  for i = 1, ROUNDS do
+    if request.command == 'PING' and request.uid ~= nil and request.pid > 0 then
+      n = n + 1
+    end
+  end
+  if n ~= ROUNDS then
+    return request:error('Mismatch')
+  end
+end)
+
+local PING = 'PING'
+
+passage_listen('/tmp/passage-bench-ffi.sock', function(request)
+  local r = ffi.cast('const struct passage_request *', request.ffi)
+  local n = 0
+  for i = 1, ROUNDS do
+    if r.command.size == #PING and ffi.string(r.command.data, r.command.size) == PING and r.uid >= 0 and r.pid > 0 then
+      n = n + 1
+    end
+  end
+  if n ~= ROUNDS then
+    return request:error('Mismatch')
+  end
+end)